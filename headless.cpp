@@ -16,6 +16,8 @@ void SceneViewer::run_headless(std::string& events) {
     initHeadlessVulkan();
 
     copyAllMeshVertexToBuffer();
+    flushBufferUploads();
+    waitUploads();
     startTime = std::chrono::high_resolution_clock::now();
 
     // headless loop
@@ -232,9 +234,8 @@ void SceneViewer::saveImage(std::string filename) {
     VkSubresourceLayout subResourceLayout;
     vkGetImageSubresourceLayout(device, dstImage, &subResource, &subResourceLayout);
 
-    // Map image memory so we can start copying from it
-    char* data;
-    vkMapMemory(device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
+    // host visible memory stays mapped, start at the image's own offset
+    char* data = static_cast<char*>(dstImageMemory.mapped) + subResourceLayout.offset;
 
     const char* filename_c = filename.c_str();
     std::ofstream file(filename_c, std::ios::out | std::ios::binary);
@@ -264,8 +265,6 @@ void SceneViewer::saveImage(std::string filename) {
         data += subResourceLayout.rowPitch;
     }
     file.close();
-
-    vkUnmapMemory(device, dstImageMemory);
 }
 
 
@@ -357,9 +356,9 @@ void SceneViewer::recordHeadlessCommandBuffer(VkCommandBuffer commandBuffer) {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
     // bind vertex buffer
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    VkBuffer vertexBuffers[] = {vertexPositionBuffer, vertexAttributeBuffer};
+    VkDeviceSize offsets[] = {0, 0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
 
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
 
@@ -386,18 +385,22 @@ void SceneViewer::initHeadlessVulkan() {
     createDescriptorSetLayout();
     createGraphicsPipelines();
     createHeadlessCommandPool();
+    createUploadEngine();
     // what about frame buffers?
     createHeadlessFramebuffers();
 
     createVertexBuffer();
+    createMaterialBuffer();
     createUniformBuffers();
 
     createDescriptorPool();
     createDescriptorSets();
     createHeadlessCommandBuffers();
+    createRecordThreadPools(queueFamilyIndex);
     createSyncObjects();
 
     createDstImage();
+    memoryAllocator.dumpStats();
 }
 
 
@@ -421,48 +424,42 @@ void SceneViewer::createDstImage() {
     }
 
     vkGetImageMemoryRequirements(device, dstImage, &memRequirements);
-    VkMemoryAllocateInfo allocInfo {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-    };
-    result = vkAllocateMemory(device, &allocInfo, nullptr, &dstImageMemory);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate image memory!");
-    }
-    vkBindImageMemory(device, dstImage, dstImageMemory, 0);
+    dstImageMemory = memoryAllocator.allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+    vkBindImageMemory(device, dstImage, dstImageMemory.memory, dstImageMemory.offset);
 }
 
 
 void SceneViewer::headlessCleanup() {
     
-    vkFreeMemory(device, dstImageMemory, nullptr);
+    memoryAllocator.free(dstImageMemory);
     vkDestroyImage(device, dstImage, nullptr);
 
     vkDestroyImageView(device, depthImageView, nullptr);
     vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
+    memoryAllocator.free(depthImageMemory);
 
     vkDestroyFramebuffer(device, headlessFramebuffer, nullptr);
 
     vkDestroyImageView(device, colorImageView, nullptr);
     vkDestroyImage(device, colorImage, nullptr);
-    vkFreeMemory(device, colorImageMemory, nullptr);
+    memoryAllocator.free(colorImageMemory);
 
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-        vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-    }
+    vkDestroyBuffer(device, instanceRingBuffer, nullptr);
+    memoryAllocator.free(instanceRingMemory);
 
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-    vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
+    vkDestroyBuffer(device, vertexPositionBuffer, nullptr);
+    memoryAllocator.free(vertexPositionBufferMemory);
+    vkDestroyBuffer(device, vertexAttributeBuffer, nullptr);
+    memoryAllocator.free(vertexAttributeBufferMemory);
+    vkDestroyBuffer(device, materialBuffer, nullptr);
+    memoryAllocator.free(materialBufferMemory);
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
@@ -470,8 +467,11 @@ void SceneViewer::headlessCleanup() {
         vkDestroyFence(device, inFlightFences[i], nullptr);
     }
 
+    destroyUploadEngine();
+    destroyRecordThreadPools();
     vkDestroyCommandPool(device, commandPool, nullptr);
 
+    memoryAllocator.destroy();
     vkDestroyDevice(device, nullptr);
 
     if (enableValidationLayers) {
@@ -1,6 +1,7 @@
 #include "../scene_viewer.hpp"
 
 void SceneViewer::createCloudPipeline() {
+    pipelineVersion++;
     std::vector<char> vertShaderCode = readFile("shaders/cloud/vert.spv");
     std::vector<char> fragShaderCode = readFile("shaders/cloud/frag.spv");
 
@@ -245,8 +246,8 @@ void SceneViewer::createCloudDescriptorSets() {
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         VkDescriptorBufferInfo bufferInfo {
-            .buffer = uniformBuffers[i],
-            .offset = 0,
+            .buffer = instanceRingBuffer,
+            .offset = i * instanceRingStride,
             .range = sizeof(UniformBufferObject),
         };
 
@@ -375,6 +376,7 @@ void SceneViewer::createCloudImagesWithViews() {
 
     // then for noises
     createCloudNoiseImageWithView();
+    submitUploads();
 }
 
 void SceneViewer::createCloudUniformBuffers() {
@@ -386,7 +388,7 @@ void SceneViewer::createCloudUniformBuffers() {
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cloudUniformBuffers[i], cloudUniformBuffersMemory[i]);
-        vkMapMemory(device, cloudUniformBuffersMemory[i], 0, bufferSize, 0, &cloudUniformBuffersMapped[i]);
+        cloudUniformBuffersMapped[i] = cloudUniformBuffersMemory[i].mapped;
     }
 }
 
@@ -434,13 +436,13 @@ void SceneViewer::cleanCloudResources() {
 
     vkDestroyImageView(device, cloudNoiseImageView, nullptr);
     vkDestroyImage(device, cloudNoiseImage, nullptr);
-    vkFreeMemory(device, cloudNoiseImageMemory, nullptr);
+    memoryAllocator.free(cloudNoiseImageMemory);
 
     int cloudImageSize = cloudImageViews.size();
     for (int i=0; i<cloudImageSize; i++) {
         vkDestroyImageView(device, cloudImageViews[i], nullptr);
         vkDestroyImage(device, cloudImages[i], nullptr);
-        vkFreeMemory(device, cloudImageMemorys[i], nullptr);
+        memoryAllocator.free(cloudImageMemorys[i]);
     }
 
     // remove cloudSampler
@@ -456,14 +458,14 @@ void SceneViewer::cleanCloudResources() {
     // remove cloudUniformBuffers
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroyBuffer(device, cloudUniformBuffers[i], nullptr);
-        vkFreeMemory(device, cloudUniformBuffersMemory[i], nullptr);
+        memoryAllocator.free(cloudUniformBuffersMemory[i]);
     }
 
     // remove cloudIndexBuffers
     for (int i = 0; i < scene_config.id2clouds.size(); i++) {
         vkDestroyBuffer(device, cloudVertexBuffers[i], nullptr);
-        vkFreeMemory(device, cloudVertexBufferMemorys[i], nullptr);
+        memoryAllocator.free(cloudVertexBufferMemorys[i]);
     }
     vkDestroyBuffer(device, cloudIndexBuffer, nullptr);
-    vkFreeMemory(device, cloudIndexBufferMemory, nullptr);
+    memoryAllocator.free(cloudIndexBufferMemory);
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "../scene_viewer.hpp"
 
+#include <omp.h>
+
 void SceneViewer::createFramebuffers() {
     swapChainFramebuffers.resize(swapChainImageViews.size());
 
@@ -73,15 +75,22 @@ void SceneViewer::createHeadlessCommandPool() {
 }
 
 void SceneViewer::createCommandBuffers() {
-    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    VkCommandBufferAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = commandPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = static_cast<uint32_t>(commandBuffers.size()),
-    };
-    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate command buffers!");
+    // one primary per (frame slot, swapchain image), the framebuffer and descriptor sets are baked into each
+    recordImageSlots = std::max(swapChainImages.size(), static_cast<size_t>(1));
+    cachedCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    cachedCommandVersions.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        cachedCommandBuffers[i].resize(recordImageSlots);
+        cachedCommandVersions[i].assign(recordImageSlots, 0);
+        VkCommandBufferAllocateInfo allocInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = static_cast<uint32_t>(cachedCommandBuffers[i].size()),
+        };
+        if (vkAllocateCommandBuffers(device, &allocInfo, cachedCommandBuffers[i].data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
     }
 }
 
@@ -110,6 +119,73 @@ void SceneViewer::createHeadlessCommandBuffers() {
 }
 
 void SceneViewer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    updateFrameUniforms();
+    recordFrameCommands(commandBuffer, imageIndex);
+}
+
+void SceneViewer::updateFrameUniforms() {
+    // first make the update, for both rendering use
+    updateUniformBuffer(currentFrame);
+
+    // instead, I begin a render pass for shadow map
+    updateLightBudget();
+    if (shadowAtlasSize > 0) {
+        packShadowAtlas();
+    }
+    LightUniformBufferObject lubo{};
+    updateWholeLightUniformBuffer(currentFrame, lubo);
+    buildShadowDrawLists();
+    updateShadowCache(lubo);
+    updateLightClusters(currentFrame);
+
+    updateCloudUniformBuffer(currentFrame);
+}
+
+void SceneViewer::recordFrameCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    auto tStart = std::chrono::high_resolution_clock::now();
+    if (recordThreads > 1) {
+        recordCommandBufferParallel(commandBuffer, imageIndex);
+    }
+    else {
+        recordCommandBufferSerial(commandBuffer, imageIndex);
+    }
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    reportRecordTime(std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+}
+
+// compares this frame against the state the current version was recorded with, bumps the version on any difference.
+// camera motion, instance transforms and light motion (cube face views are in the light ubo) only touch uniforms, so they keep the version
+// as long as every shadow view keeps its casters
+uint64_t SceneViewer::currentRecordStateVersion() {
+    const auto& batches = frameDrawLists[currentFrame].batches;
+    const auto& shadowBatches = frameDrawLists[currentFrame].shadowBatches;
+    VkViewport viewport;
+    VkRect2D scissor;
+    mainPassViewport(viewport, scissor);
+
+    bool changed = recordedState.pipelineVersion != pipelineVersion || recordedState.batches != batches ||
+        memcmp(&recordedState.viewport, &viewport, sizeof(VkViewport)) != 0 || memcmp(&recordedState.scissor, &scissor, sizeof(VkRect2D)) != 0 ||
+        recordedState.shadowAtlasTiles != shadowAtlasTiles || recordedState.shadowRenderViews != shadowRenderViews ||
+        recordedState.shadowBatches != shadowBatches;
+    if (!changed) {
+        return recordStateVersion;
+    }
+
+    // assign keeps capacity, so steady state stays allocation free
+    recordedState.batches.assign(batches.begin(), batches.end());
+    recordedState.shadowAtlasTiles.assign(shadowAtlasTiles.begin(), shadowAtlasTiles.end());
+    recordedState.shadowRenderViews.assign(shadowRenderViews.begin(), shadowRenderViews.end());
+    recordedState.shadowBatches.resize(shadowBatches.size());
+    for (size_t i = 0; i < shadowBatches.size(); i++) {
+        recordedState.shadowBatches[i].assign(shadowBatches[i].begin(), shadowBatches[i].end());
+    }
+    recordedState.viewport = viewport;
+    recordedState.scissor = scissor;
+    recordedState.pipelineVersion = pipelineVersion;
+    return ++recordStateVersion;
+}
+
+void SceneViewer::recordCommandBufferSerial(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
     // begin recording command buffer
     VkCommandBufferBeginInfo beginInfo {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -120,40 +196,266 @@ void SceneViewer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
         throw std::runtime_error("failed to begin recording command buffer!");
     }
 
-    // first make the update, for both rendering use
-    updateUniformBuffer(currentFrame);
-
-    // begin drawing, (render pass)
-    std::array<VkClearValue, 2> clearValues{};
-    clearValues[0].color = {{0.52f, 0.8f, 0.92f, 1.0f}};
-    // clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
-    clearValues[1].depthStencil = { 1.0f, 0 };
-
-    // instead, I begin a render pass for shadow map
-    LightUniformBufferObject lubo{};
-    updateWholeLightUniformBuffer(currentFrame, lubo);
-
-    int spot_idx = 0, sphere_idx = 0;
+    if (shadowAtlasSize > 0) {
+        recordShadowAtlas(commandBuffer);
+    }
+    int spot_idx = 0, sphere_idx = 0, sun_idx = 0;
     for (auto& [id, light] : scene_config.id2lights) {
         // updateCurLightUBOIndex(currentFrame, spot_idx + sphere_idx, lubo);
+        int idx = spot_idx + sphere_idx + sun_idx;
         if (light->type == sconfig::LightType::SPOT) {
-            singleShadowRenderPass(commandBuffer, spot_idx, sphere_idx, id);
+            if (shadowAtlasSize == 0 && shadowRenderViews[idx] != 0) {
+                singleShadowRenderPass(commandBuffer, spot_idx, sphere_idx, sun_idx, id);
+            }
             ++spot_idx;
         } else if (light->type == sconfig::LightType::SPHERE) {
-            singleCubeShadowRenderPass(commandBuffer, spot_idx, sphere_idx, id);
+            singleCubeShadowRenderPass(commandBuffer, spot_idx, sphere_idx, sun_idx, id, shadowRenderViews[idx]);
             ++sphere_idx;
+        } else {
+            singleSunShadowRenderPass(commandBuffer, spot_idx, sphere_idx, sun_idx, id, shadowRenderViews[idx]);
+            ++sun_idx;
         }
     }
     
-    // std::cout << lidx << std::endl;
     /*
         Learning from vulkan example: this is important!
         Note: Explicit synchronization is not required between the render pass,
         as this is done implicit via sub pass dependencies
     */
-    
+
+    // evsm lights prefilter the shadows just rendered
+    recordShadowMoments(commandBuffer);
+
     // content drawing
-    // updateUniformBuffer(currentFrame);
+    beginMainRenderPass(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkViewport viewport;
+    VkRect2D scissor;
+    mainPassViewport(viewport, scissor);
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    // draw contents
+    const auto& batches = frameDrawLists[currentFrame].batches;
+
+    VkDeviceSize offsets[] = {0, 0};
+    VkBuffer vertexBuffers[] = {vertexPositionBuffer, vertexAttributeBuffer};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+    
+    // batches are sorted by material first, so each pipeline is bound once
+    size_t firstBatch = 0;
+    while (firstBatch < batches.size()) {
+        size_t lastBatch = firstBatch;
+        while (lastBatch < batches.size() && batches[lastBatch].material == batches[firstBatch].material) {
+            lastBatch++;
+        }
+        recordMaterialDraws(commandBuffer, firstBatch, lastBatch);
+        firstBatch = lastBatch;
+    }
+    
+    // draw cloud
+    recordCloudDraws(commandBuffer);
+
+    // end drawing, (render pass)
+    vkCmdEndRenderPass(commandBuffer);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+}
+
+// each shadow view, each material and the clouds go to their own secondary buffer, recorded on worker threads.
+// the primary only begins the render passes and executes the secondaries in the same order the serial path records.
+// with the atlas the spot tasks come first and share one render pass
+void SceneViewer::recordCommandBufferParallel(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    recordTasks.clear();
+    int spot_idx = 0, sphere_idx = 0, sun_idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        if (shadowAtlasSize == 0) {
+            break;
+        }
+        if (light->type == sconfig::LightType::SPOT) {
+            if (shadowRenderViews[spot_idx + sphere_idx + sun_idx] != 0) {
+                recordTasks.push_back({ .type = RecordTaskType::spotShadow, .lightId = id, .spotIdx = spot_idx, .sphereIdx = sphere_idx,
+                    .sunIdx = sun_idx, .face = -1 });
+            }
+            ++spot_idx;
+        } else if (light->type == sconfig::LightType::SPHERE) {
+            ++sphere_idx;
+        } else {
+            ++sun_idx;
+        }
+    }
+    spot_idx = 0, sphere_idx = 0, sun_idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        int idx = spot_idx + sphere_idx + sun_idx;
+        if (light->type == sconfig::LightType::SPOT) {
+            if (shadowAtlasSize == 0 && shadowRenderViews[idx] != 0) {
+                recordTasks.push_back({ .type = RecordTaskType::spotShadow, .lightId = id, .spotIdx = spot_idx, .sphereIdx = sphere_idx,
+                    .sunIdx = sun_idx, .face = -1 });
+            }
+            ++spot_idx;
+        } else if (light->type == sconfig::LightType::SPHERE) {
+            for (int j = 0; j < static_cast<int>(shadowMapCubeFramebuffers[sphere_idx].size()); j++) {
+                if ((shadowRenderViews[idx] & (1u << j)) == 0) {
+                    continue;
+                }
+                recordTasks.push_back({ .type = RecordTaskType::cubeShadowFace, .lightId = id, .spotIdx = spot_idx, .sphereIdx = sphere_idx,
+                    .sunIdx = sun_idx, .face = j });
+            }
+            ++sphere_idx;
+        } else {
+            for (int c = 0; c < SUN_CASCADES; c++) {
+                if ((shadowRenderViews[idx] & (1u << c)) == 0) {
+                    continue;
+                }
+                recordTasks.push_back({ .type = RecordTaskType::sunCascade, .lightId = id, .spotIdx = spot_idx, .sphereIdx = sphere_idx,
+                    .sunIdx = sun_idx, .face = c });
+            }
+            ++sun_idx;
+        }
+    }
+
+    const auto& batches = frameDrawLists[currentFrame].batches;
+    size_t firstBatch = 0;
+    while (firstBatch < batches.size()) {
+        size_t lastBatch = firstBatch;
+        while (lastBatch < batches.size() && batches[lastBatch].material == batches[firstBatch].material) {
+            lastBatch++;
+        }
+        recordTasks.push_back({ .type = RecordTaskType::material, .firstBatch = firstBatch, .lastBatch = lastBatch });
+        firstBatch = lastBatch;
+    }
+    if (!scene_config.id2clouds.empty()) {
+        recordTasks.push_back({ .type = RecordTaskType::cloud });
+    }
+
+    // the fence for this frame has been waited on, so everything recorded from these pools is done.
+    // pools are per (frame slot, swapchain image), the same as the primary cache, so other cached primaries stay valid
+    std::vector<RecordThreadContext>& contexts = recordThreadContexts[currentFrame * recordImageSlots + imageIndex % recordImageSlots];
+    for (auto& context : contexts) {
+        vkResetCommandPool(device, context.pool, 0);
+        context.used = 0;
+        context.error.clear();
+    }
+
+    VkViewport viewport;
+    VkRect2D scissor;
+    mainPassViewport(viewport, scissor);
+
+    int taskCount = static_cast<int>(recordTasks.size());
+    // an exception must not leave the parallel region, the thread keeps it in its context until after it
+#pragma omp parallel for schedule(dynamic) num_threads(recordThreads)
+    for (int t = 0; t < taskCount; t++) {
+        int thread = omp_get_thread_num();
+        try {
+            RecordTask& task = recordTasks[t];
+
+            if (task.type == RecordTaskType::sunCascade) {
+                task.secondary = beginSecondaryCommandBuffer(thread, imageIndex, shadowRenderPass, sunCascadeFramebuffers[task.sunIdx * SUN_CASCADES + task.face]);
+                recordShadowView(task.secondary, task.spotIdx, task.sphereIdx, task.sunIdx, task.lightId, task.face);
+            }
+            else if (task.type == RecordTaskType::spotShadow || task.type == RecordTaskType::cubeShadowFace) {
+                VkFramebuffer framebuffer = task.face < 0 ? shadowMapFramebuffers[shadowAtlasSize > 0 ? 0 : task.spotIdx] : shadowMapCubeFramebuffers[task.sphereIdx][task.face];
+                task.secondary = beginSecondaryCommandBuffer(thread, imageIndex, task.face < 0 ? shadowRenderPass : shadowCubeRenderPass, framebuffer);
+                recordShadowView(task.secondary, task.spotIdx, task.sphereIdx, task.sunIdx, task.lightId, task.face);
+            }
+            else {
+                // nothing is inherited from the primary, so every secondary sets its own dynamic state
+                task.secondary = beginSecondaryCommandBuffer(thread, imageIndex, renderPass, swapChainFramebuffers[imageIndex]);
+                vkCmdSetViewport(task.secondary, 0, 1, &viewport);
+                vkCmdSetScissor(task.secondary, 0, 1, &scissor);
+                if (task.type == RecordTaskType::material) {
+                    VkDeviceSize offsets[] = {0, 0};
+                    VkBuffer vertexBuffers[] = {vertexPositionBuffer, vertexAttributeBuffer};
+                    vkCmdBindVertexBuffers(task.secondary, 0, 2, vertexBuffers, offsets);
+                    recordMaterialDraws(task.secondary, task.firstBatch, task.lastBatch);
+                }
+                else {
+                    recordCloudDraws(task.secondary);
+                }
+            }
+
+            if (vkEndCommandBuffer(task.secondary) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record secondary command buffer!");
+            }
+        }
+        catch (const std::exception& e) {
+            std::string& error = contexts[thread].error;
+            if (error.empty()) {
+                error = e.what();
+            }
+        }
+    }
+    for (const auto& context : contexts) {
+        if (!context.error.empty()) {
+            throw std::runtime_error(context.error);
+        }
+    }
+
+    // no ONE_TIME_SUBMIT, the primary may be replayed from the cache
+    VkCommandBufferBeginInfo beginInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = 0,
+        .pInheritanceInfo = nullptr,
+    };
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording command buffer!");
+    }
+
+    bool mainPassBegun = false;
+    for (size_t t = 0; t < recordTasks.size(); t++) {
+        const RecordTask& task = recordTasks[t];
+        if (task.type == RecordTaskType::spotShadow && shadowAtlasSize > 0) {
+            if (t == 0) {
+                beginShadowRenderPass(commandBuffer, shadowMapFramebuffers[0], false, -1, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            }
+            vkCmdExecuteCommands(commandBuffer, 1, &task.secondary);
+            if (t + 1 == recordTasks.size() || recordTasks[t + 1].type != RecordTaskType::spotShadow) {
+                vkCmdEndRenderPass(commandBuffer);
+            }
+            continue;
+        }
+        if (task.type == RecordTaskType::sunCascade) {
+            beginShadowRenderPass(commandBuffer, sunCascadeFramebuffers[task.sunIdx * SUN_CASCADES + task.face], false, task.lightId,
+                VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(commandBuffer, 1, &task.secondary);
+            vkCmdEndRenderPass(commandBuffer);
+            continue;
+        }
+        if (task.type == RecordTaskType::spotShadow || task.type == RecordTaskType::cubeShadowFace) {
+            VkFramebuffer framebuffer = task.face < 0 ? shadowMapFramebuffers[task.spotIdx] : shadowMapCubeFramebuffers[task.sphereIdx][task.face];
+            beginShadowRenderPass(commandBuffer, framebuffer, task.face >= 0, task.lightId, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(commandBuffer, 1, &task.secondary);
+            vkCmdEndRenderPass(commandBuffer);
+            continue;
+        }
+        if (!mainPassBegun) {
+            recordShadowMoments(commandBuffer);
+            beginMainRenderPass(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            mainPassBegun = true;
+        }
+        vkCmdExecuteCommands(commandBuffer, 1, &task.secondary);
+    }
+    // still clear the frame when there is nothing to draw
+    if (!mainPassBegun) {
+        recordShadowMoments(commandBuffer);
+        beginMainRenderPass(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    }
+    vkCmdEndRenderPass(commandBuffer);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+}
+
+void SceneViewer::beginMainRenderPass(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkSubpassContents contents) {
+    // begin drawing, (render pass)
+    std::array<VkClearValue, 2> clearValues{};
+    clearValues[0].color = {{0.52f, 0.8f, 0.92f, 1.0f}};
+    // clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = { 1.0f, 0 };
+
     VkRenderPassBeginInfo renderPassInfo{
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .renderPass = renderPass,
@@ -165,9 +467,10 @@ void SceneViewer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
         .clearValueCount = static_cast<uint32_t>(clearValues.size()),
         .pClearValues = clearValues.data(),
     };
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+}
 
-    
+void SceneViewer::mainPassViewport(VkViewport& viewport, VkRect2D& scissor) {
     double windowAspect = static_cast<double>(window_width) / static_cast<double>(window_height);
     std::string cur_camera = scene_config.cur_camera;
     double cameraAspect = scene_config.cameras[cur_camera]->aspect;
@@ -183,7 +486,7 @@ void SceneViewer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
     }
 
     // std::cout << "blackBarWidth: " << blackBarWidth << " blackBarHeight: " << blackBarHeight << std::endl;
-    VkViewport viewport {
+    viewport = {
         .x = blackBarWidth,
         .y = blackBarHeight,
         .width = static_cast<float>(swapChainExtent.width) - 2.0f * blackBarWidth,
@@ -201,38 +504,26 @@ void SceneViewer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
         .height = static_cast<uint32_t>(swapChainExtent.height) - 2 * static_cast<uint32_t>(blackBarHeight)
     };
 
-    VkRect2D scissor {
+    scissor = {
         .offset = scissorOffset,
         .extent = scissorExtent
     };
+}
 
-    VkDeviceSize offsets[] = {0};
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
-
-    // draw contents
-    auto& cur_frame_material_meshInnerId2ModelMatrices = frame_material_meshInnerId2ModelMatrices[currentFrame];
-    int curInstanceIndex = 0;
+// batches in [firstBatch, lastBatch) must share one material
+void SceneViewer::recordMaterialDraws(VkCommandBuffer commandBuffer, size_t firstBatch, size_t lastBatch) {
+    MaterialType materialType = frameDrawLists[currentFrame].batches[firstBatch].material;
+    VkPipeline graphicssPipeline = material2Pipelines.at(materialType);
 
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    
-    for (auto& pair : cur_frame_material_meshInnerId2ModelMatrices) {
-        MaterialType materialType = pair.first;
-        auto& meshInnerId2ModelMatrices = pair.second;
-        VkPipeline graphicssPipeline = material2Pipelines[materialType];
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicssPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, material2PipelineLayouts.at(materialType), 0, 1, &descriptorSets[currentFrame], 0, nullptr);
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicssPipeline);
-        // vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-        // vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, material2PipelineLayouts[materialType], 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+    frameRealDraw(commandBuffer, frameDrawLists[currentFrame].batches, firstBatch, lastBatch, material2PipelineLayouts.at(materialType),
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, offsetof(MeshPushConstants, materialSlot) + sizeof(int32_t));
+}
 
-        frameRealDraw(commandBuffer, curInstanceIndex, meshInnerId2ModelMatrices);
-    }
-    
-    // draw cloud
-    updateCloudUniformBuffer(currentFrame);
+void SceneViewer::recordCloudDraws(VkCommandBuffer commandBuffer) {
+    VkDeviceSize offsets[] = {0};
     int cloudIdx = 0;
     for (const auto& [id, cloud] : scene_config.id2clouds) {
         VkBuffer pcloudVertexBuffers[] = { cloudVertexBuffers[cloudIdx] };
@@ -247,12 +538,88 @@ void SceneViewer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 
         cloudIdx++;
     }
+}
 
-    // end drawing, (render pass)
-    vkCmdEndRenderPass(commandBuffer);
+void SceneViewer::createRecordThreadPools(uint32_t queueFamily) {
+    if (recordThreads <= 1) {
+        return;
+    }
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("failed to record command buffer!");
+    recordThreadContexts.resize(MAX_FRAMES_IN_FLIGHT * recordImageSlots);
+    for (auto& contexts : recordThreadContexts) {
+        contexts.resize(recordThreads);
+        for (auto& context : contexts) {
+            // pools are reset as a whole each frame, no per-buffer reset needed
+            VkCommandPoolCreateInfo poolInfo{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = queueFamily,
+            };
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &context.pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create recording thread command pool!");
+            }
+            context.used = 0;
+        }
+    }
+    std::cout << "Recording command buffers with " << recordThreads << " threads" << std::endl;
+}
+
+void SceneViewer::destroyRecordThreadPools() {
+    // destroying the pool frees its secondaries too
+    for (auto& contexts : recordThreadContexts) {
+        for (auto& context : contexts) {
+            vkDestroyCommandPool(device, context.pool, nullptr);
+        }
+    }
+    recordThreadContexts.clear();
+}
+
+// only touches the calling thread's own pool, secondaries are allocated once and reused after each pool reset
+VkCommandBuffer SceneViewer::beginSecondaryCommandBuffer(int thread, uint32_t imageIndex, VkRenderPass pass, VkFramebuffer framebuffer) {
+    RecordThreadContext& context = recordThreadContexts[currentFrame * recordImageSlots + imageIndex % recordImageSlots][thread];
+    if (context.used == context.secondaries.size()) {
+        VkCommandBufferAllocateInfo allocInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = context.pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = 1,
+        };
+        VkCommandBuffer secondary;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &secondary) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate secondary command buffer!");
+        }
+        context.secondaries.push_back(secondary);
+    }
+    VkCommandBuffer secondary = context.secondaries[context.used++];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = pass,
+        .subpass = 0,
+        .framebuffer = framebuffer,
+    };
+    VkCommandBufferBeginInfo beginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritanceInfo,
+    };
+    if (vkBeginCommandBuffer(secondary, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording secondary command buffer!");
+    }
+    return secondary;
+}
+
+void SceneViewer::reportRecordTime(double ms) {
+    recordTimeAccum += ms;
+    recordTimeFrames++;
+
+    // headless runs are short, report every frame there
+    int reportFrames = is_headless ? 1 : RECORD_TIME_REPORT_FRAMES;
+    if (recordTimeFrames >= reportFrames) {
+        std::cout << "Command recording (" << (recordThreads > 1 ? std::to_string(recordThreads) + " threads" : std::string("serial")) << "): "
+                  << recordTimeAccum / recordTimeFrames << " ms/frame" << std::endl;
+        recordTimeAccum = 0.0;
+        recordTimeFrames = 0;
     }
 }
 
@@ -297,8 +664,15 @@ void SceneViewer::drawFrame() {
     // Only reset the fence if we are submitting work
     vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-    vkResetCommandBuffer(commandBuffers[currentFrame], 0);
-    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    // uniforms are written every frame, commands are only re-recorded when something baked into them changed
+    updateFrameUniforms();
+    VkCommandBuffer commandBuffer = cachedCommandBuffers[currentFrame][imageIndex];
+    uint64_t stateVersion = currentRecordStateVersion();
+    if (cachedCommandVersions[currentFrame][imageIndex] != stateVersion) {
+        vkResetCommandBuffer(commandBuffer, 0);
+        recordFrameCommands(commandBuffer, imageIndex);
+        cachedCommandVersions[currentFrame][imageIndex] = stateVersion;
+    }
 
     // submit command buffer to graphics queue
     VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
@@ -310,7 +684,7 @@ void SceneViewer::drawFrame() {
         .pWaitSemaphores = waitSemaphores,
         .pWaitDstStageMask = waitStages,
         .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffers[currentFrame],
+        .pCommandBuffers = &commandBuffer,
         .signalSemaphoreCount = 1,
         .pSignalSemaphores = signalSemaphores,
     };
@@ -345,35 +719,30 @@ void SceneViewer::drawFrame() {
 void SceneViewer::framebufferResizeCallback(GLFWwindow* window, int width, int height) {
     auto app = reinterpret_cast<SceneViewer*>(glfwGetWindowUserPointer(window));
     app->framebufferResized = true;
+    app->frameRequested = true;
 }
 
-void SceneViewer::frameRealDraw(VkCommandBuffer commandBuffer, int& currentInstanceIdx, const std::map<int, std::vector<cglm::Mat44f>>& meshInnerId2ModelMatrices) {
-    // std::cout << "MATERIAL: " << materialType << "\n";
-
-    for (auto& p : meshInnerId2ModelMatrices) {
-        int meshInnerId = p.first;
-        auto& modelMatrices = p.second;
-        int meshId = scene_config.innerId2meshId[meshInnerId];
-        int vertexCount = scene_config.id2mesh[meshId]->vertex_count;
-        int numInstances = modelMatrices.size();
-        // vertexIndex is the offset
-        int vertexIndex = meshInnerId2Offset[meshInnerId];
-        // std::cout << vertexCount << " " << numInstances << " " << vertexIndex << " " << currentInstanceIdx << " | \n";
-        if (numInstances == 0) {
-            continue;
-        }
+// the window was uncovered or needs its contents again, an idle --render-on-demand loop would not repaint otherwise
+void SceneViewer::windowRefreshCallback(GLFWwindow* window) {
+    auto app = reinterpret_cast<SceneViewer*>(glfwGetWindowUserPointer(window));
+    app->frameRequested = true;
+}
 
-        // std::cout << meshId << " " << numInstances << " " << vertexIndex << " " << curInstanceIndex << " | \n";
+// the first pushSize bytes of the batch mesh's MeshPushConstants go to pushOffset, only when the mesh changes
+void SceneViewer::frameRealDraw(VkCommandBuffer commandBuffer, const std::vector<DrawBatch>& batches, size_t firstBatch, size_t lastBatch,
+    VkPipelineLayout layout, VkShaderStageFlags pushStages, uint32_t pushOffset, uint32_t pushSize) {
+    int pushedMesh = -1;
+    for (size_t i = firstBatch; i < lastBatch; i++) {
+        const DrawBatch& batch = batches[i];
+        if (batch.meshInnerId != pushedMesh) {
+            vkCmdPushConstants(commandBuffer, layout, pushStages, pushOffset, pushSize, &meshInnerId2PushConstants[batch.meshInnerId]);
+            pushedMesh = batch.meshInnerId;
+        }
         vkCmdDraw(commandBuffer,
-            static_cast<uint32_t>(vertexCount),      /* Vertex Count */
-            numInstances,           /* Instance Count */
-            vertexIndex,            /* First Vertex, defines lowest value of gl_VertexIndex */
-            currentInstanceIdx        /* First Instance Index, defines lowest of gl_InstanceIndex */
+            batch.vertexCount,      /* Vertex Count */
+            batch.instanceCount,    /* Instance Count */
+            batch.firstVertex,      /* First Vertex, defines lowest value of gl_VertexIndex */
+            batch.firstInstance     /* First Instance Index, defines lowest of gl_InstanceIndex */
         );
-        currentInstanceIdx += numInstances;
     }
-
-    // std::cout << std::endl;
-    // std::cout << "currentInstanceIdx: " << currentInstanceIdx << std::endl;
-
-}
\ No newline at end of file
+}
@@ -1,6 +1,9 @@
 #include "../scene_viewer.hpp"
 
 void SceneViewer::createGraphicsPipelines() {
+    // anything recorded against the old pipelines is stale now
+    pipelineVersion++;
+
     // based on scene_config's materials
     for (auto& pair : scene_config.id2material) {
         std::shared_ptr<sconfig::Material> material = pair.second;
@@ -21,11 +24,11 @@ void SceneViewer::createGraphicsPipeline(MaterialType material_type) {
     {
     case MaterialType::pbr:
         vertShaderCode = readFile("shaders/pbr/vert.spv");
-        fragShaderCode = readFile("shaders/pbr/frag.spv");
+        fragShaderCode = readFile(nonUniformIndexing ? "shaders/pbr/frag_nonuniform.spv" : "shaders/pbr/frag.spv");
         break;
     case MaterialType::lambertian:
         vertShaderCode = readFile("shaders/lambertian/vert.spv");
-        fragShaderCode = readFile("shaders/lambertian/frag.spv");
+        fragShaderCode = readFile(nonUniformIndexing ? "shaders/lambertian/frag_nonuniform.spv" : "shaders/lambertian/frag.spv");
         break;
     case MaterialType::mirror:
         vertShaderCode = readFile("shaders/mirror/vert.spv");
@@ -37,55 +40,76 @@ void SceneViewer::createGraphicsPipeline(MaterialType material_type) {
         break;
     case MaterialType::simple:
         vertShaderCode = readFile("shaders/simple/vert.spv");
-        fragShaderCode = readFile("shaders/simple/frag.spv");
+        fragShaderCode = readFile(nonUniformIndexing ? "shaders/simple/frag_nonuniform.spv" : "shaders/simple/frag.spv");
         break;
     }
 
     VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
     VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
 
-    // defining module creation info
+    // defining module creation info, constant_id 0 is COMPACT_VERTEX in the vertex shaders
+    VkBool32 compactVertexConstant = compactVertices ? VK_TRUE : VK_FALSE;
+    VkSpecializationMapEntry specializationEntry {
+        .constantID = 0,
+        .offset = 0,
+        .size = sizeof(VkBool32),
+    };
+    VkSpecializationInfo vertexSpecialization {
+        .mapEntryCount = 1,
+        .pMapEntries = &specializationEntry,
+        .dataSize = sizeof(VkBool32),
+        .pData = &compactVertexConstant,
+    };
     VkPipelineShaderStageCreateInfo vertShaderStageInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_VERTEX_BIT,
         .module = vertShaderModule,
         .pName = "main",
+        .pSpecializationInfo = &vertexSpecialization,
+    };
+    // constant_id 1 is SHADOW_SAMPLES in the fragment shaders with soft spot shadows, the others ignore it
+    int32_t shadowSamplesConstant = shadowSamples;
+    VkSpecializationMapEntry fragSpecializationEntry {
+        .constantID = 1,
+        .offset = 0,
+        .size = sizeof(int32_t),
+    };
+    VkSpecializationInfo fragSpecialization {
+        .mapEntryCount = 1,
+        .pMapEntries = &fragSpecializationEntry,
+        .dataSize = sizeof(int32_t),
+        .pData = &shadowSamplesConstant,
     };
     VkPipelineShaderStageCreateInfo fragShaderStageInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
         .module = fragShaderModule,
         .pName = "main",
+        .pSpecializationInfo = &fragSpecialization,
     };
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-    // vertex input
-    auto bindingDescription = Vertex::getBindingDescription();
+    // vertex input, simple reads color where the others read texCoord
+    bool textured = material_type != MaterialType::simple;
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions;
     std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
-
-    switch (material_type)
-    {
-    case MaterialType::environment:
-        attributeDescriptions = Vertex::getLambertianAttributeDescriptions();
-        break;
-    case MaterialType::simple:
-        attributeDescriptions = Vertex::getSimpleAttributeDescriptions();
-        break;
-    case MaterialType::mirror:
-        attributeDescriptions = Vertex::getLambertianAttributeDescriptions();
-        break;
-    case MaterialType::lambertian:
-        attributeDescriptions = Vertex::getLambertianAttributeDescriptions();
-        break;
-    case MaterialType::pbr:
-        attributeDescriptions = Vertex::getPbrAttributeDescriptions();
-        break;
+    std::vector<VkVertexInputAttributeDescription> shadingAttributes;
+    if (compactVertices) {
+        bindingDescriptions = { CompactVertexPosition::getBindingDescription(), CompactVertexAttributes::getBindingDescription() };
+        attributeDescriptions = CompactVertexPosition::getAttributeDescriptions();
+        shadingAttributes = textured ? CompactVertexAttributes::getTexturedAttributeDescriptions() : CompactVertexAttributes::getSimpleAttributeDescriptions();
     }
+    else {
+        bindingDescriptions = { VertexPosition::getBindingDescription(), VertexAttributes::getBindingDescription() };
+        attributeDescriptions = VertexPosition::getAttributeDescriptions();
+        shadingAttributes = textured ? VertexAttributes::getTexturedAttributeDescriptions() : VertexAttributes::getSimpleAttributeDescriptions();
+    }
+    attributeDescriptions.insert(attributeDescriptions.end(), shadingAttributes.begin(), shadingAttributes.end());
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bindingDescription,
+        .vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size()),
+        .pVertexBindingDescriptions = bindingDescriptions.data(),
         .vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size()),
         .pVertexAttributeDescriptions = attributeDescriptions.data(),
     };
@@ -161,13 +185,18 @@ void SceneViewer::createGraphicsPipeline(MaterialType material_type) {
         .pDynamicStates = dynamicStates.data()
     };
 
-    // pipeline layout
+    // pipeline layout, the push constants are the MeshPushConstants of the draw
+    VkPushConstantRange pushConstantRange{
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        .offset = 0,
+        .size = offsetof(MeshPushConstants, materialSlot) + sizeof(int32_t),
+    };
     VkPipelineLayoutCreateInfo pipelineLayoutInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .setLayoutCount = 1,        // set layout to 1, for ubo descriptor
         .pSetLayouts = &descriptorSetLayout,
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = nullptr,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
     };
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &material2PipelineLayouts[material_type]) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create pipeline layout!");
@@ -227,7 +256,8 @@ void SceneViewer::createGraphicsPipeline(MaterialType material_type) {
 }
 
 
-void SceneViewer::createRenderPass(VkFormat format, VkRenderPass& pRenderpass, VkImageLayout colorFinalLayout) {
+// a non zero viewMask makes it a multiview pass, every attachment then needs that many layers
+void SceneViewer::createRenderPass(VkFormat format, VkRenderPass& pRenderpass, VkImageLayout colorFinalLayout, uint32_t viewMask) {
     VkAttachmentDescription colorAttachment {
         .format = format,
         .samples = VK_SAMPLE_COUNT_1_BIT,
@@ -287,6 +317,14 @@ void SceneViewer::createRenderPass(VkFormat format, VkRenderPass& pRenderpass, V
         .dependencyCount = 1,
         .pDependencies = &dependency,
     };
+    VkRenderPassMultiviewCreateInfo multiviewInfo {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO,
+        .subpassCount = 1,
+        .pViewMasks = &viewMask,
+    };
+    if (viewMask != 0) {
+        renderPassInfo.pNext = &multiviewInfo;
+    }
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &pRenderpass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
@@ -8,7 +8,7 @@ void SceneViewer::createImageViews() {
     }
 }
 
-VkImageView SceneViewer::createImageView2D(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+VkImageView SceneViewer::createImageView2D(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
     VkImageViewCreateInfo viewInfo {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = image,
@@ -17,7 +17,7 @@ VkImageView SceneViewer::createImageView2D(VkImage image, VkFormat format, VkIma
         .subresourceRange = {
             .aspectMask = aspectFlags,
             .baseMipLevel = 0,
-            .levelCount = 1,
+            .levelCount = mipLevels,
             .baseArrayLayer = 0,
             .layerCount = 1,
         },
@@ -31,7 +31,7 @@ VkImageView SceneViewer::createImageView2D(VkImage image, VkFormat format, VkIma
     return imageView;
 }
 
-VkImageView SceneViewer::createImageViewCube(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+VkImageView SceneViewer::createImageViewCube(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
     VkImageViewCreateInfo viewInfo{
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = image,
@@ -40,7 +40,7 @@ VkImageView SceneViewer::createImageViewCube(VkImage image, VkFormat format, VkI
         .subresourceRange = {
             .aspectMask = aspectFlags,
             .baseMipLevel = 0,
-            .levelCount = 1,
+            .levelCount = mipLevels,
             .baseArrayLayer = 0,
             .layerCount = 6,
         },
@@ -56,7 +56,7 @@ VkImageView SceneViewer::createImageViewCube(VkImage image, VkFormat format, VkI
 
 void SceneViewer::createImage(uint32_t width, uint32_t height, VkImageCreateFlags flags, VkImageType imageType,
     VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-    VkImage& image, VkDeviceMemory& imageMemory, int layers) {
+    VkImage& image, MemoryAllocation& imageMemory, int layers, uint32_t mipLevels) {
     
     VkImageCreateInfo imageInfo{
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -64,7 +64,7 @@ void SceneViewer::createImage(uint32_t width, uint32_t height, VkImageCreateFlag
         .imageType = imageType,
         .format = format,
         .extent = {width, height, 1},
-        .mipLevels = 1,
+        .mipLevels = mipLevels,
         .arrayLayers = static_cast<uint32_t>(layers),
         .samples = VK_SAMPLE_COUNT_1_BIT,
         .tiling = tiling,
@@ -80,17 +80,9 @@ void SceneViewer::createImage(uint32_t width, uint32_t height, VkImageCreateFlag
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties),
-    };
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
+    imageMemory = memoryAllocator.allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR);
 
-    vkBindImageMemory(device, image, imageMemory, 0);
+    vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 }
 
 void SceneViewer::createDescriptorSetLayout() {
@@ -142,8 +134,69 @@ void SceneViewer::createDescriptorSetLayout() {
         .pImmutableSamplers = nullptr,
     };
 
-    std::array<VkDescriptorSetLayoutBinding, 6> bindings = { uboLayoutBinding, sampler2DLayoutBinding,
-        samplerCubeLayoutBinding, fragLightUBOLayoutBinding, shadowMapLayoutBinding, shadowMapCubeLayoutBinding };
+    // constant material values
+    VkDescriptorSetLayoutBinding materialLayoutBinding {
+        .binding = 6,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = nullptr,
+    };
+
+    // the spot shadow maps again without depth compare, for the pcss blocker search
+    VkDescriptorSetLayoutBinding shadowDepthLayoutBinding {
+        .binding = 7,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = MAX_LIGHT,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = nullptr,
+    };
+
+    // every scene light, and the per cluster light lists
+    VkDescriptorSetLayoutBinding lightListLayoutBinding {
+        .binding = 8,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = nullptr,
+    };
+    VkDescriptorSetLayoutBinding clusterLayoutBinding {
+        .binding = 9,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = nullptr,
+    };
+
+    // evsm moment maps per light slot, spots as 2D and spheres as cubes
+    VkDescriptorSetLayoutBinding shadowMomentLayoutBinding {
+        .binding = 10,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = MAX_LIGHT,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = nullptr,
+    };
+    VkDescriptorSetLayoutBinding shadowMomentCubeLayoutBinding {
+        .binding = 11,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = MAX_LIGHT,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = nullptr,
+    };
+
+    // every sun's cascades as layers of one depth image
+    VkDescriptorSetLayoutBinding sunCascadeLayoutBinding {
+        .binding = 12,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = nullptr,
+    };
+
+    std::array<VkDescriptorSetLayoutBinding, 13> bindings = { uboLayoutBinding, sampler2DLayoutBinding,
+        samplerCubeLayoutBinding, fragLightUBOLayoutBinding, shadowMapLayoutBinding, shadowMapCubeLayoutBinding, materialLayoutBinding,
+        shadowDepthLayoutBinding, lightListLayoutBinding, clusterLayoutBinding, shadowMomentLayoutBinding, shadowMomentCubeLayoutBinding,
+        sunCascadeLayoutBinding };
 
     VkDescriptorSetLayoutCreateInfo layoutInfo {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
@@ -157,91 +210,141 @@ void SceneViewer::createDescriptorSetLayout() {
 }
 
 void SceneViewer::createUniformBuffers() {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
 
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    // each region should be usable both as a descriptor offset and as a flush boundary
+    VkDeviceSize alignment = std::max(properties.limits.minUniformBufferOffsetAlignment, nonCoherentAtomSize);
+    instanceRingStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+    VkDeviceSize bufferSize = instanceRingStride * MAX_FRAMES_IN_FLIGHT;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+    createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, instanceRingBuffer, instanceRingMemory);
 
-        vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
+    // check whether the memory type the allocator picked needs explicit flushes
+    instanceRingCoherent = memoryAllocator.isCoherent(instanceRingMemory);
+
+    // host visible blocks stay mapped by the allocator
+    instanceRingMapped = instanceRingMemory.mapped;
+
+    // start every region and its shadow from the same known contents
+    memset(instanceRingMapped, 0, static_cast<size_t>(bufferSize));
+    instanceRingShadows.assign(MAX_FRAMES_IN_FLIGHT, UniformBufferObject{});
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        memcpy(static_cast<char*>(instanceRingMapped) + i * instanceRingStride, &instanceRingShadows[i], sizeof(UniformBufferObject));
     }
+    if (!instanceRingCoherent) {
+        VkMappedMemoryRange range{
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = instanceRingMemory.memory,
+            .offset = instanceRingMemory.offset,
+            .size = bufferSize,
+        };
+        vkFlushMappedMemoryRanges(device, 1, &range);
+    }
+
+    // header + one model and one normal range per instance at most, so no reallocation in the frame loop
+    instanceRingDirtyRanges.reserve(2 * MAX_INSTANCE + 1);
 }
 
 void SceneViewer::updateUniformBuffer(uint32_t currentImage) {
-
-    UniformBufferObject ubo{};
-
-    // assign cameraPos
-    ubo.cameraPos = scene_config.cameras[scene_config.cur_camera]->position;
-    
-    // ubo.model = cglm::rotate({0.0f, 1.0f, 0.0f}, time * cglm::to_radians(0.0f));
-    ubo.model = cglm::identity(1.0f);
+    // this region was last written MAX_FRAMES_IN_FLIGHT frames ago, only patch what changed since then
+    UniformBufferObject& shadow = instanceRingShadows[currentImage];
+    char* region = static_cast<char*>(instanceRingMapped) + currentImage * instanceRingStride;
+    instanceRingDirtyRanges.clear();
 
     std::shared_ptr<sconfig::Camera> camera = scene_config.cameras[scene_config.cur_camera];
     // ubo's view is based on current camera
     cglm::Vec3f camera_pos = camera->position;
     cglm::Vec3f view_point = camera->position + camera->dir;
-    ubo.view = cglm::lookAt(camera_pos, view_point, camera->up);
-
-    // ubo.view[0][0] = 0;
-    // ubo.view[0][1] = 0;
-    // ubo.view[0][2] = 1;
-    // ubo.view[0][3] = 0;
-    // ubo.view[1][0] = 1;
-    // ubo.view[1][1] = 0;
-    // ubo.view[1][2] = 0;
-    // ubo.view[1][3] = 0;
-    // ubo.view[2][0] = 0;
-    // ubo.view[2][1] = 1;
-    // ubo.view[2][2] = 0;
-    // ubo.view[2][3] = 0;
-    // ubo.view[3][0] = 0;
-    // ubo.view[3][1] = -5;
-    // ubo.view[3][2] = -12;
-    // ubo.view[3][3] = 1;
+    cglm::Mat44f view = cglm::lookAt(camera_pos, view_point, camera->up);
 
     // ubo's projection is based on current camera
-    ubo.proj = cglm::perspective(camera->vfov, camera->aspect, camera->near, camera->far);
-    ubo.proj[1][1] *= -1;
-
-    // for (int k=0; k<4; k++) {
-    //     for (int j=0; j<4; j++) {
-    //         ubo.proj[k][j] = 0;
-    //     }
-    // }
-    // ubo.proj[0][0] = 0.57735f;
-    // ubo.proj[1][1] = -0.57735f;
-    // ubo.proj[2][2] = -1.0f;
-    // ubo.proj[2][3] = -1.0f;
-    // ubo.proj[3][2] = -0.2f;
-
-    // ubo.view = cglm::lookAt(cglm::Vec3f(2.0f, 2.0f, 2.0f), cglm::Vec3f(0.0f, 0.0f, 0.0f), cglm::Vec3f(0.0f, 0.0f, 1.0f));
-    // ubo.proj = cglm::perspective(cglm::to_radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
-    // ubo.proj[1][1] *= -1;
-
-    int idx = 0;
-
-    // now instead, we have great frame_material_meshInnerId2ModelMatrices
-    auto& cur_frame_material_meshInnerId2ModelMatrices = frame_material_meshInnerId2ModelMatrices[currentFrame];
-    for (auto& pair : cur_frame_material_meshInnerId2ModelMatrices) {
-        // here, I just need to add matrices inorder. Draw takes care of realthings
-        auto& meshId2ModelMatrices = pair.second;
-        for (auto& p : meshId2ModelMatrices) {
-            for (auto& model_matrix : p.second) {
-                ubo.instanceModels[idx++] = model_matrix;
-            }
+    cglm::Mat44f proj = cglm::perspective(camera->vfov, camera->aspect, camera->near, camera->far);
+    proj[1][1] *= -1;
+
+    cglm::Mat44f model = cglm::identity(1.0f);
+
+    // camera part, written as one block
+    if (memcmp(&shadow.cameraPos, &camera_pos, sizeof(cglm::Vec3f)) != 0 || memcmp(&shadow.model, &model, sizeof(cglm::Mat44f)) != 0 ||
+        memcmp(&shadow.view, &view, sizeof(cglm::Mat44f)) != 0 || memcmp(&shadow.proj, &proj, sizeof(cglm::Mat44f)) != 0) {
+        shadow.cameraPos = camera_pos;
+        shadow.model = model;
+        shadow.view = view;
+        shadow.proj = proj;
+        memcpy(region, &shadow, offsetof(UniformBufferObject, instanceModels));
+        markInstanceRingDirty(currentImage, 0, offsetof(UniformBufferObject, instanceModels));
+    }
+
+    // sortedModels is already in draw order, batch firstInstance indexes straight into it
+    const auto& sortedModels = frameDrawLists[currentFrame].sortedModels;
+    size_t instanceCount = std::min(sortedModels.size(), static_cast<size_t>(MAX_INSTANCE));
+    std::bitset<MAX_INSTANCE> changed;
+    for (size_t idx = 0; idx < instanceCount; idx++) {
+        const cglm::Mat44f& model_matrix = sortedModels[idx];
+        if (memcmp(&shadow.instanceModels[idx], &model_matrix, sizeof(cglm::Mat44f)) != 0) {
+            shadow.instanceModels[idx] = model_matrix;
+            VkDeviceSize offset = offsetof(UniformBufferObject, instanceModels) + idx * sizeof(cglm::Mat44f);
+            memcpy(region + offset, &model_matrix, sizeof(cglm::Mat44f));
+            markInstanceRingDirty(currentImage, offset, sizeof(cglm::Mat44f));
+            changed.set(idx);
         }
     }
 
+    // the normal matrices follow in a second pass so their dirty ranges merge like the models' do,
+    // vertex shaders no longer invert the model for every vertex and every shadow view
+    for (size_t idx = 0; idx < instanceCount; idx++) {
+        if (!changed.test(idx)) {
+            continue;
+        }
+        cglm::Mat44f normal_matrix = cglm::transpose(cglm::inverse(sortedModels[idx]));
+        NormalMatrix& normal = shadow.instanceNormals[idx];
+        for (int c = 0; c < 3; c++) {
+            normal.columns[c] = normal_matrix[c];
+        }
+        VkDeviceSize offset = offsetof(UniformBufferObject, instanceNormals) + idx * sizeof(NormalMatrix);
+        memcpy(region + offset, &normal, sizeof(NormalMatrix));
+        markInstanceRingDirty(currentImage, offset, sizeof(NormalMatrix));
+    }
+
+    flushInstanceRing();
+}
+
+void SceneViewer::markInstanceRingDirty(uint32_t currentImage, VkDeviceSize offset, VkDeviceSize size) {
+    VkDeviceSize begin = instanceRingMemory.offset + currentImage * instanceRingStride + offset;
+    // neighbouring instances changed together (e.g. one animated node), extend the last range
+    if (!instanceRingDirtyRanges.empty()) {
+        VkMappedMemoryRange& last = instanceRingDirtyRanges.back();
+        if (last.offset + last.size == begin) {
+            last.size += size;
+            return;
+        }
+    }
+    instanceRingDirtyRanges.push_back({
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = instanceRingMemory.memory,
+        .offset = begin,
+        .size = size,
+    });
+}
 
-    memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+void SceneViewer::flushInstanceRing() {
+    // host coherent memory is visible at submit time, nothing to do
+    if (instanceRingCoherent || instanceRingDirtyRanges.empty()) {
+        return;
+    }
+
+    // flush ranges must be multiples of nonCoherentAtomSize, the region stride already is
+    for (auto& range : instanceRingDirtyRanges) {
+        VkDeviceSize end = (range.offset + range.size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+        range.offset = range.offset / nonCoherentAtomSize * nonCoherentAtomSize;
+        range.size = end - range.offset;
+    }
+    vkFlushMappedMemoryRanges(device, static_cast<uint32_t>(instanceRingDirtyRanges.size()), instanceRingDirtyRanges.data());
 }
 
 void SceneViewer::createDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 6> poolSizes{};
+    std::array<VkDescriptorPoolSize, 13> poolSizes{};
     poolSizes[0] = {
         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
         .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
@@ -266,6 +369,34 @@ void SceneViewer::createDescriptorPool() {
         .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
         .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
     };
+    poolSizes[6] = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+    };
+    poolSizes[7] = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+    };
+    poolSizes[8] = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+    };
+    poolSizes[9] = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+    };
+    poolSizes[10] = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * MAX_LIGHT),
+    };
+    poolSizes[11] = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * MAX_LIGHT),
+    };
+    poolSizes[12] = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+    };
 
     VkDescriptorPoolCreateInfo poolInfo {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
@@ -295,8 +426,8 @@ void SceneViewer::createDescriptorSets() {
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         VkDescriptorBufferInfo bufferInfo {
-            .buffer = uniformBuffers[i],
-            .offset = 0,
+            .buffer = instanceRingBuffer,
+            .offset = i * instanceRingStride,
             .range = sizeof(UniformBufferObject),
         };
         VkDescriptorBufferInfo bufferInfo2 {
@@ -304,6 +435,21 @@ void SceneViewer::createDescriptorSets() {
             .offset = 0,
             .range = sizeof(LightUniformBufferObject),
         };
+        VkDescriptorBufferInfo materialBufferInfo {
+            .buffer = materialBuffer,
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        };
+        VkDescriptorBufferInfo lightListBufferInfo {
+            .buffer = clusterLightBuffers[i],
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        };
+        VkDescriptorBufferInfo clusterBufferInfo {
+            .buffer = clusterBuffers[i],
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        };
 
         std::vector<VkDescriptorImageInfo> image2DInfos(MAX_INSTANCE);
         for (int j=0; j<texture2DImageViews.size(); j++) {
@@ -359,6 +505,11 @@ void SceneViewer::createDescriptorSets() {
             shadow2DInfos[j] = imageInfo;
         }
 
+        std::vector<VkDescriptorImageInfo> shadowDepthInfos = shadow2DInfos;
+        for (auto& info : shadowDepthInfos) {
+            info.sampler = shadowMapDepthSampler;
+        }
+
         std::vector<VkDescriptorImageInfo> shadowCubeInfos(MAX_LIGHT);
         for (int j = 0; j < shadowMapCubeImageViews.size(); j++) {
             VkDescriptorImageInfo imageInfo{
@@ -377,8 +528,32 @@ void SceneViewer::createDescriptorSets() {
             shadowCubeInfos[j] = imageInfo;
         }
 
+        // pcss lights point at the dummy, their slots are never sampled
+        std::vector<VkDescriptorImageInfo> momentInfos(MAX_LIGHT);
+        std::vector<VkDescriptorImageInfo> momentCubeInfos(MAX_LIGHT);
+        for (int j = 0; j < MAX_LIGHT; j++) {
+            bool moments = j < static_cast<int>(shadowMomentMaps.size()) && shadowMomentMaps[j].size > 0;
+            momentInfos[j] = {
+                .sampler = shadowMomentSampler,
+                .imageView = moments && shadowMomentMaps[j].layers == 1 ? shadowMomentMaps[j].view : shadowMomentDummyView,
+                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            };
+            momentCubeInfos[j] = {
+                .sampler = shadowMomentSampler,
+                .imageView = moments && shadowMomentMaps[j].layers == 6 ? shadowMomentMaps[j].view : shadowMomentDummyCubeView,
+                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            };
+        }
+
+        // the compare sampler, outside a cascade is lit
+        VkDescriptorImageInfo sunCascadeInfo {
+            .sampler = shadowMapSampler,
+            .imageView = sunCascadeView,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        };
+
         // descriptor WRITEs
-        std::array<VkWriteDescriptorSet, 6> descriptorWrites{};
+        std::array<VkWriteDescriptorSet, 13> descriptorWrites{};
 
         descriptorWrites[0] = {
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -437,6 +612,70 @@ void SceneViewer::createDescriptorSets() {
             .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
             .pImageInfo = shadowCubeInfos.data(),   
         };
+        descriptorWrites[6] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[i],
+            .dstBinding = 6,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &materialBufferInfo,
+        };
+        descriptorWrites[7] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[i],
+            .dstBinding = 7,
+            .dstArrayElement = 0,
+            .descriptorCount = MAX_LIGHT,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = shadowDepthInfos.data(),
+        };
+        descriptorWrites[8] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[i],
+            .dstBinding = 8,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &lightListBufferInfo,
+        };
+        descriptorWrites[9] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[i],
+            .dstBinding = 9,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &clusterBufferInfo,
+        };
+        descriptorWrites[10] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[i],
+            .dstBinding = 10,
+            .dstArrayElement = 0,
+            .descriptorCount = MAX_LIGHT,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = momentInfos.data(),
+        };
+        descriptorWrites[11] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[i],
+            .dstBinding = 11,
+            .dstArrayElement = 0,
+            .descriptorCount = MAX_LIGHT,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = momentCubeInfos.data(),
+        };
+
+        descriptorWrites[12] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSets[i],
+            .dstBinding = 12,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &sunCascadeInfo,
+        };
 
         vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     }
@@ -12,7 +12,7 @@ void SceneViewer::createInstance() {
         .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
         .pEngineName = "No Engine",
         .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-        .apiVersion = VK_API_VERSION_1_0,
+        .apiVersion = VK_API_VERSION_1_1,        // vkGetPhysicalDeviceMemoryProperties2 for the memory budget
     };
 
     // basic createInfo structure, extension and validation layer support is added later
@@ -0,0 +1,201 @@
+#include "../scene_viewer.hpp"
+
+// every light as the shaders read it, slot is its LightUniformBufferObject index or -1 without a shadow
+static ClusterLight packClusterLight(const sconfig::Light& light, int slot) {
+    cglm::Vec4f color = cglm::Vec4f(light.tint[0], light.tint[1], light.tint[2], static_cast<float>(slot));
+    if (light.type == sconfig::LightType::SUN) {
+        const sconfig::Sun& sun = std::get<sconfig::Sun>(light.data);
+        return {
+            .position = cglm::Vec4f(0.0f, 0.0f, 0.0f, 2.0f),
+            .direction = cglm::Vec4f(cglm::normalize(light.direction), sun.strength),
+            .color = color,
+            .metadata = cglm::Vec4f(sun.angle, 0.0f, 0.0f, 0.0f),
+        };
+    }
+    if (light.type == sconfig::LightType::SPOT) {
+        const sconfig::Spot& spot = std::get<sconfig::Spot>(light.data);
+        return {
+            .position = cglm::Vec4f(light.position, 0.0f),
+            .direction = cglm::Vec4f(light.direction, spot.power),
+            .color = color,
+            .metadata = cglm::Vec4f(spot.radius, spot.fov / 2.0f, spot.limit, spot.blend),
+        };
+    }
+    const sconfig::Sphere& sphere = std::get<sconfig::Sphere>(light.data);
+    return {
+        .position = cglm::Vec4f(light.position, 1.0f),
+        .direction = cglm::Vec4f(0.0f, 0.0f, 0.0f, sphere.power),
+        .color = color,
+        .metadata = cglm::Vec4f(sphere.radius, sphere.limit, 0.0f, 0.0f),
+    };
+}
+
+// column or row of the cluster an ndc coordinate falls in
+static int clusterTile(float ndc, int count) {
+    ndc = std::clamp(ndc, -1.0f, 1.0f);
+    return std::clamp(static_cast<int>((ndc + 1.0f) * 0.5f * count), 0, count - 1);
+}
+
+// sized for every light of the scene, the lights do not change after loading
+void SceneViewer::createClusterBuffers() {
+    clusterLightCapacity = std::max<size_t>(scene_config.id2lights.size() + scene_config.id2unshadowedLights.size(), 1);
+    VkDeviceSize lightBufferSize = sizeof(ClusterLight) * clusterLightCapacity;
+    VkDeviceSize clusterBufferSize = sizeof(ClusterHeader) + sizeof(uint32_t) * (2 * CLUSTER_COUNT + MAX_CLUSTER_INDICES);
+
+    clusterLightBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    clusterLightBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    clusterBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    clusterBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(lightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            clusterLightBuffers[i], clusterLightBuffersMemory[i]);
+        createBuffer(clusterBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            clusterBuffers[i], clusterBuffersMemory[i]);
+        memset(clusterLightBuffersMemory[i].mapped, 0, static_cast<size_t>(lightBufferSize));
+        memset(clusterBuffersMemory[i].mapped, 0, static_cast<size_t>(clusterBufferSize));
+    }
+
+    clusterLights.reserve(clusterLightCapacity);
+    clusterBounds.reserve(clusterLightCapacity);
+    clusterData.reserve(2 * CLUSTER_COUNT + MAX_CLUSTER_INDICES);
+}
+
+// bins every light into the froxels its limit sphere can reach. the sphere's screen bounds come from the extreme
+// x / z and y / z over its bounding box, which is conservative, and a sphere crossing the near plane covers the
+// whole screen. the lists are packed per cluster, (first, count) pairs followed by the light indices. when
+// MAX_CLUSTER_INDICES runs out the remaining clusters lose lights. suns light every cluster, so they lead the
+// light buffer and the shaders loop over them without a list
+void SceneViewer::updateLightClusters(uint32_t currentImage) {
+    std::shared_ptr<sconfig::Camera>& camera = scene_config.cameras[scene_config.cur_camera];
+
+    clusterLights.clear();
+    int idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        if (light->type == sconfig::LightType::SUN) {
+            clusterLights.push_back(packClusterLight(*light, idx));
+        }
+        ++idx;
+    }
+    for (auto& [id, light] : scene_config.id2unshadowedLights) {
+        if (light->type == sconfig::LightType::SUN) {
+            clusterLights.push_back(packClusterLight(*light, -1));
+        }
+    }
+    uint32_t sunCount = static_cast<uint32_t>(clusterLights.size());
+
+    idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        if (light->type != sconfig::LightType::SUN) {
+            clusterLights.push_back(packClusterLight(*light, lightBudgets[idx].shadowed ? idx : -1));
+        }
+        ++idx;
+    }
+    for (auto& [id, light] : scene_config.id2unshadowedLights) {
+        if (light->type != sconfig::LightType::SUN) {
+            clusterLights.push_back(packClusterLight(*light, -1));
+        }
+    }
+
+    float zNear = camera->near;
+    float zFar = camera->far;
+    float tanY = std::tan(camera->vfov / 2.0f);
+    float tanX = tanY * camera->aspect;
+    float sliceScale = CLUSTER_Z / std::log(zFar / zNear);
+    cglm::Vec3f dir = cglm::normalize(camera->dir);
+    cglm::Vec3f right = cglm::normalize(cglm::cross(dir, camera->up));
+    cglm::Vec3f up = cglm::cross(right, dir);
+    auto slice = [&](float depth) {
+        return std::clamp(static_cast<int>(std::log(depth / zNear) * sliceScale), 0, CLUSTER_Z - 1);
+    };
+
+    // count per cluster into the count slots
+    clusterBounds.clear();
+    clusterData.assign(2 * CLUSTER_COUNT, 0);
+    for (const auto& light : clusterLights) {
+        std::array<int, 6> bounds = { 1, 0, 0, 0, 0, 0 };
+        if (light.position[3] == 2.0f) {
+            clusterBounds.push_back(bounds);
+            continue;
+        }
+        cglm::Vec3f p = cglm::Vec3f(light.position[0], light.position[1], light.position[2]) - camera->position;
+        float r = light.position[3] == 0.0f ? light.metadata[2] : light.metadata[1];
+        float x = cglm::dot(p, right);
+        float y = cglm::dot(p, up);
+        float z = cglm::dot(p, dir);
+        if (z + r >= zNear && z - r <= zFar) {
+            if (z - r <= zNear) {
+                bounds = { 0, CLUSTER_X - 1, 0, CLUSTER_Y - 1, 0, slice(std::min(z + r, zFar)) };
+            }
+            else {
+                float minX = (x - r) / (x - r < 0.0f ? z - r : z + r) / tanX;
+                float maxX = (x + r) / (x + r > 0.0f ? z - r : z + r) / tanX;
+                float minY = (y - r) / (y - r < 0.0f ? z - r : z + r) / tanY;
+                float maxY = (y + r) / (y + r > 0.0f ? z - r : z + r) / tanY;
+                // rows count down from the top of the screen, where view space y is largest
+                if (minX <= 1.0f && maxX >= -1.0f && minY <= 1.0f && maxY >= -1.0f) {
+                    bounds = { clusterTile(minX, CLUSTER_X), clusterTile(maxX, CLUSTER_X), clusterTile(-maxY, CLUSTER_Y),
+                        clusterTile(-minY, CLUSTER_Y), slice(z - r), slice(std::min(z + r, zFar)) };
+                }
+            }
+        }
+        clusterBounds.push_back(bounds);
+
+        for (int cz = bounds[4]; bounds[0] <= bounds[1] && cz <= bounds[5]; cz++) {
+            for (int cy = bounds[2]; cy <= bounds[3]; cy++) {
+                for (int cx = bounds[0]; cx <= bounds[1]; cx++) {
+                    clusterData[2 * ((cz * CLUSTER_Y + cy) * CLUSTER_X + cx) + 1]++;
+                }
+            }
+        }
+    }
+
+    // prefix sum into first, capped at MAX_CLUSTER_INDICES
+    uint32_t total = 0;
+    for (int c = 0; c < CLUSTER_COUNT; c++) {
+        uint32_t count = std::min(clusterData[2 * c + 1], static_cast<uint32_t>(MAX_CLUSTER_INDICES) - total);
+        clusterData[2 * c] = total;
+        clusterData[2 * c + 1] = 0;
+        total += count;
+    }
+    clusterData.resize(2 * CLUSTER_COUNT + total);
+
+    // fill, a cluster's room ends where the next one starts
+    for (uint32_t light = 0; light < clusterLights.size(); light++) {
+        const std::array<int, 6>& bounds = clusterBounds[light];
+        for (int cz = bounds[4]; bounds[0] <= bounds[1] && cz <= bounds[5]; cz++) {
+            for (int cy = bounds[2]; cy <= bounds[3]; cy++) {
+                for (int cx = bounds[0]; cx <= bounds[1]; cx++) {
+                    int c = (cz * CLUSTER_Y + cy) * CLUSTER_X + cx;
+                    uint32_t end = c + 1 < CLUSTER_COUNT ? clusterData[2 * (c + 1)] : total;
+                    if (clusterData[2 * c] + clusterData[2 * c + 1] < end) {
+                        clusterData[2 * CLUSTER_COUNT + clusterData[2 * c] + clusterData[2 * c + 1]++] = light;
+                    }
+                }
+            }
+        }
+    }
+
+    VkViewport viewport;
+    VkRect2D scissor;
+    mainPassViewport(viewport, scissor);
+    ClusterHeader header {
+        .viewport = cglm::Vec4f(viewport.x, viewport.y, 1.0f / viewport.width, 1.0f / viewport.height),
+        .cameraPos = cglm::Vec4f(camera->position, zNear),
+        .cameraDir = cglm::Vec4f(dir, zFar),
+        .lightCounts = { sunCount, 0, 0, 0 },
+    };
+
+    char* clusterMapped = static_cast<char*>(clusterBuffersMemory[currentImage].mapped);
+    memcpy(clusterMapped, &header, sizeof(ClusterHeader));
+    memcpy(clusterMapped + sizeof(ClusterHeader), clusterData.data(), clusterData.size() * sizeof(uint32_t));
+    memcpy(clusterLightBuffersMemory[currentImage].mapped, clusterLights.data(), clusterLights.size() * sizeof(ClusterLight));
+}
+
+void SceneViewer::cleanClusterResources() {
+    for (size_t i = 0; i < clusterBuffers.size(); i++) {
+        vkDestroyBuffer(device, clusterLightBuffers[i], nullptr);
+        memoryAllocator.free(clusterLightBuffersMemory[i]);
+        vkDestroyBuffer(device, clusterBuffers[i], nullptr);
+        memoryAllocator.free(clusterBuffersMemory[i]);
+    }
+}
@@ -1,11 +1,31 @@
 #include "../scene_viewer.hpp"
 
+// cube face views and projections live in the light ubo, only the face index is pushed
 struct alignas(16) PushConstantStruct {
     int cur_idx;
-    alignas(16) cglm::Mat44f view;
-    alignas(16) cglm::Mat44f proj;
+    int face;                                   // ignored with multiview, gl_ViewIndex picks the face
+    alignas(16) cglm::Vec4f positionScale;      // pushed per mesh by frameRealDraw
+    cglm::Vec4f positionOffset;
 };
 
+// faces in cube map layer order: +x, -x, +y, -y, +z, -z
+static cglm::Mat44f cubeFaceView(const cglm::Vec3f& position, int face) {
+    switch (face) {
+    case 0:
+        return cglm::lookAtLeft(position, position + cglm::Vec3f(1.0f, 0.0f, 0.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
+    case 1:
+        return cglm::lookAtLeft(position, position + cglm::Vec3f(-1.0f, 0.0f, 0.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
+    case 2:
+        return cglm::lookAtLeft(position, position + cglm::Vec3f(0.0f, 1.0f, 0.0f), cglm::Vec3f(0.0f, 0.0f, -1.0f));
+    case 3:
+        return cglm::lookAtLeft(position, position + cglm::Vec3f(0.0f, -1.0f, 0.0f), cglm::Vec3f(0.0f, 0.0f, 1.0f));
+    case 4:
+        return cglm::lookAtLeft(position, position + cglm::Vec3f(0.0f, 0.0f, 1.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
+    default:
+        return cglm::lookAtLeft(position, position + cglm::Vec3f(0.0f, 0.0f, -1.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
+    }
+}
+
 void SceneViewer::lightSetup() {
     // shadowMapImages.resize(MAX_FRAMES_IN_FLIGHT);
     // shadowMapImageViews.resize(MAX_FRAMES_IN_FLIGHT);
@@ -26,8 +46,16 @@ void SceneViewer::lightSetup() {
     //     shadowMapCubeFramebuffers.resize(6);
     // }
 
+    // the light ubo and shadow sampler arrays hold MAX_LIGHT casters, the rest still shade through the clusters
+    while (scene_config.id2lights.size() > MAX_LIGHT) {
+        auto last = std::prev(scene_config.id2lights.end());
+        std::cout << "light " << last->first << " casts no shadow, only " << MAX_LIGHT << " shadow casting lights are supported" << std::endl;
+        scene_config.id2unshadowedLights[last->first] = last->second;
+        scene_config.id2lights.erase(last);
+    }
+
     std::cout << "i1" << std::endl;
-    createRenderPass(VK_FORMAT_R32G32B32A32_SFLOAT, shadowRenderPass, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    createShadowRenderPasses();
     std::cout << "i2" << std::endl;
     createShadowDescriptorSetLayout();
     std::cout << "i3" << std::endl;
@@ -36,10 +64,13 @@ void SceneViewer::lightSetup() {
     createLightImagewithViews();
     std::cout << "i5" << std::endl;
     createLightFrameBuffers();
+    createSunCascades();
     std::cout << "i6" << std::endl;
     createShadowMapSampler();
     std::cout << "i7" << std::endl;
     createLightUniformBuffers();
+    createClusterBuffers();
+    createShadowMoments();
     std::cout << "i8" << std::endl;
     createLightDescriptorPool();
     std::cout << "i9" << std::endl;
@@ -54,145 +85,125 @@ void SceneViewer::createLightResources() {
 
 
 // ---------------------------------------- Shadow Vulkan Resources ----------------------------------------
-void SceneViewer::singleCubeShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int light_id) {
-    std::shared_ptr<sconfig::Light> light = scene_config.id2lights[light_id];
-    sconfig::Sphere sphere_data = std::get<sconfig::Sphere>(light->data);
-    uint32_t shadow_width = static_cast<uint32_t>(light->shadow);
-    uint32_t shadow_height = shadow_width;
-    VkExtent2D shadowExtent = { shadow_width, shadow_height };
-
-    std::array<VkClearValue, 2> clearValues{};
-    clearValues[0].color = {{1.0f, 1.0f, 1.0f, 1.0f}};
-    clearValues[1].depthStencil = {1.0f, 0};
-
-    for (int j = 0; j < 6; j++) {
-        // on face-j
-        VkRenderPassBeginInfo renderPassInfo{
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .renderPass = shadowRenderPass,
-            .framebuffer = shadowMapCubeFramebuffers[sphere_idx][j],
-            .renderArea = {
-                .offset = {0, 0},
-                .extent = shadowExtent,
-            },
-            .clearValueCount = static_cast<uint32_t>(clearValues.size()),
-            .pClearValues = clearValues.data(),
-        };
-
-        // get view matrix
-        PushConstantStruct pushConstantStruct{};
-        cglm::Mat44f viewMat = cglm::identity(1.0f);
-        switch (j) {
-        case 0: {
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(90.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(180.0f), cglm::Vec3f(1.0f, 0.0f, 0.0f));
-                viewMat = cglm::lookAtLeft(light->position, light->position + cglm::Vec3f(1.0f, 0.0f, 0.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
-                break;
-            }
-        case 1: {
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(-90.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(180.0f), cglm::Vec3f(1.0f, 0.0f, 0.0f));
-                viewMat = cglm::lookAtLeft(light->position, light->position + cglm::Vec3f(-1.0f, 0.0f, 0.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
-                break;
-            }
-        case 2: {
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(-90.0f), cglm::Vec3f(1.0f, 0.0f, 0.0f));
-                viewMat = cglm::lookAtLeft(light->position, light->position + cglm::Vec3f(0.0f, 1.0f, 0.0f), cglm::Vec3f(0.0f, 0.0f, -1.0f));
-                break;
-            }
-        case 3: {
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(90.0f), cglm::Vec3f(1.0f, 0.0f, 0.0f));
-                viewMat = cglm::lookAtLeft(light->position, light->position + cglm::Vec3f(0.0f, -1.0f, 0.0f), cglm::Vec3f(0.0f, 0.0f, 1.0f));
-                break;
-            }
-        case 4: {
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(180.0f), cglm::Vec3f(1.0f, 0.0f, 0.0f));
-                viewMat = cglm::lookAtLeft(light->position, light->position + cglm::Vec3f(0.0f, 0.0f, 1.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
-                break;
-            }
-        case 5: {
-                // viewMat = cglm::rotate(viewMat, cglm::to_radians(180.0f), cglm::Vec3f(0.0f, 0.0f, 1.0f));
-                viewMat = cglm::lookAtLeft(light->position, light->position + cglm::Vec3f(0.0f, 0.0f, -1.0f), cglm::Vec3f(0.0f, 1.0f, 0.0f));
-                break;
-            }
+// six passes, or a single multiview pass drawing all faces at once. faces has a bit per framebuffer to render
+void SceneViewer::singleCubeShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id, uint32_t faces) {
+    for (int j = 0; j < static_cast<int>(shadowMapCubeFramebuffers[sphere_idx].size()); j++) {
+        if ((faces & (1u << j)) == 0) {
+            continue;
         }
-        pushConstantStruct.cur_idx = sphere_idx + spot_idx;
-        pushConstantStruct.view = viewMat;
-        pushConstantStruct.proj = cglm::perspective(cglm::to_radians(90.0f), 1.0f, 0.1f, sphere_data.limit);
-        pushConstantStruct.proj[1][1] *= -1;
-
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-        vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstantStruct), &pushConstantStruct);
-
-        VkViewport viewport {
-            .x = 0.0f,
-            .y = 0.0f,
-            .width = static_cast<float>(shadowExtent.width),
-            .height = static_cast<float>(shadowExtent.height),
-            .minDepth = 0.0f,
-            .maxDepth = 1.0f,
-        };
-
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = shadowExtent;
-        VkBuffer vertexBuffers[] = {vertexBuffer};
-        VkDeviceSize offsets[] = { 0 };
-
-        auto& cur_frame_material_meshInnerId2ModelMatrices = frame_material_meshInnerId2ModelMatrices[currentFrame];
-        int curInstanceIndex = 0;
-
-        for (auto& pair : cur_frame_material_meshInnerId2ModelMatrices) {
-            MaterialType materialType = pair.first;
-            auto& meshInnerId2ModelMatrices = pair.second;
-            VkPipeline graphicsPipeline = material2Pipelines[materialType];
+        // on face-j
+        beginShadowRenderPass(commandBuffer, shadowMapCubeFramebuffers[sphere_idx][j], true, light_id, VK_SUBPASS_CONTENTS_INLINE);
+        recordShadowView(commandBuffer, spot_idx, sphere_idx, sun_idx, light_id, j);
+        vkCmdEndRenderPass(commandBuffer);
+    }
+    
+}
 
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowGraphicsPipeline);
-            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-            vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout, 0, 1, &shadowDescriptorSets[currentFrame], 0, nullptr);
+void SceneViewer::singleShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id) {
+    beginShadowRenderPass(commandBuffer, shadowMapFramebuffers[spot_idx], false, light_id, VK_SUBPASS_CONTENTS_INLINE);
+    recordShadowView(commandBuffer, spot_idx, sphere_idx, sun_idx, light_id, -1);
+    vkCmdEndRenderPass(commandBuffer);
+}
 
-            frameRealDraw(commandBuffer, curInstanceIndex, meshInnerId2ModelMatrices);
+// a depth pass per cascade layer, cascades has a bit per cascade to render
+void SceneViewer::singleSunShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id, uint32_t cascades) {
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        if ((cascades & (1u << c)) == 0) {
+            continue;
         }
-
+        beginShadowRenderPass(commandBuffer, sunCascadeFramebuffers[sun_idx * SUN_CASCADES + c], false, light_id, VK_SUBPASS_CONTENTS_INLINE);
+        recordShadowView(commandBuffer, spot_idx, sphere_idx, sun_idx, light_id, c);
         vkCmdEndRenderPass(commandBuffer);
     }
-    
 }
 
-void SceneViewer::singleShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int light_id) {
-    std::shared_ptr<sconfig::Light> light = scene_config.id2lights[light_id];
+// every spot light into its tile of the atlas, one render pass for all of them. skipped when no spot is pending,
+// updateShadowCache marks either all spots or none
+void SceneViewer::recordShadowAtlas(VkCommandBuffer commandBuffer) {
+    bool pending = false;
+    int idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        pending = pending || (light->type == sconfig::LightType::SPOT && shadowRenderViews[idx] != 0);
+        ++idx;
+    }
+    if (!pending) {
+        return;
+    }
+
+    beginShadowRenderPass(commandBuffer, shadowMapFramebuffers[0], false, -1, VK_SUBPASS_CONTENTS_INLINE);
+    int spot_idx = 0, sphere_idx = 0, sun_idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        if (light->type == sconfig::LightType::SPOT) {
+            if (shadowRenderViews[spot_idx + sphere_idx + sun_idx] != 0) {
+                recordShadowView(commandBuffer, spot_idx, sphere_idx, sun_idx, id, -1);
+            }
+            ++spot_idx;
+        } else if (light->type == sconfig::LightType::SPHERE) {
+            ++sphere_idx;
+        } else {
+            ++sun_idx;
+        }
+    }
+    vkCmdEndRenderPass(commandBuffer);
+}
 
-    uint32_t shadow_width = static_cast<uint32_t>(light->shadow);
+// spot passes and sun cascades only clear depth, cube faces clear distance to 1 (the light limit) and depth.
+// light_id -1 begins the atlas pass, which clears the whole atlas
+void SceneViewer::beginShadowRenderPass(VkCommandBuffer commandBuffer, VkFramebuffer framebuffer, bool cube, int light_id, VkSubpassContents contents) {
+    uint32_t shadow_width = light_id < 0 ? shadowAtlasSize : static_cast<uint32_t>(scene_config.id2lights.at(light_id)->shadow);
+    if (light_id >= 0 && scene_config.id2lights.at(light_id)->type == sconfig::LightType::SUN) {
+        shadow_width = sunCascadeSize;
+    }
     uint32_t shadow_height = shadow_width;
     VkExtent2D shadowExtent = { shadow_width, shadow_height };
 
     std::array<VkClearValue, 2> clearValues{};
-    clearValues[0].color = {{1.0f, 1.0f, 1.0f, 1.0f}};
-    clearValues[1].depthStencil = {1.0f, 0};
+    if (cube) {
+        clearValues[0].color = {{1.0f, 1.0f, 1.0f, 1.0f}};
+        clearValues[1].depthStencil = {1.0f, 0};
+    }
+    else {
+        clearValues[0].depthStencil = {1.0f, 0};
+    }
 
     VkRenderPassBeginInfo renderPassInfo {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = shadowRenderPass,
-        .framebuffer = shadowMapFramebuffers[spot_idx],
+        .renderPass = cube ? shadowCubeRenderPass : shadowRenderPass,
+        .framebuffer = framebuffer,
         .renderArea = {
             .offset = {0, 0},
             .extent = shadowExtent,
         },
-        .clearValueCount = static_cast<uint32_t>(clearValues.size()),
+        .clearValueCount = cube ? 2u : 1u,
         .pClearValues = clearValues.data(),
     };
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+}
+
+// records one shadow view inside an already begun render pass, face is the cube face for sphere lights, the cascade
+// for suns and -1 for spots. only reads shared state, so several of these can be recorded at once from different threads
+void SceneViewer::recordShadowView(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id, int face) {
+    std::shared_ptr<sconfig::Light> light = scene_config.id2lights.at(light_id);
+    bool sun = light->type == sconfig::LightType::SUN;
+    uint32_t shadow_width = sun ? sunCascadeSize : static_cast<uint32_t>(light->shadow);
+    uint32_t shadow_height = shadow_width;
+    VkExtent2D shadowExtent = { shadow_width, shadow_height };
+    int idx = spot_idx + sphere_idx + sun_idx;
+
+    VkOffset2D shadowOffset = {0, 0};
+    if (face < 0) {
+        const ShadowAtlasTile& tile = shadowAtlasTiles[spot_idx];
+        shadowOffset = { static_cast<int32_t>(tile.x), static_cast<int32_t>(tile.y) };
+        shadowExtent = { tile.size, tile.size };
+    }
 
     PushConstantStruct pushConstantStruct{};
-    pushConstantStruct.cur_idx = sphere_idx + spot_idx;
-    vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstantStruct), &pushConstantStruct);
+    pushConstantStruct.cur_idx = idx;
+    pushConstantStruct.face = face;
 
     VkViewport viewport {
-        .x = 0.0f,
-        .y = 0.0f,
+        .x = static_cast<float>(shadowOffset.x),
+        .y = static_cast<float>(shadowOffset.y),
         .width = static_cast<float>(shadowExtent.width),
         .height = static_cast<float>(shadowExtent.height),
         .minDepth = 0.0f,
@@ -200,33 +211,30 @@ void SceneViewer::singleShadowRenderPass(VkCommandBuffer commandBuffer, int spot
     };
 
     VkRect2D scissor{};
-    scissor.offset = {0, 0};
+    scissor.offset = shadowOffset;
     scissor.extent = shadowExtent;
-    VkBuffer vertexBuffers[] = {vertexBuffer};
+    // position stream only, the shading attributes are never fetched here
+    VkBuffer vertexBuffers[] = {vertexPositionBuffer};
     VkDeviceSize offsets[] = { 0 };
 
-    auto& cur_frame_material_meshInnerId2ModelMatrices = frame_material_meshInnerId2ModelMatrices[currentFrame];
-    int curInstanceIndex = 0;
-
-    for (auto& pair : cur_frame_material_meshInnerId2ModelMatrices) {
-        MaterialType materialType = pair.first;
-        auto& meshInnerId2ModelMatrices = pair.second;
-        VkPipeline graphicsPipeline = material2Pipelines[materialType];
-
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowGraphicsPipeline);
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout, 0, 1, &shadowDescriptorSets[currentFrame], 0, nullptr);
-
-        frameRealDraw(commandBuffer, curInstanceIndex, meshInnerId2ModelMatrices);
-    }
-
-    vkCmdEndRenderPass(commandBuffer);
+    // shadow pass ignores materials, every batch goes through the same pipeline. sun cascades are depth only like spots
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, face >= 0 && !sun ? shadowCubeGraphicsPipeline : shadowGraphicsPipeline);
+    vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, offsetof(PushConstantStruct, positionScale), &pushConstantStruct);
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout, 0, 1, &shadowDescriptorSets[currentFrame], 0, nullptr);
+
+    const auto& batches = frameDrawLists[currentFrame].shadowBatches[idx * 6 + std::max(face, 0)];
+    frameRealDraw(commandBuffer, batches, 0, batches.size(), shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+        offsetof(PushConstantStruct, positionScale), offsetof(MeshPushConstants, materialSlot));
 }
 
 void SceneViewer::updateWholeLightUniformBuffer(uint32_t currentImage, LightUniformBufferObject& lubo) {
     int idx = 0;
+    int spot_idx = 0;
+    int sphere_idx = 0;
+    int sun_idx = 0;
     for (auto& [id, light] : scene_config.id2lights) {
         if (light->type == sconfig::LightType::SPOT) {
             sconfig::Spot spot_data = std::get<sconfig::Spot>(light->data);
@@ -237,17 +245,23 @@ void SceneViewer::updateWholeLightUniformBuffer(uint32_t currentImage, LightUnif
             cglm::Vec3f view_point = light->position + light->direction;
             cglm::Mat44f view_mat = cglm::lookAt(light->position, view_point, light->up);
             lubo.lightViewMatrix[idx] = view_mat;
-
-            cglm::Mat44f proj_mat = cglm::perspective(spot_data.fov, 1.0f, 0.1f, spot_data.limit);
-            proj_mat[1][1] *= -1;
-            lubo.lightProjMatrix[idx] = proj_mat;
+            lubo.lightProjMatrix[idx] = fitShadowProjection(light->position, spot_data.fov, spot_data.limit);
 
             float radius = spot_data.radius;
             float fov = spot_data.fov;
             float limit = spot_data.limit;
             float blend = spot_data.blend;
             lubo.metadata1[idx] = cglm::Vec4f(radius, fov / 2.0f, limit, blend);
-            lubo.metadata2[idx][3] = light->shadow;
+
+            // metadata2.x is the slot in the shadowMapSampler arrays, every slot holds the atlas when there is one.
+            // the tile is the rendered square of the atlas or of the light's own map
+            const ShadowAtlasTile& tile = shadowAtlasTiles[spot_idx];
+            float mapSize = static_cast<float>(shadowAtlasSize > 0 ? shadowAtlasSize : static_cast<uint32_t>(light->shadow));
+            lubo.shadowRects[idx] = cglm::Vec4f(tile.x / mapSize, tile.y / mapSize, tile.size / mapSize, tile.size / mapSize);
+            lubo.metadata2[idx][0] = shadowAtlasSize > 0 ? 0.0f : static_cast<float>(spot_idx);
+            lubo.metadata2[idx][1] = shadowMomentMaps[idx].size > 0 ? 1.0f : 0.0f;    // filtered with evsm
+            lubo.metadata2[idx][3] = tile.size > 0 ? static_cast<float>(tile.size) : light->shadow;
+            ++spot_idx;
         }
         else if (light->type == sconfig::LightType::SPHERE) {
             sconfig::Sphere sphere_data = std::get<sconfig::Sphere>(light->data);
@@ -255,11 +269,33 @@ void SceneViewer::updateWholeLightUniformBuffer(uint32_t currentImage, LightUnif
             lubo.lightDir[idx] = cglm::Vec4f(0.0f, 0.0f, 0.0f, sphere_data.power);       // last bit is power
             lubo.lightColor[idx] = cglm::Vec4f(light->tint[0], light->tint[1], light->tint[2], 1.0f);
 
+            // shared by the six faces
+            lubo.lightProjMatrix[idx] = fitShadowProjection(light->position, cglm::to_radians(90.0f), sphere_data.limit);
+            for (int face = 0; face < 6; face++) {
+                lubo.cubeFaceViews[idx * 6 + face] = cubeFaceView(light->position, face);
+            }
+            updateCubeFaceMasks(idx, light->position, sphere_data.limit, lubo);
+
             float radius = sphere_data.radius;
             float limit = sphere_data.limit;
 
             lubo.metadata1[idx] = cglm::Vec4f(radius, limit, 0.0f, 0.0f);
+            lubo.metadata2[idx][0] = static_cast<float>(sphere_idx);   // slot in shadowCubeMapSampler
+            lubo.metadata2[idx][1] = shadowMomentMaps[idx].size > 0 ? 1.0f : 0.0f;
             lubo.metadata2[idx][3] = light->shadow;
+            ++sphere_idx;
+        }
+        else if (light->type == sconfig::LightType::SUN) {
+            sconfig::Sun sun_data = std::get<sconfig::Sun>(light->data);
+            lubo.lightPos[idx] = cglm::Vec4f(light->position, 2.0f);                                 // last bit is type
+            lubo.lightDir[idx] = cglm::Vec4f(cglm::normalize(light->direction), sun_data.strength);  // last bit is strength
+            lubo.lightColor[idx] = cglm::Vec4f(light->tint[0], light->tint[1], light->tint[2], 1.0f);
+
+            updateSunCascades(idx, *light, lubo);
+            lubo.metadata2[idx][0] = static_cast<float>(sun_idx);     // its cascades start at layer sun_idx * SUN_CASCADES
+            lubo.metadata2[idx][1] = 0.0f;
+            lubo.metadata2[idx][3] = static_cast<float>(sunCascadeSize);
+            ++sun_idx;
         }
 
         ++idx;
@@ -270,6 +306,427 @@ void SceneViewer::updateWholeLightUniformBuffer(uint32_t currentImage, LightUnif
     memcpy(shadowUniformBuffersMapped[currentImage], &lubo, sizeof(lubo));
 }
 
+// square perspective with depth in [0, 1] and y flipped. cglm::perspective maps to [-1, 1], which
+// clipped the first half of its range. near and far are fitted to the bounding spheres of this frame
+// that the light reaches, so depth precision is spent where casters actually are
+cglm::Mat44f SceneViewer::fitShadowProjection(const cglm::Vec3f& position, float fovy, float limit) {
+    float nearest = limit;
+    float farthest = 0.0f;
+    for (const auto& bound : frameDrawLists[currentFrame].bounds) {
+        float distance = cglm::length(cglm::Vec3f(bound[0], bound[1], bound[2]) - position);
+        if (distance - bound[3] > limit) {
+            continue;
+        }
+        nearest = std::min(nearest, distance - bound[3]);
+        farthest = std::max(farthest, distance + bound[3]);
+    }
+
+    // shadow.vert moves casters up to 0.08 along their normals
+    float zNear = std::max(nearest - 0.1f, 0.05f);
+    float zFar = std::min(farthest + 0.1f, limit);
+    if (zFar <= zNear) {
+        zNear = 0.1f;
+        zFar = std::max(limit, 0.2f);
+    }
+
+    float f = 1.0f / std::tan(fovy / 2.0f);
+    return cglm::Mat44f(
+        {f, 0, 0, 0},
+        {0, -f, 0, 0},
+        {0, 0, zFar / (zNear - zFar), -1},
+        {0, 0, zNear * zFar / (zNear - zFar), 0}
+    );
+}
+
+// bit mask of the cube faces a bounding sphere touches, p relative to the light. a face is the 90 degree frustum
+// around one axis, so the test is against its four side planes
+static uint32_t cubeFaceMask(const cglm::Vec3f& p, float r, float limit) {
+    const float invSqrt2 = 0.70710678f;
+    uint32_t mask = 0;
+    if (cglm::length(p) - r > limit) {
+        return mask;
+    }
+    for (int face = 0; face < 6; face++) {
+        int axis = face / 2;
+        float along = (face % 2 == 0) ? p[axis] : -p[axis];
+        float side0 = p[(axis + 1) % 3];
+        float side1 = p[(axis + 2) % 3];
+        if ((along - std::abs(side0)) * invSqrt2 >= -r && (along - std::abs(side1)) * invSqrt2 >= -r) {
+            mask |= 1u << face;
+        }
+    }
+    return mask;
+}
+
+// 1 when a bounding sphere reaches the square pyramid of a spot shadow map, p relative to the light
+static uint32_t spotCasterMask(const cglm::Vec3f& p, float r, float limit, const cglm::Vec3f& dir, const cglm::Vec3f& right,
+    const cglm::Vec3f& up, float halfFov) {
+    if (cglm::length(p) - r > limit) {
+        return 0;
+    }
+    float s = std::sin(halfFov), c = std::cos(halfFov);
+    float along = cglm::dot(p, dir) * s;
+    float x = std::abs(cglm::dot(p, right)) * c;
+    float y = std::abs(cglm::dot(p, up)) * c;
+    return (along - x >= -r && along - y >= -r) ? 1u : 0u;
+}
+
+// bit per sun cascade a bounding sphere can cast into: inside the box of the cascade's sphere across the sun's view
+// and not past its far side, anything between the sun and the slice is a caster
+static uint32_t sunCascadeMask(const cglm::Vec4f& bound, const SunCascade* cascades, const cglm::Vec3f& dir, const cglm::Vec3f& right,
+    const cglm::Vec3f& up) {
+    uint32_t mask = 0;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        cglm::Vec3f p = cglm::Vec3f(bound[0], bound[1], bound[2]) - cascades[c].center;
+        float reach = cascades[c].radius + bound[3];
+        if (std::abs(cglm::dot(p, right)) <= reach && std::abs(cglm::dot(p, up)) <= reach && cglm::dot(p, dir) <= reach) {
+            mask |= 1u << c;
+        }
+    }
+    return mask;
+}
+
+// per instance mask for shadow.vert, which drops an instance on the faces it misses
+void SceneViewer::updateCubeFaceMasks(int idx, const cglm::Vec3f& position, float limit, LightUniformBufferObject& lubo) {
+    const auto& bounds = frameDrawLists[currentFrame].sortedBounds;
+    size_t count = std::min(bounds.size(), static_cast<size_t>(MAX_INSTANCE));
+    for (size_t i = 0; i < count; i++) {
+        cglm::Vec3f p = cglm::Vec3f(bounds[i][0], bounds[i][1], bounds[i][2]) - position;
+        lubo.cubeFaceMasks[idx * MAX_INSTANCE + i] = cubeFaceMask(p, bounds[i][3], limit);
+    }
+}
+
+// splits every batch into runs of consecutive instances whose mask has bit set
+static void appendCasterBatches(std::vector<DrawBatch>& out, const std::vector<DrawBatch>& batches, const std::vector<uint32_t>& masks, uint32_t bit) {
+    for (const auto& batch : batches) {
+        uint32_t end = batch.firstInstance + batch.instanceCount;
+        uint32_t runStart = end;
+        for (uint32_t i = batch.firstInstance; i <= end; i++) {
+            bool caster = i < end && (masks[i] & bit) != 0;
+            if (caster && runStart == end) {
+                runStart = i;
+            }
+            else if (!caster && runStart != end) {
+                DrawBatch run = batch;
+                run.firstInstance = runStart;
+                run.instanceCount = i - runStart;
+                out.push_back(run);
+                runStart = end;
+            }
+        }
+    }
+}
+
+// a draw list per shadow view with only the casters inside it: the range sphere of the light, then the spot
+// pyramid or the cube face frustum, or the box of a sun cascade. a multiview cube draws every face at once, so it
+// gets the union of its faces
+void SceneViewer::buildShadowDrawLists() {
+    FrameDrawList& drawList = frameDrawLists[currentFrame];
+    drawList.casterMasks.resize(drawList.sortedBounds.size());
+    drawList.shadowBatches.resize(scene_config.id2lights.size() * 6);
+    for (auto& batches : drawList.shadowBatches) {
+        batches.clear();
+    }
+
+    int idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        // lights past the shadow budget cast no shadow, their lists stay empty
+        if (!lightBudgets[idx].shadowed) {
+            ++idx;
+            continue;
+        }
+        bool sphere = light->type == sconfig::LightType::SPHERE;
+        bool sun = light->type == sconfig::LightType::SUN;
+        cglm::Vec3f dir = cglm::normalize(light->direction);
+        cglm::Vec3f right = cglm::normalize(cglm::cross(dir, light->up));
+        cglm::Vec3f up = cglm::cross(right, dir);
+
+        for (size_t i = 0; i < drawList.sortedBounds.size(); i++) {
+            const cglm::Vec4f& bound = drawList.sortedBounds[i];
+            cglm::Vec3f p = cglm::Vec3f(bound[0], bound[1], bound[2]) - light->position;
+            if (sun) {
+                drawList.casterMasks[i] = sunCascadeMask(bound, &sunCascades[idx * SUN_CASCADES], dir, right, up);
+            }
+            else if (sphere) {
+                drawList.casterMasks[i] = cubeFaceMask(p, bound[3], std::get<sconfig::Sphere>(light->data).limit);
+            }
+            else {
+                const sconfig::Spot& spot = std::get<sconfig::Spot>(light->data);
+                drawList.casterMasks[i] = spotCasterMask(p, bound[3], spot.limit, dir, right, up, spot.fov / 2.0f);
+            }
+        }
+
+        if (sun) {
+            for (int c = 0; c < SUN_CASCADES; c++) {
+                appendCasterBatches(drawList.shadowBatches[idx * 6 + c], drawList.batches, drawList.casterMasks, 1u << c);
+            }
+        }
+        else if (!sphere) {
+            appendCasterBatches(drawList.shadowBatches[idx * 6], drawList.batches, drawList.casterMasks, 1u);
+        }
+        else if (multiviewCubeShadows) {
+            appendCasterBatches(drawList.shadowBatches[idx * 6], drawList.batches, drawList.casterMasks, 0x3fu);
+        }
+        else {
+            for (int face = 0; face < 6; face++) {
+                appendCasterBatches(drawList.shadowBatches[idx * 6 + face], drawList.batches, drawList.casterMasks, 1u << face);
+            }
+        }
+        ++idx;
+    }
+}
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// picks the shadow views rendered this frame, the others keep last frame's content. a view is hashed from what it
+// was rendered with: the light matrices and tile for spots, the position for cube faces, the cascade matrix for
+// suns, then mesh and model of every caster in its draw list. a changed hash leaves the view pending until it is rendered
+void SceneViewer::updateShadowCache(const LightUniformBufferObject& lubo) {
+    const uint64_t FNV_OFFSET = 14695981039346656037ull;
+    const FrameDrawList& drawList = frameDrawLists[currentFrame];
+    std::shared_ptr<sconfig::Camera>& camera = scene_config.cameras[scene_config.cur_camera];
+
+    shadowCache.resize(scene_config.id2lights.size());
+    shadowRenderViews.assign(scene_config.id2lights.size(), 0);
+    bool atlasPending = false;
+    bool facesLeft = false;
+    int idx = 0, spot_idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        ShadowCacheEntry& entry = shadowCache[idx];
+        bool sphere = light->type == sconfig::LightType::SPHERE;
+        bool sun = light->type == sconfig::LightType::SUN;
+        if (!lightBudgets[idx].shadowed) {
+            // nothing rendered, so everything is pending once it casts shadows again
+            entry = {};
+            spot_idx += light->type == sconfig::LightType::SPOT ? 1 : 0;
+            ++idx;
+            continue;
+        }
+        int views = sun ? SUN_CASCADES : (sphere && !multiviewCubeShadows) ? 6 : 1;
+
+        uint64_t hashes[6];
+        for (int f = 0; f < views; f++) {
+            if (sun) {
+                hashes[f] = hashBytes(FNV_OFFSET, &lubo.cascadeMatrices[idx * SUN_CASCADES + f], sizeof(cglm::Mat44f));
+            }
+            else if (sphere) {
+                hashes[f] = hashBytes(FNV_OFFSET, &light->position, sizeof(cglm::Vec3f));
+            }
+            else {
+                hashes[f] = hashBytes(FNV_OFFSET, &lubo.lightViewMatrix[idx], sizeof(cglm::Mat44f));
+                hashes[f] = hashBytes(hashes[f], &lubo.lightProjMatrix[idx], sizeof(cglm::Mat44f));
+                hashes[f] = hashBytes(hashes[f], &shadowAtlasTiles[spot_idx], sizeof(ShadowAtlasTile));
+            }
+        }
+        for (int f = 0; f < views; f++) {
+            for (const auto& batch : drawList.shadowBatches[idx * 6 + f]) {
+                for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++) {
+                    hashes[f] = hashBytes(hashes[f], &batch.meshInnerId, sizeof(int));
+                    hashes[f] = hashBytes(hashes[f], &drawList.sortedModels[i], sizeof(cglm::Mat44f));
+                }
+            }
+        }
+        for (int f = 0; f < views; f++) {
+            if (hashes[f] != entry.hashes[f] || shadowUpdate == ShadowUpdate::always) {
+                entry.hashes[f] = hashes[f];
+                entry.pending |= 1u << f;
+            }
+        }
+
+        if (sun) {
+            // a stale cascade would not match its matrix in the light ubo, so every pending one is rendered
+            shadowRenderViews[idx] = static_cast<uint8_t>(entry.pending);
+            entry.pending = 0;
+        }
+        else if (!sphere) {
+            // the atlas pass clears every tile, so its spots are rendered together
+            atlasPending = atlasPending || entry.pending != 0;
+            shadowRenderViews[idx] = static_cast<uint8_t>(entry.pending);
+            entry.pending = 0;
+            ++spot_idx;
+        }
+        else if (multiviewCubeShadows) {
+            // one framebuffer for all faces
+            shadowRenderViews[idx] = entry.pending != 0 ? 1 : 0;
+            entry.pending = 0;
+        }
+        else if (shadowUpdate == ShadowUpdate::amortized &&
+            cglm::length(camera->position - light->position) > std::get<sconfig::Sphere>(light->data).limit) {
+            // the camera is out of the light's reach, stale faces are less visible there
+            for (int k = 0; k < 6; k++) {
+                int face = (entry.nextFace + k) % 6;
+                if (entry.pending & (1u << face)) {
+                    shadowRenderViews[idx] = static_cast<uint8_t>(1u << face);
+                    entry.pending &= ~(1u << face);
+                    entry.nextFace = (face + 1) % 6;
+                    break;
+                }
+            }
+        }
+        else {
+            shadowRenderViews[idx] = static_cast<uint8_t>(entry.pending);
+            entry.pending = 0;
+        }
+        facesLeft = facesLeft || entry.pending != 0;
+        ++idx;
+    }
+
+    // amortized faces still pending need more frames, --render-on-demand would otherwise wait for input
+    if (facesLeft) {
+        frameRequested = true;
+    }
+
+    if (shadowAtlasSize > 0 && atlasPending) {
+        idx = 0;
+        for (auto& [id, light] : scene_config.id2lights) {
+            if (light->type == sconfig::LightType::SPOT && lightBudgets[idx].shadowed) {
+                shadowRenderViews[idx] = 1;
+            }
+            ++idx;
+        }
+    }
+}
+
+// lights whose limit sphere misses the view frustum are dropped, the rest are ranked by a rough estimate of their
+// screen contribution: power times the share of the fov their reach covers, falling off with distance to the camera.
+// only the best shadowBudget of them cast shadows. a spot's shadow size follows its coverage, where its cone is
+// bounded by a sphere of radius limit / 2 halfway along the direction, rounded down to a power of two
+void SceneViewer::updateLightBudget() {
+    const uint32_t MIN_SHADOW_SIZE = 32;
+    std::shared_ptr<sconfig::Camera>& camera = scene_config.cameras[scene_config.cur_camera];
+
+    lightBudgets.resize(scene_config.id2lights.size());
+    lightRanking.clear();
+    int idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        LightBudget& budget = lightBudgets[idx];
+        if (light->type == sconfig::LightType::SUN) {
+            // reaches every view, its cascades are always rendered and do not count against the budget
+            budget = { .visible = true, .shadowed = true, .coverage = 1.0f, .score = 0.0f, .shadowSize = sunCascadeSize };
+            ++idx;
+            continue;
+        }
+        bool sphere = light->type == sconfig::LightType::SPHERE;
+        float limit = sphere ? std::get<sconfig::Sphere>(light->data).limit : std::get<sconfig::Spot>(light->data).limit;
+        float power = sphere ? std::get<sconfig::Sphere>(light->data).power : std::get<sconfig::Spot>(light->data).power;
+
+        budget.visible = true;
+        for (auto& plane : camera->bounds) {
+            if (cglm::dot(plane->normal, light->position) - plane->d + limit < 0.0f) {
+                budget.visible = false;
+                break;
+            }
+        }
+
+        float radius = sphere ? limit : limit * 0.5f;
+        cglm::Vec3f center = sphere ? light->position : light->position + cglm::normalize(light->direction) * radius;
+        float distance = cglm::length(center - camera->position);
+        budget.coverage = 1.0f;
+        if (distance > radius) {
+            budget.coverage = std::min(1.0f, 2.0f * std::asin(radius / distance) / camera->vfov);
+        }
+        float lightDistance = cglm::length(light->position - camera->position);
+        budget.score = power * budget.coverage / (1.0f + lightDistance * lightDistance);
+        budget.shadowed = false;
+        budget.shadowSize = 0;
+        if (budget.visible) {
+            lightRanking.push_back(idx);
+        }
+        ++idx;
+    }
+
+    std::sort(lightRanking.begin(), lightRanking.end(), [&](int a, int b) { return lightBudgets[a].score > lightBudgets[b].score; });
+    for (int i = 0; i < std::min(shadowBudget, static_cast<int>(lightRanking.size())); i++) {
+        lightBudgets[lightRanking[i]].shadowed = true;
+    }
+
+    idx = 0;
+    int spot_idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        if (light->type != sconfig::LightType::SPOT) {
+            ++idx;
+            continue;
+        }
+        LightBudget& budget = lightBudgets[idx];
+        if (budget.shadowed) {
+            float maxSize = static_cast<float>(light->shadow);
+            budget.shadowSize = MIN_SHADOW_SIZE;
+            while (budget.shadowSize * 2 <= maxSize && budget.shadowSize * 2 <= maxSize * budget.coverage) {
+                budget.shadowSize *= 2;
+            }
+        }
+        // without an atlas the spot renders into the corner of its own map
+        if (shadowAtlasSize == 0) {
+            shadowAtlasTiles[spot_idx] = { 0, 0, budget.shadowSize };
+        }
+        ++spot_idx;
+        ++idx;
+    }
+}
+
+// every shadowed spot gets a tile of its budgeted size, at most the atlas. power of two squares placed largest first
+// fill a quadtree without gaps, when they do not fit every tile is halved and packed again
+void SceneViewer::packShadowAtlas() {
+    const uint32_t MIN_TILE = 32;
+
+    shadowAtlasRequests.clear();
+    int idx = 0, spot_idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        if (light->type == sconfig::LightType::SPOT) {
+            shadowAtlasTiles[spot_idx] = { 0, 0, 0 };
+            if (lightBudgets[idx].shadowed) {
+                shadowAtlasRequests.push_back({ std::min(lightBudgets[idx].shadowSize, shadowAtlasSize), spot_idx });
+            }
+            ++spot_idx;
+        }
+        ++idx;
+    }
+    std::sort(shadowAtlasRequests.begin(), shadowAtlasRequests.end(), std::greater<>());
+
+    for (;;) {
+        shadowAtlasFreeTiles.clear();
+        shadowAtlasFreeTiles.push_back({ 0, 0, shadowAtlasSize });
+        bool packed = true;
+        for (const auto& [size, spot] : shadowAtlasRequests) {
+            // smallest free square that holds the tile, split into quadrants down to the tile size
+            int best = -1;
+            for (int i = 0; i < static_cast<int>(shadowAtlasFreeTiles.size()); i++) {
+                if (shadowAtlasFreeTiles[i].size >= size && (best < 0 || shadowAtlasFreeTiles[i].size < shadowAtlasFreeTiles[best].size)) {
+                    best = i;
+                }
+            }
+            if (best < 0) {
+                packed = false;
+                break;
+            }
+            ShadowAtlasTile tile = shadowAtlasFreeTiles[best];
+            shadowAtlasFreeTiles.erase(shadowAtlasFreeTiles.begin() + best);
+            while (tile.size > size) {
+                tile.size /= 2;
+                shadowAtlasFreeTiles.push_back({ tile.x + tile.size, tile.y, tile.size });
+                shadowAtlasFreeTiles.push_back({ tile.x, tile.y + tile.size, tile.size });
+                shadowAtlasFreeTiles.push_back({ tile.x + tile.size, tile.y + tile.size, tile.size });
+            }
+            shadowAtlasTiles[spot] = tile;
+        }
+        if (packed) {
+            return;
+        }
+        if (shadowAtlasRequests.front().first <= MIN_TILE) {
+            throw std::runtime_error("shadow atlas is too small for the spot lights!");
+        }
+        for (auto& request : shadowAtlasRequests) {
+            request.first = std::max(request.first / 2, MIN_TILE);
+        }
+    }
+}
+
 void SceneViewer::updateCurLightUBOIndex(uint32_t currentImage, int idx, LightUniformBufferObject& lubo) {
     lubo.metadata2[0][0] = idx;
     std::cout << "Modified Index: " << idx << std::endl;
@@ -355,8 +812,8 @@ void SceneViewer::createLightDescriptorSets() {
         };
 
         VkDescriptorBufferInfo bufferInfo2 {
-            .buffer = uniformBuffers[i],
-            .offset = 0,
+            .buffer = instanceRingBuffer,
+            .offset = i * instanceRingStride,
             .range = sizeof(UniformBufferObject),
         };
 
@@ -422,7 +879,7 @@ void SceneViewer::createLightUniformBuffers() {
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shadowUniformBuffers[i], shadowUniformBuffersMemory[i]);
-        vkMapMemory(device, shadowUniformBuffersMemory[i], 0, bufferSize, 0, &shadowUniformBuffersMapped[i]);
+        shadowUniformBuffersMapped[i] = shadowUniformBuffersMemory[i].mapped;
     }
 }
 
@@ -431,6 +888,41 @@ void SceneViewer::createShadowMapSampler() {
     VkPhysicalDeviceProperties properties{};
     vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
+    // spot maps: a compare sampler for pcf (bilinear where the format allows it) and a raw one for blocker search.
+    // outside the map is the border, far depth, so it is lit
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, shadowMapFormat, &formatProperties);
+    bool linearCompare = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+    VkSamplerCreateInfo depthSamplerInfo {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = linearCompare ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+        .minFilter = linearCompare ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+        .mipLodBias = 0.0f,
+        .anisotropyEnable = VK_FALSE,
+        .maxAnisotropy = 1.0f,
+        .compareEnable = VK_TRUE,
+        .compareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
+        .minLod = 0.0f,
+        .maxLod = 0.0f,
+        .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+        .unnormalizedCoordinates = VK_FALSE,
+    };
+    if (vkCreateSampler(device, &depthSamplerInfo, nullptr, &shadowMapSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadowMap sampler!");
+    }
+
+    depthSamplerInfo.magFilter = VK_FILTER_NEAREST;
+    depthSamplerInfo.minFilter = VK_FILTER_NEAREST;
+    depthSamplerInfo.compareEnable = VK_FALSE;
+    depthSamplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    if (vkCreateSampler(device, &depthSamplerInfo, nullptr, &shadowMapDepthSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadowMap depth sampler!");
+    }
+
     VkSamplerCreateInfo samplerInfo {
         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
         .magFilter = VK_FILTER_NEAREST,
@@ -450,10 +942,6 @@ void SceneViewer::createShadowMapSampler() {
         .unnormalizedCoordinates = VK_FALSE,
     };
 
-    if (vkCreateSampler(device, &samplerInfo, nullptr, &shadowMapSampler) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create shadowMap sampler!");
-    }
-
     if (vkCreateSampler(device, &samplerInfo, nullptr, &shadowMapCubeSampler) != VK_SUCCESS) {
         throw std::runtime_error("failed to create shadowCubeMap sampler!");
     }
@@ -475,19 +963,18 @@ void SceneViewer::createLightImagewithViews() {
 
     std::cout << "Spot Light Count: " << spot_cnt << std::endl;
     std::cout << "Sphere Light Count: " << sphere_cnt << std::endl;
-    shadowMapImages.resize(spot_cnt);
-    shadowMapImageViews.resize(spot_cnt);
-    shadowMapImageMemorys.resize(spot_cnt);
-    shadowDepthImages.resize(spot_cnt);
-    shadowDepthImageViews.resize(spot_cnt);
-    shadowDepthImageMemorys.resize(spot_cnt);
+    // with the atlas every spot light shares one depth image
+    int spot_images = shadowAtlasSize > 0 ? 1 : spot_cnt;
+    shadowMapImages.resize(spot_images);
+    shadowMapImageViews.resize(spot_images);
+    shadowMapImageMemorys.resize(spot_images);
 
     shadowMapCubeImages.resize(sphere_cnt);
     shadowMapCubeImageViews.resize(sphere_cnt);
     shadowMapCubeImageMemorys.resize(sphere_cnt);
     shadowMapCubeFacesImageViews.resize(sphere_cnt);
     for (int j=0; j<sphere_cnt; j++) {
-        shadowMapCubeFacesImageViews[j].resize(6);
+        shadowMapCubeFacesImageViews[j].resize(multiviewCubeShadows ? 1 : 6);
     }
     shadowCubeDepthImages.resize(sphere_cnt);
     shadowCubeDepthImageViews.resize(sphere_cnt);
@@ -495,17 +982,24 @@ void SceneViewer::createLightImagewithViews() {
 
     int idx = 0;
     VkFormat depthFormat = findDepthFormat();
+    int layers = multiviewCubeShadows ? 6 : 1;     // multiview renders every face in one pass, so depth needs a layer each
+    if (shadowAtlasSize > 0) {
+        createImage(shadowAtlasSize, shadowAtlasSize, 0, VK_IMAGE_TYPE_2D, shadowMapFormat,
+            VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapImages[0], shadowMapImageMemorys[0], 1);
+        shadowMapImageViews[0] = createImageView2D(shadowMapImages[0], shadowMapFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+    }
+    shadowAtlasTiles.resize(spot_cnt);
     for (auto& [id, light] : scene_config.id2lights) {
-        // together with depth image
+        if (shadowAtlasSize > 0) {
+            break;
+        }
+        // the depth attachment is the shadow map
         if (light->type == sconfig::LightType::SPOT) {
-            createImage(light->shadow, light->shadow, 0, VK_IMAGE_TYPE_2D, VK_FORMAT_R32G32B32A32_SFLOAT,
-                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            createImage(light->shadow, light->shadow, 0, VK_IMAGE_TYPE_2D, shadowMapFormat,
+                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapImages[idx], shadowMapImageMemorys[idx], 1);
-            createImage(light->shadow, light->shadow, 0, VK_IMAGE_TYPE_2D, depthFormat,
-                VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowDepthImages[idx], shadowDepthImageMemorys[idx], 1);
-            shadowMapImageViews[idx] = createImageView2D(shadowMapImages[idx], VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
-            shadowDepthImageViews[idx] = createImageView2D(shadowDepthImages[idx], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+            shadowMapImageViews[idx] = createImageView2D(shadowMapImages[idx], shadowMapFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
             ++idx;
         }
 
@@ -515,18 +1009,18 @@ void SceneViewer::createLightImagewithViews() {
     for (auto& [id, light] : scene_config.id2lights) {
         if (light->type == sconfig::LightType::SPHERE) {
             createImage(light->shadow, light->shadow, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT,
-                VK_IMAGE_TYPE_2D, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_TYPE_2D, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
                 VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                 shadowMapCubeImages[idx], shadowMapCubeImageMemorys[idx], 6);
             createImage(light->shadow, light->shadow, 0, VK_IMAGE_TYPE_2D, depthFormat,
                 VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowCubeDepthImages[idx], shadowCubeDepthImageMemorys[idx], 1);
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowCubeDepthImages[idx], shadowCubeDepthImageMemorys[idx], layers);
 
             VkImageViewCreateInfo viewInfo {
                 .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
                 .image = shadowMapCubeImages[idx],
                 .viewType = VK_IMAGE_VIEW_TYPE_CUBE,
-                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .format = VK_FORMAT_R32_SFLOAT,
                 .subresourceRange = {
                     .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                     .baseMipLevel = 0,
@@ -541,18 +1035,46 @@ void SceneViewer::createLightImagewithViews() {
                 throw std::runtime_error("failed to create texture image view!");
             }
 
-            // then is 6 faces 2D view
-            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            viewInfo.subresourceRange.layerCount = 1;
-            for (int j = 0; j < 6; j++) {
-                viewInfo.subresourceRange.baseArrayLayer = j;
-                if (vkCreateImageView(device, &viewInfo, nullptr, &shadowMapCubeFacesImageViews[idx][j]) != VK_SUCCESS) {
+            // then is 6 faces 2D view, or all faces as one array for multiview
+            if (multiviewCubeShadows) {
+                viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+                if (vkCreateImageView(device, &viewInfo, nullptr, &shadowMapCubeFacesImageViews[idx][0]) != VK_SUCCESS) {
                     throw std::runtime_error("failed to create texture image view!");
                 }
             }
+            else {
+                viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.subresourceRange.layerCount = 1;
+                for (int j = 0; j < 6; j++) {
+                    viewInfo.subresourceRange.baseArrayLayer = j;
+                    if (vkCreateImageView(device, &viewInfo, nullptr, &shadowMapCubeFacesImageViews[idx][j]) != VK_SUCCESS) {
+                        throw std::runtime_error("failed to create texture image view!");
+                    }
+                }
+            }
 
             // then depth view
-            shadowCubeDepthImageViews[idx] = createImageView2D(shadowCubeDepthImages[idx], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+            if (multiviewCubeShadows) {
+                VkImageViewCreateInfo depthViewInfo {
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                    .image = shadowCubeDepthImages[idx],
+                    .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+                    .format = depthFormat,
+                    .subresourceRange = {
+                        .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                        .baseMipLevel = 0,
+                        .levelCount = 1,
+                        .baseArrayLayer = 0,
+                        .layerCount = 6,
+                    },
+                };
+                if (vkCreateImageView(device, &depthViewInfo, nullptr, &shadowCubeDepthImageViews[idx]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create texture image view!");
+                }
+            }
+            else {
+                shadowCubeDepthImageViews[idx] = createImageView2D(shadowCubeDepthImages[idx], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+            }
 
             ++idx;
         }
@@ -574,32 +1096,44 @@ void SceneViewer::createLightFrameBuffers() {
         }
     }
 
-    shadowMapFramebuffers.resize(spot_cnt);
+    shadowMapFramebuffers.resize(shadowAtlasSize > 0 ? 1 : spot_cnt);
     shadowMapCubeFramebuffers.resize(sphere_cnt);
     for (int i=0; i<sphere_cnt; i++) {
-        shadowMapCubeFramebuffers[i].resize(6);
+        shadowMapCubeFramebuffers[i].resize(multiviewCubeShadows ? 1 : 6);
     }
 
     int idx = 0;
+    if (shadowAtlasSize > 0) {
+        VkFramebufferCreateInfo framebufferInfo {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = shadowRenderPass,
+            .attachmentCount = 1,
+            .pAttachments = &shadowMapImageViews[0],
+            .width = shadowAtlasSize,
+            .height = shadowAtlasSize,
+            .layers = 1,
+        };
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &shadowMapFramebuffers[0]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+    }
+
     // spot lights
     for (auto& [id, light] : scene_config.id2lights) {
+        if (shadowAtlasSize > 0) {
+            break;
+        }
         uint32_t l_width = static_cast<uint32_t>(light->shadow);
         uint32_t l_height = l_width;
         if (light->type != sconfig::LightType::SPOT) {
             continue;
         }
 
-        std::array<VkImageView, 2> attachments = {
-            shadowMapImageViews[idx],
-            shadowDepthImageViews[idx]
-        };
-
-        // I need to get
         VkFramebufferCreateInfo framebufferInfo {
             .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
             .renderPass = shadowRenderPass,
-            .attachmentCount = static_cast<uint32_t>(attachments.size()),
-            .pAttachments = attachments.data(),
+            .attachmentCount = 1,
+            .pAttachments = &shadowMapImageViews[idx],
             .width = l_width,
             .height = l_height,
             .layers = 1,
@@ -624,7 +1158,7 @@ void SceneViewer::createLightFrameBuffers() {
 
         VkFramebufferCreateInfo framebufferInfo{
             .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = shadowRenderPass,
+            .renderPass = shadowCubeRenderPass,
             .attachmentCount = 2,
             .pAttachments = attachments,
             .width = l_width,
@@ -632,7 +1166,8 @@ void SceneViewer::createLightFrameBuffers() {
             .layers = 1,
         };
 
-        for (int j = 0; j < 6; j++) {
+        // multiview framebuffers have one layer, the view mask selects the array layers
+        for (size_t j = 0; j < shadowMapCubeFramebuffers[idx].size(); j++) {
             attachments[0] = shadowMapCubeFacesImageViews[idx][j];
             if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &shadowMapCubeFramebuffers[idx][j]) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create cube framebuffer!");
@@ -643,7 +1178,76 @@ void SceneViewer::createLightFrameBuffers() {
     }
 }
 
+// spot lights render depth only and sample it directly. sphere lights keep a distance cube (R32F is
+// enough, the biases in the shaders are tuned for full float precision) plus a depth buffer for testing
+void SceneViewer::createShadowRenderPasses() {
+    shadowMapFormat = findSupportedFormat(
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+    );
+
+    VkAttachmentDescription depthAttachment {
+        .format = shadowMapFormat,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+
+    VkAttachmentReference depthAttachmentRef {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
+    VkSubpassDescription subpass {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 0,
+        .pDepthStencilAttachment = &depthAttachmentRef,
+    };
+
+    // previous frame's sampling has to finish before clearing, and the main pass reads what we wrote
+    std::array<VkSubpassDependency, 2> dependencies {{
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+            .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        },
+        {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        },
+    }};
+
+    VkRenderPassCreateInfo renderPassInfo {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &depthAttachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = static_cast<uint32_t>(dependencies.size()),
+        .pDependencies = dependencies.data(),
+    };
+    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &shadowRenderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadow render pass!");
+    }
+
+    createRenderPass(VK_FORMAT_R32_SFLOAT, shadowCubeRenderPass, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, multiviewCubeShadows ? 0x3f : 0);
+}
+
+// one layout for both pipelines, the spot pipeline has no fragment stage
 void SceneViewer::createShadowGraphicsPipeline() {
+    pipelineVersion++;
     // TODO: maybe update with different light type
     std::vector<char> vertShaderCode;
     std::vector<char> fragShaderCode;
@@ -653,12 +1257,28 @@ void SceneViewer::createShadowGraphicsPipeline() {
 
     VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
     VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+    // same source built with MULTIVIEW, the face comes from gl_ViewIndex
+    VkShaderModule cubeVertShaderModule = multiviewCubeShadows ? createShaderModule(readFile("shaders/shadow/vert_multiview.spv")) : vertShaderModule;
 
+    // constant_id 0 is COMPACT_VERTEX
+    VkBool32 compactVertexConstant = compactVertices ? VK_TRUE : VK_FALSE;
+    VkSpecializationMapEntry specializationEntry {
+        .constantID = 0,
+        .offset = 0,
+        .size = sizeof(VkBool32),
+    };
+    VkSpecializationInfo vertexSpecialization {
+        .mapEntryCount = 1,
+        .pMapEntries = &specializationEntry,
+        .dataSize = sizeof(VkBool32),
+        .pData = &compactVertexConstant,
+    };
     VkPipelineShaderStageCreateInfo vertShaderStageInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_VERTEX_BIT,
         .module = vertShaderModule,
         .pName = "main",
+        .pSpecializationInfo = &vertexSpecialization,
     };
     VkPipelineShaderStageCreateInfo fragShaderStageInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -668,8 +1288,9 @@ void SceneViewer::createShadowGraphicsPipeline() {
     };
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    std::vector<VkVertexInputAttributeDescription> attributeDescriptions = Vertex::getSimpleAttributeDescriptions();
+    auto bindingDescription = compactVertices ? CompactVertexPosition::getBindingDescription() : VertexPosition::getBindingDescription();
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions =
+        compactVertices ? CompactVertexPosition::getAttributeDescriptions() : VertexPosition::getAttributeDescriptions();
     VkPipelineVertexInputStateCreateInfo vertexInputInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         .vertexBindingDescriptionCount = 1,
@@ -725,6 +1346,11 @@ void SceneViewer::createShadowGraphicsPipeline() {
         .pAttachments = &colorBlendAttachment,
         .blendConstants = { 0.0f, 0.0f, 0.0f, 0.0f },
     };
+    VkPipelineColorBlendStateCreateInfo depthOnlyBlending {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .logicOpEnable = VK_FALSE,
+        .attachmentCount = 0,
+    };
     std::vector<VkDynamicState> dynamicStates = {
         VK_DYNAMIC_STATE_VIEWPORT,
         VK_DYNAMIC_STATE_SCISSOR
@@ -752,7 +1378,7 @@ void SceneViewer::createShadowGraphicsPipeline() {
     }
     VkGraphicsPipelineCreateInfo pipelineInfo {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = 2,
+        .stageCount = 1,
         .pStages = shaderStages,
         .pVertexInputState = &vertexInputInfo,
         .pInputAssemblyState = &inputAssembly,
@@ -760,7 +1386,7 @@ void SceneViewer::createShadowGraphicsPipeline() {
         .pRasterizationState = &rasterizer,
         .pMultisampleState = &multisampling,
         .pDepthStencilState = &depthStencil,
-        .pColorBlendState = &colorBlending,
+        .pColorBlendState = &depthOnlyBlending,
         .pDynamicState = &dynamicState,
         .layout = shadowPipelineLayout,
         .renderPass = shadowRenderPass,
@@ -771,9 +1397,20 @@ void SceneViewer::createShadowGraphicsPipeline() {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
+    shaderStages[0].module = cubeVertShaderModule;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.renderPass = shadowCubeRenderPass;
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &shadowCubeGraphicsPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create graphics pipeline!");
+    }
+
     // clean up
     vkDestroyShaderModule(device, fragShaderModule, nullptr);
     vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    if (cubeVertShaderModule != vertShaderModule) {
+        vkDestroyShaderModule(device, cubeVertShaderModule, nullptr);
+    }
 }
 
 
@@ -808,7 +1445,10 @@ void SceneViewer::createShadowDescriptorSetLayout() {
 }
 
 void SceneViewer::cleanShadowResources() {
-    
+    // the moment maps hold views of the shadow maps
+    cleanShadowMomentResources();
+    cleanSunCascadeResources();
+
     int spot_cnt = 0;
     int sphere_cnt = 0;
 
@@ -821,31 +1461,27 @@ void SceneViewer::cleanShadowResources() {
         }
     }
 
-    for (size_t i = 0; i < spot_cnt; i++) {
-        vkDestroyImageView(device, shadowDepthImageViews[i], nullptr);
-        vkDestroyImage(device, shadowDepthImages[i], nullptr);
-        vkFreeMemory(device, shadowDepthImageMemorys[i], nullptr);
-    }
     for (auto shadowFrameBuffer : shadowMapFramebuffers) {
         vkDestroyFramebuffer(device, shadowFrameBuffer, nullptr);
     }
 
     for (size_t i = 0; i < sphere_cnt; i++) {
-        for (int j = 0; j < 6; j++) {
-            vkDestroyImageView(device, shadowMapCubeFacesImageViews[i][j], nullptr);
+        for (auto faceView : shadowMapCubeFacesImageViews[i]) {
+            vkDestroyImageView(device, faceView, nullptr);
         }
         vkDestroyImageView(device, shadowCubeDepthImageViews[i], nullptr);
         vkDestroyImage(device, shadowCubeDepthImages[i], nullptr);
-        vkFreeMemory(device, shadowCubeDepthImageMemorys[i], nullptr);
+        memoryAllocator.free(shadowCubeDepthImageMemorys[i]);
         vkDestroyImageView(device, shadowMapCubeImageViews[i], nullptr);
         vkDestroyImage(device, shadowMapCubeImages[i], nullptr);
-        vkFreeMemory(device, shadowMapCubeImageMemorys[i], nullptr);
-        for (int j = 0; j < 6; j++) {
-            vkDestroyFramebuffer(device, shadowMapCubeFramebuffers[i][j], nullptr);
+        memoryAllocator.free(shadowMapCubeImageMemorys[i]);
+        for (auto cubeFramebuffer : shadowMapCubeFramebuffers[i]) {
+            vkDestroyFramebuffer(device, cubeFramebuffer, nullptr);
         }
     }
     
     vkDestroySampler(device, shadowMapSampler, nullptr);
+    vkDestroySampler(device, shadowMapDepthSampler, nullptr);
     vkDestroySampler(device, shadowMapCubeSampler, nullptr);
 
     for (auto& imageView : shadowMapImageViews) {
@@ -855,21 +1491,25 @@ void SceneViewer::cleanShadowResources() {
         vkDestroyImage(device, image, nullptr);
     }
     for (auto& memory : shadowMapImageMemorys) {
-        vkFreeMemory(device, memory, nullptr);
+        memoryAllocator.free(memory);
     }
 
     // destroy shadow pipeline
     vkDestroyPipeline(device, shadowGraphicsPipeline, nullptr);
+    vkDestroyPipeline(device, shadowCubeGraphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, shadowPipelineLayout, nullptr);
     vkDestroyRenderPass(device, shadowRenderPass, nullptr);
+    vkDestroyRenderPass(device, shadowCubeRenderPass, nullptr);
 
+    vkDestroyBuffer(device, instanceRingBuffer, nullptr);
+    memoryAllocator.free(instanceRingMemory);
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-        vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
         vkDestroyBuffer(device, shadowUniformBuffers[i], nullptr);
-        vkFreeMemory(device, shadowUniformBuffersMemory[i], nullptr);
+        memoryAllocator.free(shadowUniformBuffersMemory[i]);
     }
 
     vkDestroyDescriptorPool(device, shadowDescriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, shadowDescriptorSetLayout, nullptr);
+
+    cleanClusterResources();
 }
\ No newline at end of file
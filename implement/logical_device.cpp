@@ -1,10 +1,101 @@
 #include "../scene_viewer.hpp"
 
+// VK_EXT_memory_budget is optional, the allocator estimates the budget without it
+void SceneViewer::addMemoryBudgetExtension(std::vector<const char*>& extensions) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+    memoryBudgetEnabled = false;
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            memoryBudgetEnabled = true;
+            break;
+        }
+    }
+}
+
+// the material shaders index their shadow sampler arrays with the lights of each fragment's cluster, which is not
+// uniform across a draw. VK_EXT_descriptor_indexing is optional, without it the plain frag.spv builds are used
+void SceneViewer::addDescriptorIndexingExtension(std::vector<const char*>& extensions) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+    nonUniformIndexing = false;
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0) {
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+            };
+            VkPhysicalDeviceFeatures2 features2 {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &indexingFeatures,
+            };
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+            nonUniformIndexing = indexingFeatures.shaderSampledImageArrayNonUniformIndexing == VK_TRUE;
+            break;
+        }
+    }
+    if (!nonUniformIndexing) {
+        std::cout << "non uniform sampler indexing is not supported, shadow samplers are indexed without it" << std::endl;
+        return;
+    }
+    extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+}
+
+void SceneViewer::enableDescriptorIndexingFeature(VkDeviceCreateInfo& createInfo, VkPhysicalDeviceDescriptorIndexingFeaturesEXT& indexingFeatures) {
+    if (!nonUniformIndexing) {
+        return;
+    }
+
+    indexingFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+        .pNext = const_cast<void*>(createInfo.pNext),
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+    };
+    createInfo.pNext = &indexingFeatures;
+}
+
+// multiview is core in 1.1 but still an optional feature, --cube-shadows multiview falls back to per face passes without it
+void SceneViewer::enableMultiviewFeature(VkDeviceCreateInfo& createInfo, VkPhysicalDeviceMultiviewFeatures& multiviewFeatures) {
+    if (!multiviewCubeShadows) {
+        return;
+    }
+
+    multiviewFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 features2 {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &multiviewFeatures,
+    };
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+    if (multiviewFeatures.multiview != VK_TRUE) {
+        std::cout << "multiview is not supported, cube shadows render one pass per face" << std::endl;
+        multiviewCubeShadows = false;
+        return;
+    }
+
+    multiviewFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES,
+        .pNext = const_cast<void*>(createInfo.pNext),
+        .multiview = VK_TRUE,
+    };
+    createInfo.pNext = &multiviewFeatures;
+}
+
 void SceneViewer::createLogicalDevice() {
     QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::unordered_set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    if (indices.transferFamily.has_value()) {
+        uniqueQueueFamilies.insert(indices.transferFamily.value());
+    }
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -17,20 +108,32 @@ void SceneViewer::createLogicalDevice() {
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
-    // physical device features
+    // physical device features, bc formats only when the device has them (ktx2 textures fall back to png otherwise)
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    textureCompressionBCEnabled = supportedFeatures.textureCompressionBC == VK_TRUE;
     VkPhysicalDeviceFeatures deviceFeatures {
         .samplerAnisotropy = VK_TRUE,
+        .textureCompressionBC = supportedFeatures.textureCompressionBC,
     };
 
+    std::vector<const char*> enabledExtensions = deviceExtensions;
+    addMemoryBudgetExtension(enabledExtensions);
+    addDescriptorIndexingExtension(enabledExtensions);
+
     // logical device creation
     VkDeviceCreateInfo createInfo {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
         .pQueueCreateInfos = queueCreateInfos.data(),
-        .enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
-        .ppEnabledExtensionNames = deviceExtensions.data(),
+        .enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()),
+        .ppEnabledExtensionNames = enabledExtensions.data(),
         .pEnabledFeatures = &deviceFeatures,
     };
+    VkPhysicalDeviceMultiviewFeatures multiviewFeatures;
+    enableMultiviewFeature(createInfo, multiviewFeatures);
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+    enableDescriptorIndexingFeature(createInfo, indexingFeatures);
 
     if (enableValidationLayers) {
         createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -45,6 +148,13 @@ void SceneViewer::createLogicalDevice() {
 
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+    graphicsQueueFamily = indices.graphicsFamily.value();
+    dedicatedTransferQueue = indices.transferFamily.has_value();
+    transferQueueFamily = dedicatedTransferQueue ? indices.transferFamily.value() : graphicsQueueFamily;
+    vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
+
+    memoryAllocator.init(physicalDevice, device, memoryBudgetEnabled);
 }
 
 void SceneViewer::createHeadlessLogicalDevice() {
@@ -66,16 +176,42 @@ void SceneViewer::createHeadlessLogicalDevice() {
             break;
         }
     }
+    std::vector<const char*> enabledExtensions;
+    addMemoryBudgetExtension(enabledExtensions);
+    addDescriptorIndexingExtension(enabledExtensions);
+
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    textureCompressionBCEnabled = supportedFeatures.textureCompressionBC == VK_TRUE;
+    VkPhysicalDeviceFeatures deviceFeatures {
+        .textureCompressionBC = supportedFeatures.textureCompressionBC,
+    };
+
     // Create on logical device
     VkDeviceCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .queueCreateInfoCount = 1,
         .pQueueCreateInfos = &queueCreateInfo,
+        .enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()),
+        .ppEnabledExtensionNames = enabledExtensions.data(),
+        .pEnabledFeatures = &deviceFeatures,
     };
+    VkPhysicalDeviceMultiviewFeatures multiviewFeatures;
+    enableMultiviewFeature(createInfo, multiviewFeatures);
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+    enableDescriptorIndexingFeature(createInfo, indexingFeatures);
     if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
         throw std::runtime_error("failed to create logical device!");
     }
 
     // then for graphics queue
     vkGetDeviceQueue(device, queueFamilyIndex, 0, &graphicsQueue);
+
+    // headless uploads stay on the graphics queue
+    graphicsQueueFamily = queueFamilyIndex;
+    transferQueueFamily = queueFamilyIndex;
+    dedicatedTransferQueue = false;
+    transferQueue = graphicsQueue;
+
+    memoryAllocator.init(physicalDevice, device, memoryBudgetEnabled);
 }
\ No newline at end of file
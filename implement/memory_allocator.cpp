@@ -0,0 +1,339 @@
+#include "../memory_allocator.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+static uint32_t ceilLog2(VkDeviceSize value) {
+    uint32_t order = 0;
+    while ((VkDeviceSize(1) << order) < value) {
+        order++;
+    }
+    return order;
+}
+
+static double toMiB(VkDeviceSize bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, bool budgetExtension) {
+    this->physicalDevice = physicalDevice;
+    this->device = device;
+    this->budgetExtension = budgetExtension;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    updateBudget();
+    std::cout << "Memory allocator: " << memProperties.memoryHeapCount << " heaps, budget tracking "
+              << (budgetExtension ? "VK_EXT_memory_budget" : "estimated") << std::endl;
+}
+
+void MemoryAllocator::destroy() {
+    for (auto& pool : pools) {
+        for (auto& block : pool.blocks) {
+            if (block) {
+                vkFreeMemory(device, block->memory, nullptr);
+            }
+        }
+    }
+    pools.clear();
+    for (auto& [memory, allocation] : dedicatedAllocations) {
+        vkFreeMemory(device, memory, nullptr);
+    }
+    dedicatedAllocations.clear();
+}
+
+void MemoryAllocator::updateBudget() {
+    if (budgetExtension) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceMemoryProperties2 properties2{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+            .pNext = &budgetProperties,
+        };
+        vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties2);
+        for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++) {
+            heapBudget[i] = budgetProperties.heapBudget[i];
+            heapUsage[i] = budgetProperties.heapUsage[i];
+        }
+        return;
+    }
+
+    // without the extension assume we may use 80% of each heap, and only count our own allocations
+    for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++) {
+        heapBudget[i] = memProperties.memoryHeaps[i].size / 10 * 8;
+        heapUsage[i] = heapAllocated[i];
+    }
+}
+
+// first type with the wanted properties whose heap still has budget left, else the first type with the properties
+uint32_t MemoryAllocator::chooseMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize size) {
+    uint32_t fallback = UINT32_MAX;
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if (!(typeFilter & (1 << i)) || (memProperties.memoryTypes[i].propertyFlags & properties) != properties) {
+            continue;
+        }
+        uint32_t heap = memProperties.memoryTypes[i].heapIndex;
+        if (heapUsage[heap] + size <= heapBudget[heap]) {
+            return i;
+        }
+        if (fallback == UINT32_MAX) {
+            fallback = i;
+        }
+    }
+
+    if (fallback == UINT32_MAX) {
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+    std::cout << "Memory allocator: heap " << memProperties.memoryTypes[fallback].heapIndex << " is over budget" << std::endl;
+    return fallback;
+}
+
+// 64 MiB blocks, smaller on small heaps so a few blocks cannot exhaust them
+VkDeviceSize MemoryAllocator::blockSizeFor(uint32_t memoryType) const {
+    VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+    while (blockSize > (VkDeviceSize(1) << 20) && blockSize > heapSize / 8) {
+        blockSize >>= 1;
+    }
+    return blockSize;
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, void** mapped) {
+    VkMemoryAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryType,
+    };
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+
+    // host visible memory is mapped once for its whole lifetime
+    *mapped = nullptr;
+    if (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+    }
+
+    heapAllocated[memProperties.memoryTypes[memoryType].heapIndex] += size;
+    updateBudget();
+    return memory;
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t memoryType = chooseMemoryType(requirements.memoryTypeBits, properties, requirements.size);
+    VkDeviceSize blockSize = blockSizeFor(memoryType);
+
+    MemoryAllocation allocation{};
+    allocation.size = requirements.size;
+    allocation.memoryType = memoryType;
+
+    // huge resources (cloud volume, big cubemaps) get their own allocation instead of pinning half a block
+    if (requirements.size > blockSize / 2) {
+        allocation.memory = allocateDeviceMemory(memoryType, requirements.size, &allocation.mapped);
+        dedicatedAllocations[allocation.memory] = allocation;
+        return allocation;
+    }
+
+    // buddy nodes are aligned to their own size, so rounding up to the alignment is enough
+    uint32_t order = std::max(ceilLog2(std::max(requirements.size, requirements.alignment)), MIN_ORDER);
+
+    int poolIdx = -1;
+    for (size_t i = 0; i < pools.size(); i++) {
+        if (pools[i].memoryType == memoryType && pools[i].linear == linear) {
+            poolIdx = static_cast<int>(i);
+            break;
+        }
+    }
+    if (poolIdx < 0) {
+        pools.push_back({ .memoryType = memoryType, .linear = linear });
+        poolIdx = static_cast<int>(pools.size()) - 1;
+    }
+    MemoryPool& pool = pools[poolIdx];
+
+    int blockIdx = -1;
+    VkDeviceSize offset = 0;
+    for (size_t i = 0; i < pool.blocks.size(); i++) {
+        if (pool.blocks[i] && allocateFromBlock(*pool.blocks[i], order, offset)) {
+            blockIdx = static_cast<int>(i);
+            break;
+        }
+    }
+    if (blockIdx < 0) {
+        auto block = std::make_unique<MemoryBlock>();
+        block->size = blockSize;
+        block->maxOrder = ceilLog2(blockSize);
+        block->memory = allocateDeviceMemory(memoryType, blockSize, &block->mapped);
+        block->freeLists.resize(block->maxOrder + 1);
+        block->freeLists[block->maxOrder].insert(0);
+        block->requestedBytes = 0;
+        block->nodeBytes = 0;
+        allocateFromBlock(*block, order, offset);
+
+        // reuse a released slot so existing allocations keep their block index
+        auto hole = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+        if (hole != pool.blocks.end()) {
+            *hole = std::move(block);
+            blockIdx = static_cast<int>(hole - pool.blocks.begin());
+        }
+        else {
+            pool.blocks.push_back(std::move(block));
+            blockIdx = static_cast<int>(pool.blocks.size()) - 1;
+        }
+    }
+
+    MemoryBlock& block = *pool.blocks[blockIdx];
+    block.requestedBytes += requirements.size;
+    block.nodeBytes += VkDeviceSize(1) << order;
+
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.pool = poolIdx;
+    allocation.block = blockIdx;
+    allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+    return allocation;
+}
+
+bool MemoryAllocator::allocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset) {
+    if (order > block.maxOrder) {
+        return false;
+    }
+    uint32_t found = order;
+    while (found <= block.maxOrder && block.freeLists[found].empty()) {
+        found++;
+    }
+    if (found > block.maxOrder) {
+        return false;
+    }
+
+    offset = *block.freeLists[found].begin();
+    block.freeLists[found].erase(block.freeLists[found].begin());
+    // split down, the upper halves go back to the free lists
+    while (found > order) {
+        found--;
+        block.freeLists[found].insert(offset + (VkDeviceSize(1) << found));
+    }
+    block.nodeOrders[offset] = order;
+    return true;
+}
+
+void MemoryAllocator::freeInBlock(MemoryBlock& block, VkDeviceSize offset) {
+    auto it = block.nodeOrders.find(offset);
+    if (it == block.nodeOrders.end()) {
+        throw std::runtime_error("freeing memory that was not allocated from this block!");
+    }
+    uint32_t order = it->second;
+    block.nodeOrders.erase(it);
+    block.nodeBytes -= VkDeviceSize(1) << order;
+
+    // merge with the buddy as long as it is free
+    while (order < block.maxOrder) {
+        VkDeviceSize buddy = offset ^ (VkDeviceSize(1) << order);
+        auto buddyIt = block.freeLists[order].find(buddy);
+        if (buddyIt == block.freeLists[order].end()) {
+            break;
+        }
+        block.freeLists[order].erase(buddyIt);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    block.freeLists[order].insert(offset);
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t heap = memProperties.memoryTypes[allocation.memoryType].heapIndex;
+    if (allocation.pool < 0) {
+        heapAllocated[heap] -= allocation.size;
+        dedicatedAllocations.erase(allocation.memory);
+        vkFreeMemory(device, allocation.memory, nullptr);
+    }
+    else {
+        MemoryPool& pool = pools[allocation.pool];
+        MemoryBlock& block = *pool.blocks[allocation.block];
+        block.requestedBytes -= allocation.size;
+        freeInBlock(block, allocation.offset);
+
+        // keep one empty block around per pool, release the rest
+        bool empty = block.nodeOrders.empty();
+        int liveBlocks = 0;
+        for (auto& other : pool.blocks) {
+            liveBlocks += other ? 1 : 0;
+        }
+        if (empty && liveBlocks > 1) {
+            heapAllocated[heap] -= block.size;
+            vkFreeMemory(device, block.memory, nullptr);
+            pool.blocks[allocation.block].reset();
+        }
+    }
+    updateBudget();
+    allocation = MemoryAllocation{};
+}
+
+bool MemoryAllocator::isCoherent(const MemoryAllocation& allocation) const {
+    return (memProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+// usage, padding and fragmentation per heap. fragmentation = share of free block bytes outside the largest free node
+void MemoryAllocator::dumpStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    updateBudget();
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "---------------- memory stats ----------------" << std::endl;
+    for (uint32_t heap = 0; heap < memProperties.memoryHeapCount; heap++) {
+        size_t blockCount = 0, subAllocations = 0, dedicatedCount = 0;
+        VkDeviceSize blockBytes = 0, requestedBytes = 0, nodeBytes = 0, largestFree = 0, dedicatedBytes = 0;
+        for (auto& pool : pools) {
+            if (memProperties.memoryTypes[pool.memoryType].heapIndex != heap) {
+                continue;
+            }
+            for (auto& block : pool.blocks) {
+                if (!block) {
+                    continue;
+                }
+                blockCount++;
+                blockBytes += block->size;
+                requestedBytes += block->requestedBytes;
+                nodeBytes += block->nodeBytes;
+                subAllocations += block->nodeOrders.size();
+                for (uint32_t order = block->maxOrder + 1; order-- > 0;) {
+                    if (!block->freeLists[order].empty()) {
+                        largestFree = std::max(largestFree, VkDeviceSize(1) << order);
+                        break;
+                    }
+                }
+            }
+        }
+        for (auto& [memory, dedicated] : dedicatedAllocations) {
+            if (memProperties.memoryTypes[dedicated.memoryType].heapIndex == heap) {
+                dedicatedCount++;
+                dedicatedBytes += dedicated.size;
+            }
+        }
+        if (blockCount == 0 && heapAllocated[heap] == 0) {
+            continue;
+        }
+
+        VkDeviceSize freeBytes = blockBytes - nodeBytes;
+        double fragmentation = freeBytes > 0 ? 100.0 * (1.0 - static_cast<double>(largestFree) / static_cast<double>(freeBytes)) : 0.0;
+        bool deviceLocal = memProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+
+        std::cout << "Heap " << heap << (deviceLocal ? " (device local)" : " (host)") << ": size " << toMiB(memProperties.memoryHeaps[heap].size)
+                  << " MiB, budget " << toMiB(heapBudget[heap]) << " MiB, usage " << toMiB(heapUsage[heap]) << " MiB" << std::endl;
+        std::cout << "  blocks " << blockCount << " (" << toMiB(blockBytes) << " MiB), " << subAllocations << " sub-allocations using "
+                  << toMiB(requestedBytes) << " MiB (+" << toMiB(nodeBytes - requestedBytes) << " MiB padding), free " << toMiB(freeBytes)
+                  << " MiB, largest free " << toMiB(largestFree) << " MiB, fragmentation " << fragmentation << "%" << std::endl;
+        std::cout << "  dedicated " << dedicatedCount << " (" << toMiB(dedicatedBytes) << " MiB), allocated from driver "
+                  << toMiB(heapAllocated[heap]) << " MiB" << std::endl;
+    }
+    std::cout << "----------------------------------------------" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+}
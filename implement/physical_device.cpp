@@ -62,6 +62,15 @@ QueueFamilyIndices SceneViewer::findQueueFamilies(VkPhysicalDevice device) {
         ++idx;
     }
 
+    // a transfer-only family usually maps to the copy engines and runs beside graphics work
+    for (uint32_t i = 0; i < queueFamilyCount; i++) {
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            indices.transferFamily = i;
+            break;
+        }
+    }
+
     return indices;
 }
 
@@ -0,0 +1,379 @@
+#include "../scene_viewer.hpp"
+
+// the light to convert and which blur pass, 0 blurs rows of the source into the blur image, 1 blurs its columns into the moment map
+struct MomentPushConstants {
+    int lightIdx;
+    int pass;
+};
+
+static const uint32_t MOMENT_GROUP_SIZE = 8;       // local_size_x and local_size_y of shader.moments.comp
+
+static VkImageView createArrayView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t layers) {
+    VkImageViewCreateInfo viewInfo {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .format = format,
+        .subresourceRange = {
+            .aspectMask = aspectFlags,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = layers,
+        },
+    };
+
+    VkImageView imageView;
+    if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create image view!");
+    }
+    return imageView;
+}
+
+static VkImageMemoryBarrier momentBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess,
+    VkAccessFlags dstAccess, uint32_t baseMip, uint32_t mipCount, uint32_t layers) {
+    return {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = srcAccess,
+        .dstAccessMask = dstAccess,
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, baseMip, mipCount, 0, layers},
+    };
+}
+
+bool SceneViewer::usesShadowMoments(const sconfig::Light& light) const {
+    return light.type != sconfig::LightType::SUN && light.shadowFilter.value_or(shadowFilter) == sconfig::ShadowFilter::evsm;
+}
+
+// moment maps for the evsm lights at the light's full shadow resolution, whatever tile the budget gives it,
+// and the compute pipeline that fills them. runs after the shadow maps and light uniform buffers exist
+void SceneViewer::createShadowMoments() {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, shadowMomentFormat, &formatProperties);
+    shadowMomentLinear = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+
+    // every sampler slot needs a view, pcss lights get a 1x1 cube that the shaders never read
+    createImage(1, 1, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, VK_IMAGE_TYPE_2D, shadowMomentFormat, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        shadowMomentDummyImage, shadowMomentDummyMemory, 6);
+    transitionImageLayout(shadowMomentDummyImage, shadowMomentFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 6);
+    transitionImageLayout(shadowMomentDummyImage, shadowMomentFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 6);
+    shadowMomentDummyView = createImageView2D(shadowMomentDummyImage, shadowMomentFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+    shadowMomentDummyCubeView = createImageViewCube(shadowMomentDummyImage, shadowMomentFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    // trilinear where the format allows it, that is the whole point of prefiltering
+    VkSamplerCreateInfo samplerInfo {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = shadowMomentLinear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+        .minFilter = shadowMomentLinear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+        .mipmapMode = shadowMomentLinear ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .mipLodBias = 0.0f,
+        .anisotropyEnable = VK_FALSE,
+        .maxAnisotropy = 1.0f,
+        .compareEnable = VK_FALSE,
+        .compareOp = VK_COMPARE_OP_ALWAYS,
+        .minLod = 0.0f,
+        .maxLod = VK_LOD_CLAMP_NONE,
+        .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+        .unnormalizedCoordinates = VK_FALSE,
+    };
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &shadowMomentSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadow moment sampler!");
+    }
+
+    // images per evsm light
+    shadowMomentMaps.assign(scene_config.id2lights.size(), ShadowMomentMap{});
+    uint32_t momentLights = 0;
+    int idx = 0, spot_idx = 0, sphere_idx = 0;
+    for (auto& [id, light] : scene_config.id2lights) {
+        ShadowMomentMap& map = shadowMomentMaps[idx++];
+        bool sphere = light->type == sconfig::LightType::SPHERE;
+        int slot = sphere ? sphere_idx : spot_idx;
+        if (light->type == sconfig::LightType::SPHERE) {
+            ++sphere_idx;
+        } else if (light->type == sconfig::LightType::SPOT) {
+            ++spot_idx;
+        }
+        if (!usesShadowMoments(*light)) {
+            continue;
+        }
+
+        map.size = static_cast<uint32_t>(light->shadow);
+        map.layers = sphere ? 6 : 1;
+        map.mipLevels = static_cast<uint32_t>(std::floor(std::log2(map.size))) + 1;
+        createImage(map.size, map.size, sphere ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0, VK_IMAGE_TYPE_2D, shadowMomentFormat,
+            VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, map.image, map.memory, map.layers, map.mipLevels);
+        createImage(map.size, map.size, 0, VK_IMAGE_TYPE_2D, shadowMomentFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, map.blurImage, map.blurMemory, map.layers);
+
+        map.view = sphere ? createImageViewCube(map.image, shadowMomentFormat, VK_IMAGE_ASPECT_COLOR_BIT, map.mipLevels)
+                          : createImageView2D(map.image, shadowMomentFormat, VK_IMAGE_ASPECT_COLOR_BIT, map.mipLevels);
+        map.storageView = createArrayView(device, map.image, shadowMomentFormat, VK_IMAGE_ASPECT_COLOR_BIT, map.layers);
+        map.blurView = createArrayView(device, map.blurImage, shadowMomentFormat, VK_IMAGE_ASPECT_COLOR_BIT, map.layers);
+        // spots read their tile out of the atlas or their own map, the rect is in the light ubo
+        map.sourceView = sphere ? createArrayView(device, shadowMapCubeImages[slot], VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 6)
+                                : createArrayView(device, shadowMapImages[shadowAtlasSize > 0 ? 0 : slot], shadowMapFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+        ++momentLights;
+    }
+    std::cout << "EVSM Light Count: " << momentLights << std::endl;
+
+    // no evsm light, the dummies fill the sampler slots and there is nothing to prefilter
+    if (momentLights == 0) {
+        return;
+    }
+
+    // 0 light ubo, 1 depth map or distance cube, 2 row blur, 3 moment map mip 0
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings {{
+        { .binding = 0, .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT },
+        { .binding = 1, .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT },
+        { .binding = 2, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT },
+        { .binding = 3, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT },
+    }};
+    VkDescriptorSetLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(bindings.size()),
+        .pBindings = bindings.data(),
+    };
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &shadowMomentSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout!");
+    }
+
+    VkPushConstantRange pushConstantRange {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(MomentPushConstants),
+    };
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &shadowMomentSetLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
+    };
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &shadowMomentPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout!");
+    }
+
+    VkShaderModule computeShaderModule = createShaderModule(readFile("shaders/shadow/moments.spv"));
+    VkComputePipelineCreateInfo pipelineInfo {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = computeShaderModule,
+            .pName = "main",
+        },
+        .layout = shadowMomentPipelineLayout,
+    };
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &shadowMomentPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadow moment pipeline!");
+    }
+    vkDestroyShaderModule(device, computeShaderModule, nullptr);
+
+
+    uint32_t setCount = momentLights * MAX_FRAMES_IN_FLIGHT;
+    std::array<VkDescriptorPoolSize, 3> poolSizes {{
+        { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = setCount },
+        { .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = setCount },
+        { .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 2 * setCount },
+    }};
+    VkDescriptorPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = setCount,
+        .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+        .pPoolSizes = poolSizes.data(),
+    };
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &shadowMomentDescriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    for (auto& map : shadowMomentMaps) {
+        if (map.size == 0) {
+            continue;
+        }
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, shadowMomentSetLayout);
+        map.descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        VkDescriptorSetAllocateInfo allocInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = shadowMomentDescriptorPool,
+            .descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+            .pSetLayouts = layouts.data(),
+        };
+        if (vkAllocateDescriptorSets(device, &allocInfo, map.descriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            VkDescriptorBufferInfo bufferInfo {
+                .buffer = shadowUniformBuffers[i],
+                .offset = 0,
+                .range = sizeof(LightUniformBufferObject),
+            };
+            VkDescriptorImageInfo sourceInfo {
+                .sampler = shadowMapDepthSampler,
+                .imageView = map.sourceView,
+                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            };
+            VkDescriptorImageInfo blurInfo {
+                .imageView = map.blurView,
+                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            };
+            VkDescriptorImageInfo momentInfo {
+                .imageView = map.storageView,
+                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            };
+
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+            descriptorWrites[0] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = map.descriptorSets[i],
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .pBufferInfo = &bufferInfo,
+            };
+            descriptorWrites[1] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = map.descriptorSets[i],
+                .dstBinding = 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &sourceInfo,
+            };
+            descriptorWrites[2] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = map.descriptorSets[i],
+                .dstBinding = 2,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                .pImageInfo = &blurInfo,
+            };
+            descriptorWrites[3] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = map.descriptorSets[i],
+                .dstBinding = 3,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                .pImageInfo = &momentInfo,
+            };
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+}
+
+// rebuilds the moment maps of the evsm lights whose shadow was rendered this frame, the others keep last frame's.
+// recorded outside any render pass, between the shadow passes and the main pass
+void SceneViewer::recordShadowMoments(VkCommandBuffer commandBuffer) {
+    bool pending = false;
+    for (size_t idx = 0; idx < shadowMomentMaps.size(); idx++) {
+        pending = pending || (shadowMomentMaps[idx].size > 0 && shadowRenderViews[idx] != 0);
+    }
+    if (!pending) {
+        return;
+    }
+
+    // shadow passes finish writing (and their final layout transition) before the blur reads them
+    VkMemoryBarrier renderBarrier {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &renderBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shadowMomentPipeline);
+    for (size_t idx = 0; idx < shadowMomentMaps.size(); idx++) {
+        const ShadowMomentMap& map = shadowMomentMaps[idx];
+        if (map.size == 0 || shadowRenderViews[idx] == 0) {
+            continue;
+        }
+
+        // everything is rewritten, so the old contents go. the previous frame's sampling has to be done first
+        std::array<VkImageMemoryBarrier, 3> begin = {
+            momentBarrier(map.blurImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT, 0, 1, map.layers),
+            momentBarrier(map.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT, 0, 1, map.layers),
+            momentBarrier(map.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, 1, map.mipLevels - 1, map.layers),
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, map.mipLevels > 1 ? 3 : 2, begin.data());
+
+        uint32_t groups = (map.size + MOMENT_GROUP_SIZE - 1) / MOMENT_GROUP_SIZE;
+        MomentPushConstants push { .lightIdx = static_cast<int>(idx), .pass = 0 };
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shadowMomentPipelineLayout, 0, 1, &map.descriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, shadowMomentPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MomentPushConstants), &push);
+        vkCmdDispatch(commandBuffer, groups, groups, map.layers);
+
+        VkImageMemoryBarrier rows = momentBarrier(map.blurImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0, 1, map.layers);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &rows);
+
+        push.pass = 1;
+        vkCmdPushConstants(commandBuffer, shadowMomentPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MomentPushConstants), &push);
+        vkCmdDispatch(commandBuffer, groups, groups, map.layers);
+
+        // mip chain, each level blitted down from the one above
+        VkImageMemoryBarrier columns = momentBarrier(map.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, 0, 1, map.layers);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &columns);
+
+        int32_t mipSize = static_cast<int32_t>(map.size);
+        for (uint32_t level = 1; level < map.mipLevels; level++) {
+            VkImageBlit blit {
+                .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, map.layers},
+                .srcOffsets = {{0, 0, 0}, {mipSize, mipSize, 1}},
+                .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, map.layers},
+                .dstOffsets = {{0, 0, 0}, {std::max(mipSize / 2, 1), std::max(mipSize / 2, 1), 1}},
+            };
+            vkCmdBlitImage(commandBuffer, map.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, map.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                1, &blit, shadowMomentLinear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
+
+            VkImageMemoryBarrier written = momentBarrier(map.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, level, 1, map.layers);
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &written);
+            mipSize = std::max(mipSize / 2, 1);
+        }
+
+        VkImageMemoryBarrier done = momentBarrier(map.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0, map.mipLevels, map.layers);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &done);
+    }
+}
+
+void SceneViewer::cleanShadowMomentResources() {
+    for (auto& map : shadowMomentMaps) {
+        if (map.size == 0) {
+            continue;
+        }
+        vkDestroyImageView(device, map.view, nullptr);
+        vkDestroyImageView(device, map.storageView, nullptr);
+        vkDestroyImageView(device, map.blurView, nullptr);
+        vkDestroyImageView(device, map.sourceView, nullptr);
+        vkDestroyImage(device, map.image, nullptr);
+        memoryAllocator.free(map.memory);
+        vkDestroyImage(device, map.blurImage, nullptr);
+        memoryAllocator.free(map.blurMemory);
+    }
+    vkDestroyImageView(device, shadowMomentDummyView, nullptr);
+    vkDestroyImageView(device, shadowMomentDummyCubeView, nullptr);
+    vkDestroyImage(device, shadowMomentDummyImage, nullptr);
+    memoryAllocator.free(shadowMomentDummyMemory);
+    vkDestroySampler(device, shadowMomentSampler, nullptr);
+
+    vkDestroyPipeline(device, shadowMomentPipeline, nullptr);
+    vkDestroyPipelineLayout(device, shadowMomentPipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, shadowMomentDescriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, shadowMomentSetLayout, nullptr);
+}
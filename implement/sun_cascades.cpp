@@ -0,0 +1,153 @@
+#include "../scene_viewer.hpp"
+
+// far bound of a cascade in view depth. logarithmic splits give every cascade the same ratio of far to near,
+// so each one keeps a similar texel density on screen
+static float cascadeSplit(float zNear, float zFar, int cascade) {
+    return zNear * std::pow(zFar / zNear, static_cast<float>(cascade + 1) / SUN_CASCADES);
+}
+
+// one depth image for every sun with SUN_CASCADES layers each, rendered a layer at a time by the spot shadow pass.
+// without suns it still holds one sun's layers, so the material sampler always has a view
+void SceneViewer::createSunCascades() {
+    int sun_cnt = 0;
+    sunCascadeSize = 1;
+    for (auto& [id, light] : scene_config.id2lights) {
+        if (light->type == sconfig::LightType::SUN) {
+            ++sun_cnt;
+            sunCascadeSize = std::max(sunCascadeSize, static_cast<uint32_t>(light->shadow));
+        }
+    }
+    std::cout << "Sun Light Count: " << sun_cnt << std::endl;
+
+    uint32_t layers = static_cast<uint32_t>(std::max(sun_cnt, 1) * SUN_CASCADES);
+    createImage(sunCascadeSize, sunCascadeSize, 0, VK_IMAGE_TYPE_2D, shadowMapFormat, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        sunCascadeImage, sunCascadeMemory, layers);
+
+    VkImageViewCreateInfo viewInfo {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = sunCascadeImage,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .format = shadowMapFormat,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = layers,
+        },
+    };
+    if (vkCreateImageView(device, &viewInfo, nullptr, &sunCascadeView) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create sun cascade image view!");
+    }
+
+    // a 2D view and a framebuffer per cascade of the suns that exist
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.subresourceRange.layerCount = 1;
+    sunCascadeLayerViews.resize(sun_cnt * SUN_CASCADES);
+    sunCascadeFramebuffers.resize(sun_cnt * SUN_CASCADES);
+    for (size_t layer = 0; layer < sunCascadeLayerViews.size(); layer++) {
+        viewInfo.subresourceRange.baseArrayLayer = static_cast<uint32_t>(layer);
+        if (vkCreateImageView(device, &viewInfo, nullptr, &sunCascadeLayerViews[layer]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create sun cascade image view!");
+        }
+
+        VkFramebufferCreateInfo framebufferInfo {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = shadowRenderPass,
+            .attachmentCount = 1,
+            .pAttachments = &sunCascadeLayerViews[layer],
+            .width = sunCascadeSize,
+            .height = sunCascadeSize,
+            .layers = 1,
+        };
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &sunCascadeFramebuffers[layer]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create sun cascade framebuffer!");
+        }
+    }
+
+    // sampled before the first cascade is rendered, and never rendered without suns
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkImageMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = sunCascadeImage,
+        .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, layers},
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+    endSingleTimeCommands(commandBuffer);
+
+    sunCascades.assign(scene_config.id2lights.size() * SUN_CASCADES, SunCascade{});
+}
+
+// an orthographic view per cascade around the bounding sphere of its slice of the camera frustum. the sphere only
+// depends on the split depths and the fov, so its size holds while the camera turns, and its center is snapped to
+// whole texels of the sun's view, so moving the camera shifts the map by whole texels and edges do not crawl.
+// depth starts at the farthest caster toward the sun. metadata1 gets the split depths
+void SceneViewer::updateSunCascades(int idx, const sconfig::Light& light, LightUniformBufferObject& lubo) {
+    std::shared_ptr<sconfig::Camera>& camera = scene_config.cameras[scene_config.cur_camera];
+    cglm::Vec3f dir = cglm::normalize(light.direction);
+    cglm::Vec3f right = cglm::normalize(cglm::cross(dir, light.up));
+    cglm::Vec3f up = cglm::cross(right, dir);
+    cglm::Vec3f viewDir = cglm::normalize(camera->dir);
+
+    // squared distance of a frustum corner from the view axis, per unit of depth
+    float tanY = std::tan(camera->vfov / 2.0f);
+    float tanX = tanY * camera->aspect;
+    float k = tanX * tanX + tanY * tanY;
+
+    float zNear = camera->near;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        float zFar = cascadeSplit(camera->near, camera->far, c);
+        // the sphere through the near and far corners of the slice, centered on the far plane when that is smaller
+        float centerDepth = std::min(zFar, (zNear + zFar) * (1.0f + k) / 2.0f);
+        float radius = std::sqrt(std::max((zFar - centerDepth) * (zFar - centerDepth) + zFar * zFar * k,
+            (centerDepth - zNear) * (centerDepth - zNear) + zNear * zNear * k));
+
+        float texel = 2.0f * radius / static_cast<float>(sunCascadeSize);
+        cglm::Vec3f center = camera->position + viewDir * centerDepth;
+        float x = std::floor(cglm::dot(center, right) / texel) * texel;
+        float y = std::floor(cglm::dot(center, up) / texel) * texel;
+        center = right * x + up * y + dir * cglm::dot(center, dir);
+
+        float back = radius;
+        for (const auto& bound : frameDrawLists[currentFrame].bounds) {
+            cglm::Vec3f p = cglm::Vec3f(bound[0], bound[1], bound[2]) - center;
+            if (std::abs(cglm::dot(p, right)) - bound[3] > radius || std::abs(cglm::dot(p, up)) - bound[3] > radius) {
+                continue;
+            }
+            back = std::max(back, bound[3] - cglm::dot(p, dir));
+        }
+        back += 0.1f;
+        float depth = back + radius;
+
+        // depth in [0, 1] from the eye and y flipped, like fitShadowProjection
+        cglm::Mat44f view = cglm::lookAt(center - dir * back, center, up);
+        cglm::Mat44f proj(
+            {1.0f / radius, 0, 0, 0},
+            {0, -1.0f / radius, 0, 0},
+            {0, 0, -1.0f / depth, 0},
+            {0, 0, 0, 1}
+        );
+        lubo.cascadeMatrices[idx * SUN_CASCADES + c] = proj * view;
+        lubo.metadata1[idx][c] = zFar;
+        sunCascades[idx * SUN_CASCADES + c] = { center, radius };
+        zNear = zFar;
+    }
+}
+
+void SceneViewer::cleanSunCascadeResources() {
+    for (size_t layer = 0; layer < sunCascadeFramebuffers.size(); layer++) {
+        vkDestroyFramebuffer(device, sunCascadeFramebuffers[layer], nullptr);
+        vkDestroyImageView(device, sunCascadeLayerViews[layer], nullptr);
+    }
+    vkDestroyImageView(device, sunCascadeView, nullptr);
+    vkDestroyImage(device, sunCascadeImage, nullptr);
+    memoryAllocator.free(sunCascadeMemory);
+}
@@ -2,96 +2,348 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include <omp.h>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+
+// one texture file for the decode workers, bytes is known up front from the header
+struct TextureDecodeJob {
+    std::string file_name;
+    std::string ktx_name;       // <name>.ktx2 next to the png, empty when there is none
+    int idx;
+    bool cube;
+    VkDeviceSize bytes;
+};
+
+struct Ktx2Level {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+// what the loader needs from a KTX2 file written by utility/ktx_gen
+struct Ktx2Texture {
+    VkFormat format;
+    uint32_t width, height;
+    uint32_t faceCount;
+    std::vector<Ktx2Level> levels;
+};
+
+struct DecodedTexture {
+    size_t job;
+    stbi_uc* pixels;                // png path
+    int width, height;
+    std::vector<uint8_t> ktxFile;   // ktx path, the whole file
+    Ktx2Texture ktx;
+};
+
+static std::string ktxNameFor(const std::string& file_name) {
+    size_t dot = file_name.find_last_of('.');
+    return file_name.substr(0, dot) + ".ktx2";
+}
 
-void generateSinglePixel(const std::vector<double>& val, std::string& file_name);
+// bytes per 4x4 block, 0 for formats the loader does not know
+static VkDeviceSize ktx2BlockBytes(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        return 8;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        return 16;
+    default:
+        return 0;
+    }
+}
 
-void SceneViewer::createTextureImagesWithViews() {
-    // start with 2D's
-    std::unordered_map<std::string, int> texture2D2Idx = scene_config.texture2D2Idx;
-    for (auto& [file_name, idx] : texture2D2Idx) {
-        std::cout << "loading 2D texture " << file_name << " with idx " << idx << std::endl;
-        createTextureImage2D(file_name, idx);
-        texture2DImageViews[idx] = createImageView2D(texture2DImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+static bool ktx2IsSrgb(VkFormat format) {
+    return format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK ||
+           format == VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+// only plain block compressed files: no supercompression, no arrays or 3D, mips precomputed. false for a file
+// the loader does not handle, which falls back to the png, throws when the file is malformed
+static bool parseKtx2(const std::vector<uint8_t>& file, Ktx2Texture& texture) {
+    static const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+    if (file.size() < 80 || memcmp(file.data(), identifier, 12) != 0) {
+        throw std::runtime_error("not a KTX2 file");
+    }
+    uint32_t header[9];
+    memcpy(header, file.data() + 12, sizeof(header));
+    VkDeviceSize blockBytes = ktx2BlockBytes(static_cast<VkFormat>(header[0]));
+    if (blockBytes == 0 || header[4] != 0 || header[5] != 0 || (header[6] != 1 && header[6] != 6) || header[8] != 0) {
+        return false;
+    }
+
+    texture.format = static_cast<VkFormat>(header[0]);
+    texture.width = header[2];
+    texture.height = header[3];
+    texture.faceCount = header[6];
+    if (texture.width == 0 || texture.height == 0) {
+        throw std::runtime_error("KTX2 image has no size");
+    }
+    uint32_t levelCount = header[7];
+    uint32_t maxLevels = 1;
+    while ((std::max(texture.width, texture.height) >> maxLevels) != 0) {
+        maxLevels++;
+    }
+    if (levelCount == 0 || levelCount > maxLevels) {
+        throw std::runtime_error("KTX2 level count does not match the image size");
+    }
+    if (file.size() < 80 + static_cast<size_t>(levelCount) * 24) {
+        throw std::runtime_error("KTX2 level index is truncated");
     }
 
-    // then cube's
-    std::unordered_map<std::string, int> textureCube2Idx = scene_config.textureCube2Idx;
-    for (auto& [file_name, idx] : textureCube2Idx) {
-        std::cout << "loading cube texture " << file_name << " with idx " << idx << std::endl;
-        createTextureImageCube(file_name, idx);
-        textureCubeImageViews[idx] = createImageViewCube(textureCubeImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+    // every level is a whole number of blocks per face, at a block aligned offset inside the file
+    texture.levels.resize(levelCount);
+    for (uint32_t level = 0; level < levelCount; level++) {
+        uint64_t entry[3];
+        memcpy(entry, file.data() + 80 + level * 24, sizeof(entry));
+        VkDeviceSize blocksX = (std::max(texture.width >> level, 1u) + 3) / 4;
+        VkDeviceSize blocksY = (std::max(texture.height >> level, 1u) + 3) / 4;
+        if (entry[1] != blocksX * blocksY * blockBytes * texture.faceCount) {
+            throw std::runtime_error("KTX2 level " + std::to_string(level) + " size does not match the image size");
+        }
+        if (entry[0] % blockBytes != 0 || entry[0] > file.size() || entry[1] > file.size() - entry[0]) {
+            throw std::runtime_error("KTX2 level " + std::to_string(level) + " is outside the file");
+        }
+        texture.levels[level] = { .offset = entry[0], .size = entry[1] };
     }
+    return true;
 }
 
-void SceneViewer::createTextureImage2D(const std::string& file_name, int idx) {
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(file_name.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-    // std::cout << "texture image size: " << texWidth << "x" << texHeight << std::endl;
+// block compressed formats need the device feature and sampling support for optimal tiling
+bool SceneViewer::compressedTextureSupported(VkFormat format) {
+    if (!textureCompressionBCEnabled) {
+        return false;
+    }
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+    return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
 
-    if (!pixels) {
-        throw std::runtime_error("Failed to load texture image!");
+// worker threads decode, the main thread creates the images and records uploads as each decode finishes.
+// decoded bytes waiting for their upload are capped by TEXTURE_DECODE_BUDGET
+void SceneViewer::createTextureImagesWithViews() {
+    std::vector<TextureDecodeJob> jobs;
+    for (auto& [file_name, idx] : scene_config.texture2D2Idx) {
+        jobs.push_back({ .file_name = file_name, .ktx_name = "", .idx = idx, .cube = false, .bytes = 0 });
+    }
+    for (auto& [file_name, idx] : scene_config.textureCube2Idx) {
+        jobs.push_back({ .file_name = file_name, .ktx_name = "", .idx = idx, .cube = true, .bytes = 0 });
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    // header reads only, to budget decodes before they start. a ktx2 file is uploaded as is
+#pragma omp parallel for
+    for (int i = 0; i < static_cast<int>(jobs.size()); i++) {
+        std::string ktx_name = ktxNameFor(jobs[i].file_name);
+        std::ifstream ktxFile(ktx_name, std::ios::binary | std::ios::ate);
+        if (ktxFile.is_open()) {
+            jobs[i].ktx_name = ktx_name;
+            jobs[i].bytes = static_cast<VkDeviceSize>(ktxFile.tellg());
+            continue;
+        }
+        int texWidth = 0, texHeight = 0, texChannels = 0;
+        stbi_info(jobs[i].file_name.c_str(), &texWidth, &texHeight, &texChannels);
+        jobs[i].bytes = static_cast<VkDeviceSize>(texWidth) * texHeight * 4;
+    }
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+    auto tStart = std::chrono::high_resolution_clock::now();
 
-    stbi_image_free(pixels);
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<DecodedTexture> ready;
+    size_t nextJob = 0;
+    size_t uploaded = 0;
+    size_t compressedCount = 0;
+    VkDeviceSize inFlightBytes = 0;
+    bool uploadsRecorded = false;
+    std::string error;
+    int threadCount = 1;
+
+#pragma omp parallel
+    {
+        // vulkan calls stay on thread 0, the main thread
+        bool uploader = omp_get_thread_num() == 0;
+        if (uploader) {
+            threadCount = omp_get_num_threads();
+        }
 
-    createImage(texWidth, texHeight, 0, VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        texture2DImages[idx], texture2DImageMemorys[idx], 1);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (error.empty()) {
+            if (uploader && !ready.empty()) {
+                DecodedTexture texture = std::move(ready.front());
+                ready.pop_front();
+                const TextureDecodeJob& job = jobs[texture.job];
+                lock.unlock();
+                try {
+                    if (!texture.ktxFile.empty()) {
+                        createCompressedTexture(texture.ktxFile, texture.ktx, job.cube, job.idx);
+                        compressedCount++;
+                    }
+                    else if (job.cube) {
+                        createTextureImageCube(texture.pixels, texture.width, job.idx);
+                        textureCubeImageViews[job.idx] = createImageViewCube(textureCubeImages[job.idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+                    }
+                    else {
+                        createTextureImage2D(texture.pixels, texture.width, texture.height, job.idx);
+                        texture2DImageViews[job.idx] = createImageView2D(texture2DImages[job.idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+                    }
+                }
+                catch (const std::exception& e) {
+                    lock.lock();
+                    error = e.what();
+                    cv.notify_all();
+                    break;
+                }
+                // uploadImage copied the data into staging
+                stbi_image_free(texture.pixels);
+                texture.ktxFile.clear();
+                lock.lock();
+                inFlightBytes -= job.bytes;
+                uploaded++;
+                uploadsRecorded = true;
+                cv.notify_all();
+                continue;
+            }
+            if (uploader && uploaded == jobs.size()) {
+                break;
+            }
 
-    transitionImageLayout(texture2DImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
-        copyBufferToImage(stagingBuffer, texture2DImages[idx], static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1);
-    transitionImageLayout(texture2DImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+            // a single texture above the budget still goes when nothing else is in flight
+            if (nextJob < jobs.size() && (inFlightBytes == 0 || inFlightBytes + jobs[nextJob].bytes <= TEXTURE_DECODE_BUDGET)) {
+                size_t jobIdx = nextJob++;
+                const TextureDecodeJob& job = jobs[jobIdx];
+                inFlightBytes += job.bytes;
+                lock.unlock();
+
+                DecodedTexture texture{ .job = jobIdx, .pixels = nullptr, .width = 0, .height = 0 };
+                std::string ktxError;
+                if (!job.ktx_name.empty()) {
+                    std::ifstream file(job.ktx_name, std::ios::binary);
+                    texture.ktxFile.resize(static_cast<size_t>(job.bytes));
+                    file.read(reinterpret_cast<char*>(texture.ktxFile.data()), texture.ktxFile.size());
+                    bool usable = false;
+                    try {
+                        usable = file.good() && parseKtx2(texture.ktxFile, texture.ktx) &&
+                                 texture.ktx.faceCount == (job.cube ? 6u : 1u) && compressedTextureSupported(texture.ktx.format);
+                    }
+                    catch (const std::exception& e) {
+                        // an exception must not leave the parallel region, reported below
+                        ktxError = "Malformed texture " + job.ktx_name + ": " + e.what();
+                    }
+                    if (!usable) {
+                        // png fallback, the budget was taken with the file size which is close enough
+                        texture.ktxFile.clear();
+                    }
+                }
+                if (texture.ktxFile.empty() && ktxError.empty()) {
+                    int texChannels;
+                    texture.pixels = stbi_load(job.file_name.c_str(), &texture.width, &texture.height, &texChannels, STBI_rgb_alpha);
+                }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
+                lock.lock();
+                if (!ktxError.empty()) {
+                    error = ktxError;
+                }
+                else if (texture.ktxFile.empty() && !texture.pixels) {
+                    error = "Failed to load texture image " + job.file_name;
+                }
+                else {
+                    ready.push_back(std::move(texture));
+                }
+                cv.notify_all();
+                continue;
+            }
+            if (!uploader && nextJob == jobs.size()) {
+                break;
+            }
 
-void SceneViewer::createTextureImageCube(const std::string& file_name, int idx) {
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(file_name.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+            // about to idle: let the gpu start on the copies recorded so far
+            if (uploader && uploadsRecorded) {
+                uploadsRecorded = false;
+                lock.unlock();
+                submitUploads();
+                lock.lock();
+                continue;
+            }
+            cv.wait(lock);
+        }
+    }
 
-    // std::cout << "texture image size: " << texWidth << "x" << texHeight << std::endl;
+    if (!error.empty()) {
+        for (auto& texture : ready) {
+            stbi_image_free(texture.pixels);
+        }
+        throw std::runtime_error(error);
+    }
 
-    if (!pixels) {
-        throw std::runtime_error("Failed to load texture image!");
+    // the last partial batch goes out now, nothing waits until the first frame
+    submitUploads();
+
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "Loaded " << jobs.size() << " textures (" << compressedCount << " ktx2) in " << std::chrono::duration<double, std::milli>(tEnd - tStart).count()
+              << "ms on " << threadCount << " threads" << std::endl;
+}
+
+// uploads every mip of every face as stored in the file, no decoding on the cpu
+void SceneViewer::createCompressedTexture(const std::vector<uint8_t>& file, const Ktx2Texture& ktx, bool cube, int idx) {
+    uint32_t mipLevels = static_cast<uint32_t>(ktx.levels.size());
+    VkImage& image = cube ? textureCubeImages[idx] : texture2DImages[idx];
+    MemoryAllocation& imageMemory = cube ? textureCubeImageMemorys[idx] : texture2DImageMemorys[idx];
+    createImage(ktx.width, ktx.height, cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0, VK_IMAGE_TYPE_2D, ktx.format, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        image, imageMemory, ktx.faceCount, mipLevels);
+
+    // level data is block aligned in the file, so the file offsets work as staging offsets
+    std::vector<VkBufferImageCopy> regions(mipLevels);
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        regions[level] = {
+            .bufferOffset = ktx.levels[level].offset,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, ktx.faceCount},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {std::max(ktx.width >> level, 1u), std::max(ktx.height >> level, 1u), 1},
+        };
     }
+    uploadImageRegions(image, file.data(), file.size(), regions, mipLevels, ktx.faceCount);
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    if (cube) {
+        textureCubeImageViews[idx] = createImageViewCube(image, ktx.format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+    }
+    else {
+        texture2DImageViews[idx] = createImageView2D(image, ktx.format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+        texture2DNormalXY[idx] = ktx.format == VK_FORMAT_BC5_UNORM_BLOCK;
+        texture2DLinear[idx] = !ktx2IsSrgb(ktx.format);
+    }
+}
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+void SceneViewer::createTextureImage2D(const uint8_t* pixels, int texWidth, int texHeight, int idx) {
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(texWidth) * texHeight * 4;
 
-    stbi_image_free(pixels);
+    createImage(texWidth, texHeight, 0, VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        texture2DImages[idx], texture2DImageMemorys[idx], 1);
+
+    uploadImage(texture2DImages[idx], pixels, imageSize, {static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1}, 1);
+}
+
+void SceneViewer::createTextureImageCube(const uint8_t* pixels, int texWidth, int idx) {
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(texWidth) * texWidth * 6 * 4;
 
     createImage(texWidth, texWidth, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT, VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         textureCubeImages[idx], textureCubeImageMemorys[idx], 6);
 
-    transitionImageLayout(textureCubeImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 6);
-        copyBufferToImage(stagingBuffer, textureCubeImages[idx], static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texWidth), 6);
-    transitionImageLayout(textureCubeImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 6);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    // the six faces are stacked vertically in the file, which is the layer order of the copy
+    uploadImage(textureCubeImages[idx], pixels, imageSize, {static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texWidth), 1}, 6);
 }
 
 
@@ -119,7 +371,7 @@ void SceneViewer::createTextureSampler() {
         .compareEnable = VK_FALSE,
         .compareOp = VK_COMPARE_OP_ALWAYS,
         .minLod = 0.0f,
-        .maxLod = 0.0f,
+        .maxLod = VK_LOD_CLAMP_NONE,      // ktx2 textures carry mips, png ones have a single level
         .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
         .unnormalizedCoordinates = VK_FALSE,
     };
@@ -135,6 +387,24 @@ void SceneViewer::createTextureSampler() {
 }
 
 
+int SceneViewer::registerTexture(const std::string& file_name, TextureType type) {
+    auto& texture2Idx = type == TextureType::textureCube ? scene_config.textureCube2Idx : scene_config.texture2D2Idx;
+    if (texture2Idx.find(file_name) == texture2Idx.end()) {
+        texture2Idx[file_name] = texture2Idx.size();
+    }
+    return texture2Idx[file_name];
+}
+
+// same value the old 1x1 R8G8B8A8_SRGB texture gave the shader: 8 bit quantized, then sRGB decoded
+static cglm::Vec4f constantAlbedo(const std::vector<double>& val) {
+    float linear[3];
+    for (int c = 0; c < 3; c++) {
+        float v = static_cast<float>(static_cast<uint8_t>(val[c] * 255)) / 255.0f;
+        linear[c] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+    }
+    return cglm::Vec4f(linear[0], linear[1], linear[2], 1.0f);
+}
+
 void SceneViewer::texturePrepare() {
     std::cout << "Preparing textures..." << std::endl;
     // first is environment
@@ -158,98 +428,73 @@ void SceneViewer::texturePrepare() {
     // default color
     scene_config.texture2D2Idx["textures/default2D.png"] = scene_config.texture2D2Idx.size();
 
-    // then for all materials => load texture
+    // then for all materials => load texture, constant values go to materialParams instead
+    materialParams.clear();
+    materialId2Slot.clear();
     for (auto& [id, mat] : scene_config.id2material) {
+        materialId2Slot[id] = static_cast<int>(materialParams.size());
+        MaterialParams params{
+            .albedo = cglm::Vec4f(1.0f, 1.0f, 1.0f, 1.0f),
+            .roughness = 1.0f,
+            .metalness = 0.0f,
+            .flags = 0,
+            .normalMap = -1,
+            .albedoTexture = 0,
+            .roughnessTexture = 0,
+            .metalnessTexture = 0,
+            .pad = 0,
+        };
+
         // if anymaterial has a normal map, then load it
         if (mat->normal_map != "") {
-            if (scene_config.texture2D2Idx.find(mat->normal_map) != scene_config.texture2D2Idx.end()) {
-                continue;
-            }
-            scene_config.texture2D2Idx[mat->normal_map] = scene_config.texture2D2Idx.size();
+            params.normalMap = registerTexture(mat->normal_map, TextureType::texture2D);
         }
 
         // lambertian - case
         if (mat->matetial_type == MaterialType::lambertian) {
             std::shared_ptr<sconfig::Lambertian> detail = std::get<std::shared_ptr<sconfig::Lambertian>>(mat->matetial_detail);
             if (std::holds_alternative<std::vector<double>>(detail->albedo)) {
-                std::string temp_file_name = "temp\\lambertian_" + std::to_string(id) + "_albedo.png";
-                generateSinglePixel(std::get<std::vector<double>>(detail->albedo), temp_file_name);
-                detail->albedo = temp_file_name;
-                detail->albedo_type = TextureType::texture2D;
-            }
-            // now it's definitely a string (file)
-            std::string filename = std::get<std::string>(detail->albedo);
-            if (scene_config.textureCube2Idx.find(filename) != scene_config.textureCube2Idx.end() || scene_config.texture2D2Idx.find(filename) != scene_config.texture2D2Idx.end() ){
-                continue;
-            }
-            if (detail->albedo_type == TextureType::texture2D) {
-                scene_config.texture2D2Idx[filename] = scene_config.texture2D2Idx.size();
+                params.albedo = constantAlbedo(std::get<std::vector<double>>(detail->albedo));
+                params.flags |= MATERIAL_CONST_ALBEDO;
             }
             else {
-                scene_config.textureCube2Idx[filename] = scene_config.textureCube2Idx.size();
+                params.albedoTexture = registerTexture(std::get<std::string>(detail->albedo), detail->albedo_type);
+                if (detail->albedo_type == TextureType::textureCube) {
+                    params.flags |= MATERIAL_ALBEDO_CUBE;
+                }
             }
         }
 
-        // pbr - case
+        // pbr - case, only 2D textures are sampled
         if (mat->matetial_type == MaterialType::pbr) {
             std::shared_ptr<sconfig::Pbr> detail = std::get<std::shared_ptr<sconfig::Pbr>>(mat->matetial_detail);
 
             if (std::holds_alternative<std::vector<double>>(detail->albedo)) {
-                std::string temp_file_name = "temp\\pbr_" + std::to_string(id) + "_albedo.png";
-                generateSinglePixel(std::get<std::vector<double>>(detail->albedo), temp_file_name);
-                detail->albedo = temp_file_name;
-                detail->albedo_type = TextureType::texture2D;
-            }
-            std::string filename = std::get<std::string>(detail->albedo);
-            if (detail->albedo_type == TextureType::texture2D) {
-                if (scene_config.texture2D2Idx.find(filename) == scene_config.texture2D2Idx.end()) {
-                    scene_config.texture2D2Idx[filename] = scene_config.texture2D2Idx.size();
-                }
+                params.albedo = constantAlbedo(std::get<std::vector<double>>(detail->albedo));
+                params.flags |= MATERIAL_CONST_ALBEDO;
             }
             else {
-                if (scene_config.textureCube2Idx.find(filename) == scene_config.textureCube2Idx.end()) {
-                    scene_config.textureCube2Idx[filename] = scene_config.textureCube2Idx.size();
-                }
+                params.albedoTexture = registerTexture(std::get<std::string>(detail->albedo), detail->albedo_type);
             }
 
             if (std::holds_alternative<double>(detail->roughness)) {
-                std::string temp_file_name = "temp\\pbr_" + std::to_string(id) + "_roughness.png";
-                std::vector<double> val = { std::get<double>(detail->roughness), 0, 0 };
-                generateSinglePixel(val, temp_file_name);
-                detail->roughness = temp_file_name;
-                detail->roughness_type = TextureType::texture2D;
-            }
-            filename = std::get<std::string>(detail->roughness);
-            if (detail->roughness_type == TextureType::texture2D) {
-                if (scene_config.texture2D2Idx.find(filename) == scene_config.texture2D2Idx.end()) {
-                    scene_config.texture2D2Idx[filename] = scene_config.texture2D2Idx.size();
-                }
+                params.roughness = static_cast<float>(std::get<double>(detail->roughness));
+                params.flags |= MATERIAL_CONST_ROUGHNESS;
             }
             else {
-                if (scene_config.textureCube2Idx.find(filename) == scene_config.textureCube2Idx.end()) {
-                    scene_config.textureCube2Idx[filename] = scene_config.textureCube2Idx.size();
-                }
+                params.roughnessTexture = registerTexture(std::get<std::string>(detail->roughness), detail->roughness_type);
             }
 
             if (std::holds_alternative<double>(detail->metalness)) {
-                std::string temp_file_name = "temp\\pbr_" + std::to_string(id) + "_metalness.png";
-                std::vector<double> val = { std::get<double>(detail->metalness), 0, 0 };
-                generateSinglePixel(val, temp_file_name);
-                detail->metalness = temp_file_name;
-                detail->metalness_type = TextureType::texture2D;
-            }
-            filename = std::get<std::string>(detail->metalness);
-            if (detail->metalness_type == TextureType::texture2D) {
-                if (scene_config.texture2D2Idx.find(filename) == scene_config.texture2D2Idx.end()) {
-                    scene_config.texture2D2Idx[filename] = scene_config.texture2D2Idx.size();
-                }
+                params.metalness = static_cast<float>(std::get<double>(detail->metalness));
+                params.flags |= MATERIAL_CONST_METALNESS;
             }
             else {
-                if (scene_config.textureCube2Idx.find(filename) == scene_config.textureCube2Idx.end()) {
-                    scene_config.textureCube2Idx[filename] = scene_config.textureCube2Idx.size();
-                }
+                params.metalnessTexture = registerTexture(std::get<std::string>(detail->metalness), detail->metalness_type);
             }
         }
+
+        materialParams.push_back(params);
     }
 
     // std::cout << "2D has size " << scene_config.texture2D2Idx.size() << " and cube has size " << scene_config.textureCube2Idx.size() << std::endl;
@@ -261,6 +506,8 @@ void SceneViewer::texturePrepare() {
     texture2DImages.resize(tex2DCount);
     texture2DImageMemorys.resize(tex2DCount);
     texture2DImageViews.resize(tex2DCount);
+    texture2DNormalXY.assign(tex2DCount, 0);
+    texture2DLinear.assign(tex2DCount, 0);
 
     textureCubeImages.resize(texCubeCount);
     textureCubeImageMemorys.resize(texCubeCount);
@@ -268,17 +515,41 @@ void SceneViewer::texturePrepare() {
 }
 
 
-void generateSinglePixel(const std::vector<double>& val, std::string& file_name) {
-    stbi_uc* pixels = new stbi_uc[4];
-    pixels[0] = static_cast<stbi_uc>(val[0] * 255);
-    pixels[1] = static_cast<stbi_uc>(val[1] * 255);
-    pixels[2] = static_cast<stbi_uc>(val[2] * 255);
-    pixels[3] = 128;
+// constant values are read straight from the storage buffer, the shaders skip the sampler for them
+void SceneViewer::createMaterialBuffer() {
+    // at least one entry so the descriptor always points at a valid range
+    VkDeviceSize bufferSize = sizeof(MaterialParams) * std::max<size_t>(materialParams.size(), 1);
+    createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, staticBufferMemoryProperties(), materialBuffer, materialBufferMemory);
+    if (materialParams.empty()) {
+        return;
+    }
 
-    stbi_write_png(file_name.c_str(), 1, 1, 4, pixels, 0);
-    delete[] pixels;
-}
+    // formats are known once the textures are loaded
+    for (auto& [id, slot] : materialId2Slot) {
+        MaterialParams& params = materialParams[slot];
+        if (params.normalMap >= 0) {
+            params.flags |= texture2DNormalXY[params.normalMap] ? MATERIAL_NORMAL_XY : 0;
+            params.flags |= texture2DLinear[params.normalMap] ? MATERIAL_LINEAR_NORMAL : 0;
+        }
+        if (scene_config.id2material[id]->matetial_type != MaterialType::pbr) {
+            continue;
+        }
+        if ((params.flags & MATERIAL_CONST_ROUGHNESS) == 0 && texture2DLinear[params.roughnessTexture]) {
+            params.flags |= MATERIAL_LINEAR_ROUGHNESS;
+        }
+        if ((params.flags & MATERIAL_CONST_METALNESS) == 0 && texture2DLinear[params.metalnessTexture]) {
+            params.flags |= MATERIAL_LINEAR_METALNESS;
+        }
+    }
 
+    VkDeviceSize dataSize = sizeof(MaterialParams) * materialParams.size();
+    if (staticBuffersHostVisible) {
+        memcpy(materialBufferMemory.mapped, materialParams.data(), static_cast<size_t>(dataSize));
+        return;
+    }
+    uploadBuffer(materialBuffer, materialParams.data(), dataSize, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    submitUploads();
+}
 
 
 void SceneViewer::createCloudNoiseImageWithView() {
@@ -304,17 +575,9 @@ void SceneViewer::createCloudNoiseImageWithView() {
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, cloudNoiseImage, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
-    };
+    cloudNoiseImageMemory = memoryAllocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
 
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &cloudNoiseImageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(device, cloudNoiseImage, cloudNoiseImageMemory, 0);
+    vkBindImageMemory(device, cloudNoiseImage, cloudNoiseImageMemory.memory, cloudNoiseImageMemory.offset);
 
     // COPY IMAGE DATAS
     uint8_t* pdata = new uint8_t[128 * 128 * 128 * 4];
@@ -347,43 +610,10 @@ void SceneViewer::createCloudNoiseImageWithView() {
     std::cout << "Done in " << tDiff << "ms" << std::endl;
 
     
-    // Use stage Buffer to copy
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+    // volume goes through the upload engine like every other texture
     VkDeviceSize imageSize = 128 * 128 * 128 * 4;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pdata, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
-
-
-    // Copy to image
-    transitionImageLayout(cloudNoiseImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
-
-    // ======================= Begin Single Time Command =======================
-    VkCommandBuffer ccommandBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy bufferCopyRegion{
-        .bufferOffset = 0,
-        .bufferRowLength = 0,
-        .bufferImageHeight = 0,
-        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
-        .imageOffset = {0, 0, 0},
-        .imageExtent = {128, 128, 128},
-    };
-
-    vkCmdCopyBufferToImage(ccommandBuffer, stagingBuffer, cloudNoiseImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-
-    endSingleTimeCommands(ccommandBuffer);
-    // ======================= End Single Time Command =======================
-
-    transitionImageLayout(cloudNoiseImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
-
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    uploadImage(cloudNoiseImage, pdata, imageSize, {128, 128, 128}, 1);
+    delete[] pdata;
 
 
     // Then create image view
@@ -417,26 +647,11 @@ void SceneViewer::createCloudImages(const std::string& filename, int idx) {
         throw std::runtime_error("Failed to load cloud image!");
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    stbi_image_free(pixels);
-
     createImage(texWidth, texHeight, 0, VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         cloudImages[idx], cloudImageMemorys[idx], 1);
 
-    transitionImageLayout(cloudImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
-        copyBufferToImage(stagingBuffer, cloudImages[idx], static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1);
-    transitionImageLayout(cloudImages[idx], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+    uploadImage(cloudImages[idx], pixels, imageSize, {static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1}, 1);
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    stbi_image_free(pixels);
 }
\ No newline at end of file
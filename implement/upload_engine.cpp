@@ -0,0 +1,315 @@
+#include "../scene_viewer.hpp"
+
+// staging data goes into a persistently mapped ring, split into one segment per batch. copies and barriers of
+// a batch are recorded into one command buffer and submitted together, on a transfer-only queue when the
+// device has one. the graphics queue then acquires ownership before anything samples the resources.
+void SceneViewer::createUploadEngine() {
+    VkCommandPoolCreateInfo poolInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = transferQueueFamily,
+    };
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create transfer command pool!");
+    }
+
+    createBuffer(UPLOAD_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uploadRingBuffer, uploadRingMemory);
+
+    uploadBatches.resize(UPLOAD_BATCH_COUNT);
+    for (auto& batch : uploadBatches) {
+        VkCommandBufferAllocateInfo allocInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = transferCommandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        if (vkAllocateCommandBuffers(device, &allocInfo, &batch.transferCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate upload command buffers!");
+        }
+        allocInfo.commandPool = commandPool;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &batch.acquireCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate upload command buffers!");
+        }
+
+        VkSemaphoreCreateInfo semaphoreInfo{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+        VkFenceCreateInfo fenceInfo{
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        };
+        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch.transferDone) != VK_SUCCESS ||
+            vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload synchronization objects!");
+        }
+
+        batch.used = 0;
+        batch.uploadCount = 0;
+        batch.recording = false;
+        batch.inFlight = false;
+    }
+    currentUploadBatch = 0;
+
+    if (dedicatedTransferQueue) {
+        std::cout << "Upload engine: transfer queue family " << transferQueueFamily << std::endl;
+    }
+    else {
+        std::cout << "Upload engine: no transfer-only queue, uploading on the graphics queue" << std::endl;
+    }
+}
+
+void SceneViewer::destroyUploadEngine() {
+    waitUploads();
+    for (auto& batch : uploadBatches) {
+        vkDestroySemaphore(device, batch.transferDone, nullptr);
+        vkDestroyFence(device, batch.fence, nullptr);
+        vkFreeCommandBuffers(device, commandPool, 1, &batch.acquireCommandBuffer);
+    }
+    uploadBatches.clear();
+
+    vkDestroyBuffer(device, uploadRingBuffer, nullptr);
+    memoryAllocator.free(uploadRingMemory);
+    vkDestroyCommandPool(device, transferCommandPool, nullptr);
+}
+
+// the current batch, started if needed. a batch whose ring segment cannot take `size` more bytes is submitted first
+UploadBatch& SceneViewer::beginUploadBatch(VkDeviceSize size) {
+    VkDeviceSize segmentSize = UPLOAD_RING_SIZE / UPLOAD_BATCH_COUNT;
+    UploadBatch* batch = &uploadBatches[currentUploadBatch];
+    if (batch->recording && size <= segmentSize && ((batch->used + 15) & ~static_cast<VkDeviceSize>(15)) + size > segmentSize) {
+        submitUploads();
+        batch = &uploadBatches[currentUploadBatch];
+    }
+    if (batch->recording) {
+        return *batch;
+    }
+
+    // the previous submit of this slot still reads its segment, wait for it
+    if (batch->inFlight) {
+        vkWaitForFences(device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        vkResetFences(device, 1, &batch->fence);
+        for (auto& [buffer, memory] : batch->oversizeStaging) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            memoryAllocator.free(memory);
+        }
+        batch->oversizeStaging.clear();
+        batch->inFlight = false;
+    }
+
+    VkCommandBufferBeginInfo beginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkResetCommandBuffer(batch->transferCommandBuffer, 0);
+    vkBeginCommandBuffer(batch->transferCommandBuffer, &beginInfo);
+    if (dedicatedTransferQueue) {
+        vkResetCommandBuffer(batch->acquireCommandBuffer, 0);
+        vkBeginCommandBuffer(batch->acquireCommandBuffer, &beginInfo);
+    }
+
+    batch->used = 0;
+    batch->uploadCount = 0;
+    batch->recording = true;
+    return *batch;
+}
+
+void SceneViewer::stageUploadData(UploadBatch& batch, const void* data, VkDeviceSize size, VkBuffer& srcBuffer, VkDeviceSize& srcOffset) {
+    VkDeviceSize segmentSize = UPLOAD_RING_SIZE / UPLOAD_BATCH_COUNT;
+
+    // too big for the ring (large cubemaps), give it a staging buffer that lives until the batch completes
+    if (size > segmentSize) {
+        VkBuffer stagingBuffer;
+        MemoryAllocation stagingBufferMemory;
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        memcpy(stagingBufferMemory.mapped, data, static_cast<size_t>(size));
+        batch.oversizeStaging.push_back({ stagingBuffer, stagingBufferMemory });
+        srcBuffer = stagingBuffer;
+        srcOffset = 0;
+        return;
+    }
+
+    // 16 byte aligned regions satisfy the texel size of every format we copy
+    VkDeviceSize offset = (batch.used + 15) & ~static_cast<VkDeviceSize>(15);
+    srcBuffer = uploadRingBuffer;
+    srcOffset = static_cast<VkDeviceSize>(&batch - uploadBatches.data()) * segmentSize + offset;
+    memcpy(static_cast<uint8_t*>(uploadRingMemory.mapped) + srcOffset, data, static_cast<size_t>(size));
+    batch.used = offset + size;
+}
+
+// copies the whole image and leaves it in SHADER_READ_ONLY_OPTIMAL for fragment shaders, data may be freed on return
+void SceneViewer::uploadImage(VkImage image, const void* data, VkDeviceSize size, VkExtent3D extent, uint32_t layerCount) {
+    std::vector<VkBufferImageCopy> regions{ {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, layerCount},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = extent,
+    } };
+    uploadImageRegions(image, data, size, regions, 1, layerCount);
+}
+
+// same as uploadImage for any set of regions (e.g. one per mip), region bufferOffsets are relative to data
+void SceneViewer::uploadImageRegions(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions, uint32_t mipLevels, uint32_t layerCount) {
+    UploadBatch& batch = beginUploadBatch(size);
+    VkBuffer srcBuffer;
+    VkDeviceSize srcOffset;
+    stageUploadData(batch, data, size, srcBuffer, srcOffset);
+
+    VkCommandBuffer commandBuffer = batch.transferCommandBuffer;
+    VkImageMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, layerCount},
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    std::vector<VkBufferImageCopy> stagedRegions = regions;
+    for (auto& region : stagedRegions) {
+        region.bufferOffset += srcOffset;
+    }
+    vkCmdCopyBufferToImage(commandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(stagedRegions.size()), stagedRegions.data());
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    if (dedicatedTransferQueue) {
+        // release on the transfer queue, the matching acquire runs on the graphics queue
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = transferQueueFamily;
+        barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(batch.acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    else {
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    batch.uploadCount++;
+}
+
+// copies into the start of dst and makes it visible to dstAccess at dstStage, data may be freed on return
+void SceneViewer::uploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+    if (size == 0) {
+        return;
+    }
+    UploadBatch& batch = beginUploadBatch(size);
+    VkBuffer srcBuffer;
+    VkDeviceSize srcOffset;
+    stageUploadData(batch, data, size, srcBuffer, srcOffset);
+
+    VkBufferCopy copyRegion{
+        .srcOffset = srcOffset,
+        .dstOffset = 0,
+        .size = size,
+    };
+    vkCmdCopyBuffer(batch.transferCommandBuffer, srcBuffer, dst, 1, &copyRegion);
+
+    VkBufferMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = dstAccess,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = dst,
+        .offset = 0,
+        .size = size,
+    };
+    if (dedicatedTransferQueue) {
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = transferQueueFamily;
+        barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+        vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(batch.acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+    else {
+        vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+    batch.uploadCount++;
+}
+
+// submits the batch being recorded without waiting for it
+void SceneViewer::submitUploads() {
+    UploadBatch& batch = uploadBatches[currentUploadBatch];
+    if (!batch.recording) {
+        return;
+    }
+    vkEndCommandBuffer(batch.transferCommandBuffer);
+
+    if (dedicatedTransferQueue) {
+        vkEndCommandBuffer(batch.acquireCommandBuffer);
+
+        VkSubmitInfo transferSubmit{
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &batch.transferCommandBuffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &batch.transferDone,
+        };
+        if (vkQueueSubmit(transferQueue, 1, &transferSubmit, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload command buffer!");
+        }
+
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo acquireSubmit{
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &batch.transferDone,
+            .pWaitDstStageMask = &waitStage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &batch.acquireCommandBuffer,
+        };
+        if (vkQueueSubmit(graphicsQueue, 1, &acquireSubmit, batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload acquire command buffer!");
+        }
+    }
+    else {
+        VkSubmitInfo submitInfo{
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &batch.transferCommandBuffer,
+        };
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload command buffer!");
+        }
+    }
+
+    batch.recording = false;
+    batch.inFlight = true;
+    currentUploadBatch = (currentUploadBatch + 1) % uploadBatches.size();
+}
+
+// submits what is left and blocks until every batch has completed, staging memory is reclaimed
+void SceneViewer::waitUploads() {
+    submitUploads();
+    size_t uploadCount = 0;
+    for (auto& batch : uploadBatches) {
+        if (!batch.inFlight) {
+            continue;
+        }
+        vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        vkResetFences(device, 1, &batch.fence);
+        for (auto& [buffer, memory] : batch.oversizeStaging) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            memoryAllocator.free(memory);
+        }
+        batch.oversizeStaging.clear();
+        batch.inFlight = false;
+        uploadCount += batch.uploadCount;
+    }
+    if (uploadCount > 0) {
+        std::cout << "Upload engine: " << uploadCount << " uploads completed" << std::endl;
+    }
+}
@@ -1,9 +1,15 @@
 #include "../scene_viewer.hpp"
 
+// one buffer per stream, the shadow passes bind only the position one
 void SceneViewer::createVertexBuffer() {
-    VkDeviceSize bufferSize = sizeof(Vertex) * scene_config.get_mesh_vertex_count();
-    std::cout << "Vertex buffer size: " << scene_config.get_mesh_vertex_count() << std::endl;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertexBuffer, vertexBufferMemory);
+    VkDeviceSize vertexCount = scene_config.get_mesh_vertex_count();
+    VkDeviceSize positionSize = compactVertices ? sizeof(CompactVertexPosition) : sizeof(VertexPosition);
+    VkDeviceSize attributeSize = compactVertices ? sizeof(CompactVertexAttributes) : sizeof(VertexAttributes);
+    std::cout << "Vertex buffer size: " << vertexCount << " x (" << positionSize << " + " << attributeSize << ") bytes" << std::endl;
+    createBuffer(positionSize * vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, staticBufferMemoryProperties(),
+        vertexPositionBuffer, vertexPositionBufferMemory);
+    createBuffer(attributeSize * vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, staticBufferMemoryProperties(),
+        vertexAttributeBuffer, vertexAttributeBufferMemory);
 }
 
 void SceneViewer::createCloudVertexBuffers() {
@@ -13,124 +19,211 @@ void SceneViewer::createCloudVertexBuffers() {
 
     for (const auto& [id, cloudPtr] : scene_config.id2clouds) {
         VkDeviceSize bufferSize = sizeof(CloudVertex) * cloudPtr->vertices.size();
-        createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cloudVertexBuffers[idx], cloudVertexBufferMemorys[idx]);
+        createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, staticBufferMemoryProperties(), cloudVertexBuffers[idx], cloudVertexBufferMemorys[idx]);
         idx++;
     }
 }
 
-void SceneViewer::copyVertexToBuffer() {
-    // based on current valid vertices
-    VkDeviceSize bufferSize = sizeof(Vertex) * frame_vertices_static[currentFrame].size();
-    void* data;
-    vkMapMemory(device, vertexBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, frame_vertices_static[currentFrame].data(), static_cast<size_t>(bufferSize));
-    vkUnmapMemory(device, vertexBufferMemory);
-}
-
 void SceneViewer::copyCloudVertexToBuffer() {
     int idx = 0;
     for (const auto& [id, cloudPtr] : scene_config.id2clouds) {
         VkDeviceSize bufferSize = sizeof(CloudVertex) * cloudPtr->vertices.size();
-        void* data;
-        vkMapMemory(device, cloudVertexBufferMemorys[idx], 0, bufferSize, 0, &data);
-            memcpy(data, cloudPtr->vertices.data(), static_cast<size_t>(bufferSize));
-        vkUnmapMemory(device, cloudVertexBufferMemorys[idx]);
+        queueBufferUpload(cloudPtr->vertices.data(), bufferSize, cloudVertexBuffers[idx], cloudVertexBufferMemorys[idx]);
         idx++;
     }
 
 }
 
+// round to nearest even is not needed here, uvs only lose the last bit
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    if (exponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+    if (exponent <= 0) {
+        // subnormal half, or zero when even that is too small
+        if (exponent < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000;
+        uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half = (mantissa >> shift) + ((mantissa >> (shift - 1)) & 1);
+        return static_cast<uint16_t>(sign | half);
+    }
+    // a rounding carry into the exponent is still the right value
+    uint32_t half = (sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1);
+    return static_cast<uint16_t>(half);
+}
+
+// octahedral mapping of a unit vector to [-1, 1]^2, decoded by octDecode in the vertex shaders
+static void octEncode(const cglm::Vec3f& n, int16_t out[2]) {
+    float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+    float x = l1 > 0.0f ? n[0] / l1 : 0.0f;
+    float y = l1 > 0.0f ? n[1] / l1 : 0.0f;
+    if (n[2] < 0.0f) {
+        float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    out[0] = static_cast<int16_t>(std::lround(std::clamp(x, -1.0f, 1.0f) * 32767.0f));
+    out[1] = static_cast<int16_t>(std::lround(std::clamp(y, -1.0f, 1.0f) * 32767.0f));
+}
+
+// positions are quantized against the mesh bounds, the shaders undo it with MeshPushConstants
+static void quantizeMesh(const sconfig::Mesh& mesh, CompactVertexPosition* positions, CompactVertexAttributes* attributes,
+    MeshPushConstants& pushConstants) {
+    cglm::Vec3f lo = mesh.positions.empty() ? cglm::Vec3f(0.0f, 0.0f, 0.0f) : mesh.positions[0];
+    cglm::Vec3f hi = lo;
+    for (const auto& p : mesh.positions) {
+        for (int c = 0; c < 3; c++) {
+            lo[c] = std::min(lo[c], p[c]);
+            hi[c] = std::max(hi[c], p[c]);
+        }
+    }
+    cglm::Vec3f extent = hi - lo;
+    pushConstants.positionScale = cglm::Vec4f(extent, 0.0f);
+    pushConstants.positionOffset = cglm::Vec4f(lo, 1.0f);
+
+    for (size_t i = 0; i < mesh.vertex_count; i++) {
+        CompactVertexPosition& p = positions[i];
+        for (int c = 0; c < 3; c++) {
+            float t = extent[c] > 0.0f ? (mesh.positions[i][c] - lo[c]) / extent[c] : 0.0f;
+            p.pos[c] = static_cast<uint16_t>(std::lround(std::clamp(t, 0.0f, 1.0f) * 65535.0f));
+        }
+        p.pos[3] = 0;
+        octEncode(mesh.normals[i], p.normal);
+
+        CompactVertexAttributes& a = attributes[i];
+        cglm::Vec2f uv = mesh.texcoords.empty() ? cglm::Vec2f{ 0.0f, 0.0f } : mesh.texcoords[i];
+        a.texCoord[0] = floatToHalf(uv[0]);
+        a.texCoord[1] = floatToHalf(uv[1]);
+        memcpy(a.color, mesh.colors[i].data(), sizeof(a.color));
+    }
+}
+
 void SceneViewer::copyAllMeshVertexToBuffer() {
     // each mesh is unique, we just apply differnt draw calls
-    static_vertices.clear();
-    static_vertices.resize(scene_config.get_mesh_vertex_count());
+    size_t vertexCount = scene_config.get_mesh_vertex_count();
+    static_vertex_positions.clear();
+    static_vertex_attributes.clear();
+    static_compact_vertex_positions.clear();
+    static_compact_vertex_attributes.clear();
+    if (compactVertices) {
+        static_compact_vertex_positions.resize(vertexCount);
+        static_compact_vertex_attributes.resize(vertexCount);
+    }
+    else {
+        static_vertex_positions.resize(vertexCount);
+        static_vertex_attributes.resize(vertexCount);
+    }
 
-    std::cout << "Mesh vertex count: " << scene_config.get_mesh_vertex_count() << std::endl;
+    std::cout << "Mesh vertex count: " << vertexCount << std::endl;
+    meshInnerId2PushConstants.assign(scene_config.cur_mesh, MeshPushConstants{
+        .positionScale = cglm::Vec4f(1.0f, 1.0f, 1.0f, 0.0f),
+        .positionOffset = cglm::Vec4f(0.0f, 0.0f, 0.0f, 1.0f),
+        .materialSlot = 0,
+    });
 
     int prev = 0;
     for (int inner_id = 0; inner_id < scene_config.cur_mesh; inner_id++) {
         std::shared_ptr<sconfig::Mesh> meshPtr = scene_config.id2mesh[scene_config.innerId2meshId[inner_id]];
 
-        // we should assign material here too, as lambertian
-        int material_id = meshPtr->material_id;
-        std::shared_ptr<sconfig::Material> materialPtr = scene_config.id2material[material_id];
-
-        float mat_idx = 0.0f; float mat_type = 0.0f;
-        cglm::Vec3f pbrss = { -1.0f, -1.0f, -1.0f };
-        if (materialPtr->matetial_type == MaterialType::lambertian) {
-            std::shared_ptr<sconfig::Lambertian> lambertianPtr = std::get<std::shared_ptr<sconfig::Lambertian>>(materialPtr->matetial_detail);
-            std::string& filename = std::get<std::string>(lambertianPtr->albedo);
-            if (lambertianPtr->albedo_type == TextureType::textureCube) {
-                mat_type = 1;
-                mat_idx = scene_config.textureCube2Idx[filename];
-            }
-            else {
-                mat_type = 0;
-                mat_idx = scene_config.texture2D2Idx[filename];
-            }
-        }
-        if (materialPtr->matetial_type == MaterialType::pbr) {
-            std::shared_ptr<sconfig::Pbr> pbrPtr = std::get<std::shared_ptr<sconfig::Pbr>>(materialPtr->matetial_detail);
-            std::string filename = std::get<std::string>(pbrPtr->albedo);
-            pbrss[0] = scene_config.texture2D2Idx[filename];
-            filename = std::get<std::string>(pbrPtr->roughness);
-            pbrss[1] = scene_config.texture2D2Idx[filename];
-            filename = std::get<std::string>(pbrPtr->metalness);
-            pbrss[2] = scene_config.texture2D2Idx[filename];
-        }
+        // the material is one push constant per draw, not per vertex
+        MeshPushConstants& pushConstants = meshInnerId2PushConstants[inner_id];
+        pushConstants.materialSlot = materialId2Slot[meshPtr->material_id];
 
-        // normal maps
-        float normal_map_idx = -1.0f;
-        if (materialPtr->normal_map != "") {
-            std::string& filename = materialPtr->normal_map;
-            normal_map_idx = scene_config.texture2D2Idx[filename];
+        int vertex_count = meshPtr->vertex_count;
+        if (compactVertices) {
+            quantizeMesh(*meshPtr, static_compact_vertex_positions.data() + prev, static_compact_vertex_attributes.data() + prev, pushConstants);
         }
-        cglm::Vec2f normal_map_idxv = { normal_map_idx, 0.0f };
+        else {
+            for (int i = 0; i < vertex_count; i++) {
+                const auto& color = meshPtr->colors[i];
+                static_vertex_positions[prev + i] = {
+                    .pos = meshPtr->positions[i],
+                    .normal = meshPtr->normals[i],
+                };
+                static_vertex_attributes[prev + i] = {
+                    .color = cglm::Vec3f(color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f),
+                };
 
-        int vertex_count = meshPtr->vertex_count;
-        
-        // std::cout << "material name: " << materialPtr->name << " idx: " << mat_idx << "type goes to " << mat_type << std::endl;
-        cglm::Vec3f midx = { mat_idx, 0.0f, mat_type };
-        // std::cout << "Inner vertex count: " << vertex_count << std::endl;
-        for (int i = 0; i < vertex_count; i++) {
-            static_vertices[prev + i] = {
-                .pos = meshPtr->positions[i],
-                .normal = meshPtr->normals[i],
-                .color = meshPtr->colors[i],
-                .mappingIdxs = midx,
-                .normalMappingIdxs = normal_map_idxv,
-                .pbrs = pbrss
-            };
-
-            if (meshPtr->texcoords.size() > 0) {
-                static_vertices[prev + i].texCoord = meshPtr->texcoords[i];
+                if (meshPtr->texcoords.size() > 0) {
+                    static_vertex_attributes[prev + i].texCoord = meshPtr->texcoords[i];
+                }
             }
-
         }
         meshInnerId2Offset[inner_id] = prev;
         prev += vertex_count;
     }
 
-    VkDeviceSize bufferSize = sizeof(Vertex) * scene_config.get_mesh_vertex_count();
-    void* data;
-    vkMapMemory(device, vertexBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, static_vertices.data(), static_cast<size_t>(bufferSize));
-    vkUnmapMemory(device, vertexBufferMemory);
+    if (compactVertices) {
+        queueBufferUpload(static_compact_vertex_positions.data(), sizeof(CompactVertexPosition) * vertexCount, vertexPositionBuffer, vertexPositionBufferMemory);
+        queueBufferUpload(static_compact_vertex_attributes.data(), sizeof(CompactVertexAttributes) * vertexCount, vertexAttributeBuffer, vertexAttributeBufferMemory);
+    }
+    else {
+        queueBufferUpload(static_vertex_positions.data(), sizeof(VertexPosition) * vertexCount, vertexPositionBuffer, vertexPositionBufferMemory);
+        queueBufferUpload(static_vertex_attributes.data(), sizeof(VertexAttributes) * vertexCount, vertexAttributeBuffer, vertexAttributeBufferMemory);
+    }
 }
 
-uint32_t SceneViewer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+// discrete gpus keep static buffers in DEVICE_LOCAL memory filled by a staged copy,
+// on unified memory devices that memory is host visible anyway, so it is written in place.
+// a unified device without a host coherent DEVICE_LOCAL type still takes the staged copy
+VkMemoryPropertyFlags SceneViewer::staticBufferMemoryProperties() {
+    const VkMemoryPropertyFlags unified = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
     VkPhysicalDeviceMemoryProperties memProperties;
     vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+    staticBuffersHostVisible = false;
+    if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU || properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((memProperties.memoryTypes[i].propertyFlags & unified) == unified) {
+                staticBuffersHostVisible = true;
+                break;
+            }
         }
     }
+    return staticBuffersHostVisible ? unified : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
 
-    throw std::runtime_error("failed to find suitable memory type!");
+void SceneViewer::queueBufferUpload(const void* data, VkDeviceSize size, VkBuffer dst, const MemoryAllocation& dstMemory) {
+    if (size == 0) {
+        return;
+    }
+    if (staticBuffersHostVisible) {
+        memcpy(dstMemory.mapped, data, static_cast<size_t>(size));
+        return;
+    }
+    pendingBufferUploads.push_back({ .data = data, .size = size, .dst = dst });
 }
 
+// queued uploads are batched by the upload engine, vertex fetch of later graphics submits sees them
+void SceneViewer::flushBufferUploads() {
+    if (pendingBufferUploads.empty()) {
+        return;
+    }
+
+    VkDeviceSize uploadBytes = 0;
+    for (auto& upload : pendingBufferUploads) {
+        uploadBuffer(upload.dst, upload.data, upload.size, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+        uploadBytes += upload.size;
+    }
+    submitUploads();
+
+    std::cout << "Uploaded " << pendingBufferUploads.size() << " static buffers (" << uploadBytes << " bytes) through staging" << std::endl;
+    pendingBufferUploads.clear();
+}
 
 void SceneViewer::createIndexBuffer() {
 
@@ -142,26 +235,15 @@ void SceneViewer::createIndexBuffer() {
 
     VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t) bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
-
     createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cloudIndexBuffer, cloudIndexBufferMemory);
 
-    copyBuffer(stagingBuffer, cloudIndexBuffer, bufferSize);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    // rides along with the vertex uploads
+    uploadBuffer(cloudIndexBuffer, indices.data(), bufferSize, VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 }
 
 
 // ----------- Declaration of help function ----------------
-void SceneViewer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+void SceneViewer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
     // create a buffer
     VkBufferCreateInfo bufferInfo{
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -172,19 +254,12 @@ void SceneViewer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMe
     if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to create buffer!");
     }
-    // make allocation for the buffer
+    // sub-allocate memory for the buffer
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-    VkMemoryAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties),
-    };
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
-    // bind the buffer with the memory
-    vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    bufferMemory = memoryAllocator.allocate(memRequirements, properties, true);
+    // bind the buffer with its range of the block
+    vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
 void SceneViewer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
@@ -3,19 +3,20 @@
 // #define NDEBUG 1
 
 ASSIGN_RESULT assign_values(SceneViewer& sv, int w, int h, std::string& scene_file, std::string& camera_name,
-    std::string& device_name, std::string& events, std::string& culling);
+    std::string& device_name, std::string& events, std::string& culling, int record_threads, bool render_on_demand, std::string& vertex_format, std::string& cube_shadows, int shadow_atlas, std::string& shadow_update, int shadow_budget, int shadow_samples, std::string& shadow_filter);
 
 void parse_arguments(int argc, char* argv[], int& w, int& h, std::string& scene_file, std::string& camera_name,
-    std::string& device_name, std::string& events, bool& list_devices, std::string& culling);
+    std::string& device_name, std::string& events, bool& list_devices, std::string& culling, int& record_threads, bool& render_on_demand, std::string& vertex_format, std::string& cube_shadows, int& shadow_atlas, std::string& shadow_update, int& shadow_budget, int& shadow_samples, std::string& shadow_filter);
 
 
 int main(int argc, char* argv[]) {
 
     // handling arguments
     int w = 0, h = 0;
-    std::string scene_file, camera_name = "debug", device_name = "", events = "", culling = "none";
-    bool list_devices = false;
-    parse_arguments(argc, argv, w, h, scene_file, camera_name, device_name, events, list_devices, culling);
+    std::string scene_file, camera_name = "debug", device_name = "", events = "", culling = "none", vertex_format = "float", cube_shadows = "faces", shadow_update = "cached", shadow_filter = "pcss";
+    int record_threads = 1, shadow_atlas = 0, shadow_budget = MAX_LIGHT, shadow_samples = 16;
+    bool list_devices = false, render_on_demand = false;
+    parse_arguments(argc, argv, w, h, scene_file, camera_name, device_name, events, list_devices, culling, record_threads, render_on_demand, vertex_format, cube_shadows, shadow_atlas, shadow_update, shadow_budget, shadow_samples, shadow_filter);
 
     SceneViewer scene_viewer;
 
@@ -25,7 +26,7 @@ int main(int argc, char* argv[]) {
     }
 
     // assigning values to scene_viewer
-    if (assign_values(scene_viewer, w, h, scene_file, camera_name, device_name, events, culling) != SUCCESS) {
+    if (assign_values(scene_viewer, w, h, scene_file, camera_name, device_name, events, culling, record_threads, render_on_demand, vertex_format, cube_shadows, shadow_atlas, shadow_update, shadow_budget, shadow_samples, shadow_filter) != SUCCESS) {
         return EXIT_FAILURE;
     }
 
@@ -48,7 +49,7 @@ int main(int argc, char* argv[]) {
 
 // implement the assign_values function
 ASSIGN_RESULT assign_values(SceneViewer& sv, int w, int h, std::string& scene_file, std::string& camera_name,
-                            std::string& device_name, std::string& events, std::string& culling) {
+                            std::string& device_name, std::string& events, std::string& culling, int record_threads, bool render_on_demand, std::string& vertex_format, std::string& cube_shadows, int shadow_atlas, std::string& shadow_update, int shadow_budget, int shadow_samples, std::string& shadow_filter) {
     if (w != 0 && h != 0) {
         sv.window_width = w;
         sv.window_height = h;
@@ -74,12 +75,71 @@ ASSIGN_RESULT assign_values(SceneViewer& sv, int w, int h, std::string& scene_fi
         sv.culling = culling;
     }
 
+    if (record_threads < 1) {
+        std::cerr << "--record-threads expects a positive thread count" << std::endl;
+        return FAILURE;
+    }
+    sv.recordThreads = record_threads;
+
+    sv.renderOnDemand = render_on_demand;
+
+    if (vertex_format != "float" && vertex_format != "compact") {
+        std::cerr << "--vertex-format expects float or compact" << std::endl;
+        return FAILURE;
+    }
+    sv.compactVertices = vertex_format == "compact";
+
+    if (cube_shadows != "faces" && cube_shadows != "multiview") {
+        std::cerr << "--cube-shadows expects faces or multiview" << std::endl;
+        return FAILURE;
+    }
+    sv.multiviewCubeShadows = cube_shadows == "multiview";
+
+    // the packer splits the atlas into power of two quadrants
+    if (shadow_atlas != 0 && (shadow_atlas < 256 || (shadow_atlas & (shadow_atlas - 1)) != 0)) {
+        std::cerr << "--shadow-atlas expects a power of two of at least 256" << std::endl;
+        return FAILURE;
+    }
+    sv.shadowAtlasSize = static_cast<uint32_t>(shadow_atlas);
+
+    if (shadow_update == "always") {
+        sv.shadowUpdate = ShadowUpdate::always;
+    }
+    else if (shadow_update == "cached") {
+        sv.shadowUpdate = ShadowUpdate::cached;
+    }
+    else if (shadow_update == "amortized") {
+        sv.shadowUpdate = ShadowUpdate::amortized;
+    }
+    else {
+        std::cerr << "--shadow-update expects always, cached or amortized" << std::endl;
+        return FAILURE;
+    }
+
+    if (shadow_budget < 0) {
+        std::cerr << "--shadow-budget expects a light count of at least 0" << std::endl;
+        return FAILURE;
+    }
+    sv.shadowBudget = shadow_budget;
+
+    if (shadow_samples < 4 || shadow_samples > MAX_SHADOW_SAMPLES) {
+        std::cerr << "--shadow-samples expects a sample count between 4 and " << MAX_SHADOW_SAMPLES << std::endl;
+        return FAILURE;
+    }
+    sv.shadowSamples = shadow_samples;
+
+    if (shadow_filter != "pcss" && shadow_filter != "evsm") {
+        std::cerr << "--shadow-filter expects pcss or evsm" << std::endl;
+        return FAILURE;
+    }
+    sv.shadowFilter = shadow_filter == "evsm" ? sconfig::ShadowFilter::evsm : sconfig::ShadowFilter::pcss;
+
     return SUCCESS;
 }
 
 // TODO: there is a bug here: enter name with space, it will not work
 void parse_arguments(int argc, char* argv[], int& w, int& h, std::string& scene_file, std::string& camera_name,
-                    std::string& device_name, std::string& events, bool& list_devices, std::string& culling) {
+                    std::string& device_name, std::string& events, bool& list_devices, std::string& culling, int& record_threads, bool& render_on_demand, std::string& vertex_format, std::string& cube_shadows, int& shadow_atlas, std::string& shadow_update, int& shadow_budget, int& shadow_samples, std::string& shadow_filter) {
     if (argc == 1) {
         return;
     }
@@ -118,5 +178,40 @@ void parse_arguments(int argc, char* argv[], int& w, int& h, std::string& scene_
             culling = argv[i + 1];
             ++i;
         }
+        else if (arg == "--record-threads") {
+            record_threads = std::stoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--vertex-format") {
+            vertex_format = argv[i + 1];
+            ++i;
+        }
+        else if (arg == "--cube-shadows") {
+            cube_shadows = argv[i + 1];
+            ++i;
+        }
+        else if (arg == "--shadow-atlas") {
+            shadow_atlas = std::stoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--shadow-update") {
+            shadow_update = argv[i + 1];
+            ++i;
+        }
+        else if (arg == "--shadow-budget") {
+            shadow_budget = std::stoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--shadow-samples") {
+            shadow_samples = std::stoi(argv[i + 1]);
+            ++i;
+        }
+        else if (arg == "--shadow-filter") {
+            shadow_filter = argv[i + 1];
+            ++i;
+        }
+        else if (arg == "--render-on-demand") {
+            render_on_demand = true;
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// where a buffer or image lives: a range inside a VkDeviceMemory block, or a whole dedicated allocation
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+    int pool = -1;              // -1 for dedicated allocations
+    int block = -1;
+    void* mapped = nullptr;     // host pointer at offset, set for host visible memory (blocks stay mapped)
+};
+
+// one large vkAllocateMemory, handed out with a buddy allocator
+struct MemoryBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;                                      // power of two
+    uint32_t maxOrder;                                      // size == 1 << maxOrder
+    void* mapped;
+    std::vector<std::set<VkDeviceSize>> freeLists;          // [order] offsets of free nodes
+    std::unordered_map<VkDeviceSize, uint32_t> nodeOrders;  // offset -> order of allocated nodes
+    VkDeviceSize requestedBytes;
+    VkDeviceSize nodeBytes;                                 // requestedBytes rounded up to the buddy nodes
+};
+
+// blocks of one memory type, linear resources (buffers, linear images) and optimal images never share a
+// block so bufferImageGranularity never applies
+struct MemoryPool {
+    uint32_t memoryType;
+    bool linear;
+    std::vector<std::unique_ptr<MemoryBlock>> blocks;      // nullptr once an empty block was released
+};
+
+class MemoryAllocator {
+public:
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, bool budgetExtension);
+    void destroy();
+
+    MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+    void free(MemoryAllocation& allocation);
+
+    bool isCoherent(const MemoryAllocation& allocation) const;
+    void dumpStats();
+
+private:
+    static const uint32_t MIN_ORDER = 8;                    // 256 bytes, also covers nonCoherentAtomSize
+    static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    bool budgetExtension = false;
+    VkPhysicalDeviceMemoryProperties memProperties{};
+    VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS]{};
+    VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS]{};          // from the budget extension, else our own count
+    VkDeviceSize heapAllocated[VK_MAX_MEMORY_HEAPS]{};      // bytes we got from vkAllocateMemory
+
+    std::vector<MemoryPool> pools;
+    std::unordered_map<VkDeviceMemory, MemoryAllocation> dedicatedAllocations;
+    std::mutex mutex;
+
+    uint32_t chooseMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkDeviceSize size);
+    VkDeviceSize blockSizeFor(uint32_t memoryType) const;
+    void updateBudget();
+    VkDeviceMemory allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, void** mapped);
+    bool allocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset);
+    void freeInBlock(MemoryBlock& block, VkDeviceSize offset);
+};
@@ -399,7 +399,7 @@ namespace sconfig {
             file.read(reinterpret_cast<char*>(&g), sizeof(uint8_t));
             file.read(reinterpret_cast<char*>(&b), sizeof(uint8_t));
             file.read(reinterpret_cast<char*>(&a), sizeof(uint8_t));
-            mesh->colors.emplace_back(cglm::Vec3f{ static_cast<float>(r) / 255.0f, static_cast<float>(g) / 255.0f, static_cast<float>(b) / 255.0f });
+            mesh->colors.push_back({ r, g, b, a });
         }
 
         // close file
@@ -464,7 +464,7 @@ namespace sconfig {
         // translation could be applied to light
         if (obj->contents.find("light") != obj->contents.end()) {
             int light_id = static_cast<int>(std::get<double>(obj->contents.at("light")));
-            std::shared_ptr<Light> light = id2lights[light_id];
+            std::shared_ptr<Light> light = findLight(light_id);
             cglm::Vec4f npos = translate_m * cglm::Vec4f{ light->position, 1.0f };
             light->position = { npos[0] / npos[3], npos[1] / npos[3], npos[2] / npos[3] };
             light->direction = rotation_m * light->direction;
@@ -622,6 +622,14 @@ namespace sconfig {
     }
 
 
+    std::shared_ptr<Light> SceneConfig::findLight(int light_id) {
+        auto it = id2lights.find(light_id);
+        if (it != id2lights.end()) {
+            return it->second;
+        }
+        return id2unshadowedLights.at(light_id);
+    }
+
     std::shared_ptr<Light> SceneConfig::generateLight(const mcjp::Object* obj) {
         std::shared_ptr<Light> light = std::make_shared<Light>();
         light->name = std::get<std::string>(obj->contents.at("name"));
@@ -630,8 +638,17 @@ namespace sconfig {
             light->tint[i] = static_cast<float>(ttint[i]);
         }
         light->shadow = std::get<double>(obj->contents.at("shadow"));
-        if (light->shadow == 0) {
-            return nullptr;
+        if (obj->contents.find("shadowFilter") != obj->contents.end()) {
+            std::string filter = std::get<std::string>(obj->contents.at("shadowFilter"));
+            if (filter == "pcss") {
+                light->shadowFilter = ShadowFilter::pcss;
+            }
+            else if (filter == "evsm") {
+                light->shadowFilter = ShadowFilter::evsm;
+            }
+            else {
+                throw std::runtime_error("Unknown shadowFilter " + filter + " on Light " + light->name + "!");
+            }
         }
         light->position = cglm::Vec3f{ 0.0f, 0.0f, 0.0f };
         light->direction = cglm::Vec3f{ 0.0f, 0.0f, -1.0f };
@@ -738,9 +755,12 @@ namespace sconfig {
             }
             else if (type == "light" || type == "LIGHT") {
                 std::shared_ptr<Light> lightPtr = generateLight(obj);
-                if (lightPtr != nullptr) {
+                if (lightPtr->shadow > 0) {
                     id2lights[i] = lightPtr;
                 }
+                else {
+                    id2unshadowedLights[i] = lightPtr;
+                }
             }
             else if (type == "CLOUD") {
                 std::shared_ptr<Cloud> cloudPtr = generateCloud(obj);
@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <stdexcept>
 #include <set>
+#include <optional>
 
 #include "libs/cglm.hpp"
 #include "libs/mcjp.hpp"
@@ -85,7 +86,7 @@ namespace sconfig {
         // vertex data
         std::vector<cglm::Vec3f> positions;
         std::vector<cglm::Vec3f> normals;
-        std::vector<cglm::Vec3f> colors;
+        std::vector<std::array<uint8_t, 4>> colors;     // RGBA8 as stored in the .b72 files
         std::string position_format;
         std::string normal_format;
         std::string color_format;
@@ -190,12 +191,18 @@ namespace sconfig {
         SPHERE,
         SPOT
     };
+    // how a light's shadow map is filtered, per sample (pcss) or once into moments (evsm)
+    enum class ShadowFilter {
+        pcss,
+        evsm
+    };
     struct Light {
         LightType type;
         std::string name;
         std::array<float, 3> tint;
         LightData data;
         int shadow;
+        std::optional<ShadowFilter> shadowFilter;     // "shadowFilter", unset falls back to --shadow-filter
 
         cglm::Vec3f position;
         cglm::Vec3f direction;
@@ -236,7 +243,8 @@ namespace sconfig {
         std::shared_ptr<Scene> scene;
         std::shared_ptr<Environment> environment;
 
-        std::map<int, std::shared_ptr<Light>> id2lights;
+        std::map<int, std::shared_ptr<Light>> id2lights;               // shadow casting lights
+        std::map<int, std::shared_ptr<Light>> id2unshadowedLights;     // shadow 0, only shaded through the light clusters
 
         std::map<int, std::shared_ptr<Cloud>> id2clouds;
 
@@ -257,6 +265,7 @@ namespace sconfig {
         std::shared_ptr<Material> generateMaterial(const mcjp::Object* obj);
         std::shared_ptr<Environment> generateEnvironment(const mcjp::Object* obj);
         std::shared_ptr<Light> generateLight(const mcjp::Object* obj);
+        std::shared_ptr<Light> findLight(int light_id);
         std::shared_ptr<Cloud> generateCloud(const mcjp::Object* obj);
     };
 
@@ -1,8 +1,9 @@
 #include "scene_viewer.hpp"
 
-std::vector<std::vector<Vertex>> frame_vertices_static(MAX_FRAMES_IN_FLIGHT);
-std::vector<Vertex> static_vertices;
-std::vector<Vertex> indexed_vertices;
+std::vector<VertexPosition> static_vertex_positions;
+std::vector<VertexAttributes> static_vertex_attributes;
+std::vector<CompactVertexPosition> static_compact_vertex_positions;
+std::vector<CompactVertexAttributes> static_compact_vertex_attributes;
 
 bool SceneViewer::leftMouseButtonPressed = false;
 bool SceneViewer::rightMouseButtonPressed = false;
@@ -31,6 +32,7 @@ void SceneViewer::initVulkan() {
     createCloudPipeline();
     std::cout << 2 << std::endl;
     createCommandPool();
+    createUploadEngine();
     std::cout << 3 << std::endl;
     createDepthResources();
     std::cout << 4 << std::endl;
@@ -46,6 +48,7 @@ void SceneViewer::initVulkan() {
     std::cout << 6 << std::endl;
 
     createVertexBuffer();
+    createMaterialBuffer();
     createCloudVertexBuffers();
     std::cout << 7 << std::endl;
     createIndexBuffer();
@@ -62,9 +65,11 @@ void SceneViewer::initVulkan() {
     createCloudDescriptorSets();
     std::cout << 9 << std::endl;
     createCommandBuffers();
+    createRecordThreadPools(findQueueFamilies(physicalDevice).graphicsFamily.value());
     std::cout << 10 << std::endl;
     createSyncObjects();
     std::cout << 11 << std::endl;
+    memoryAllocator.dumpStats();
 
 }
 
@@ -88,7 +93,7 @@ void SceneViewer::cleanup() {
         vkDestroyImage(device, image, nullptr);
     }
     for (auto& memory : texture2DImageMemorys) {
-        vkFreeMemory(device, memory, nullptr);
+        memoryAllocator.free(memory);
     }
 
     for (auto& imageView : textureCubeImageViews) {
@@ -98,7 +103,7 @@ void SceneViewer::cleanup() {
         vkDestroyImage(device, image, nullptr);
     }
     for (auto& memory : textureCubeImageMemorys) {
-        vkFreeMemory(device, memory, nullptr);
+        memoryAllocator.free(memory);
     }
 
     // vkDestroyPipeline(device, graphicsPipeline, nullptr);
@@ -114,8 +119,12 @@ void SceneViewer::cleanup() {
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-    vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
+    vkDestroyBuffer(device, vertexPositionBuffer, nullptr);
+    memoryAllocator.free(vertexPositionBufferMemory);
+    vkDestroyBuffer(device, vertexAttributeBuffer, nullptr);
+    memoryAllocator.free(vertexAttributeBufferMemory);
+    vkDestroyBuffer(device, materialBuffer, nullptr);
+    memoryAllocator.free(materialBufferMemory);
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
@@ -123,8 +132,11 @@ void SceneViewer::cleanup() {
         vkDestroyFence(device, inFlightFences[i], nullptr);
     }
 
+    destroyUploadEngine();
+    destroyRecordThreadPools();
     vkDestroyCommandPool(device, commandPool, nullptr);
 
+    memoryAllocator.destroy();
     vkDestroyDevice(device, nullptr);
 
     if (enableValidationLayers) {
@@ -140,7 +152,16 @@ void SceneViewer::cleanup() {
 
 void SceneViewer::loadCheck() {
     // initialize frame instances
-    frame_material_meshInnerId2ModelMatrices.resize(MAX_FRAMES_IN_FLIGHT);
+    // reserve for the whole scene up front, later frames only clear and refill
+    size_t drawCapacity = std::max(scene_config.id2instance.size(), static_cast<size_t>(MAX_INSTANCE));
+    frameDrawLists.resize(MAX_FRAMES_IN_FLIGHT);
+    for (auto& drawList : frameDrawLists) {
+        drawList.models.reserve(drawCapacity);
+        drawList.items.reserve(drawCapacity);
+        drawList.scratch.reserve(drawCapacity);
+        drawList.sortedModels.reserve(drawCapacity);
+        drawList.batches.reserve(drawCapacity);
+    }
 
     texturePrepare();
 
@@ -160,7 +181,8 @@ void SceneViewer::initWindow() {
     // std::cout << "Window width: " << window_width << " " << window_height << std::endl;
     window = glfwCreateWindow(window_width, window_height, "Michael_NICE_Window", nullptr, nullptr);
     glfwSetWindowUserPointer(window, this);
-    // glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    glfwSetWindowRefreshCallback(window, windowRefreshCallback);
     glfwSetMouseButtonCallback(window, mouse_control_callback);
     glfwSetCursorPosCallback(window, cursor_position_callback);
     glfwSetKeyCallback(window, keyCallback);
@@ -171,10 +193,21 @@ void SceneViewer::mainLoop() {
 
     copyAllMeshVertexToBuffer();
     copyCloudVertexToBuffer();
+    flushBufferUploads();
+    // textures were submitted during init, reclaim every staging buffer before the loop
+    waitUploads();
 
     startTime = std::chrono::high_resolution_clock::now();
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        if (renderOnDemand) {
+            // sleeps in glfwWaitEventsTimeout until input, animation or the cloud timer asks for a frame
+            if (!waitForFrameRequest()) {
+                continue;
+            }
+        }
+        else {
+            glfwPollEvents();
+        }
         setup_frame_instances(-1);
 
         drawFrame();
@@ -188,6 +221,34 @@ void SceneViewer::mainLoop() {
     vkDeviceWaitIdle(device);
 }
 
+// returns true when a frame should be drawn now, otherwise blocks for events up to the next timed effect
+bool SceneViewer::waitForFrameRequest() {
+    // the cloud pass animates with time, it is the only thing that needs frames while paused
+    bool timedEffects = !scene_config.id2clouds.empty();
+
+    if (frameRequested || animationPlay) {
+        glfwPollEvents();
+    }
+    else if (timedEffects) {
+        glfwWaitEventsTimeout(std::max(nextTimedFrame - glfwGetTime(), 0.0));
+    }
+    else {
+        glfwWaitEventsTimeout(ON_DEMAND_IDLE_TIMEOUT);
+    }
+
+    double now = glfwGetTime();
+    bool timedFrameDue = timedEffects && now >= nextTimedFrame;
+    if (!frameRequested && !animationPlay && !timedFrameDue) {
+        return false;
+    }
+
+    frameRequested = false;
+    if (timedFrameDue) {
+        nextTimedFrame = now + TIMED_EFFECT_FRAME_INTERVAL;
+    }
+    return true;
+}
+
 void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator) {
     auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
     if (func != nullptr) {
@@ -309,6 +370,7 @@ void SceneViewer::keyCallback(GLFWwindow* window, int key, int scancode, int act
     // std::cout << "Camera Up: " << camera->up[0] << " " << camera->up[1] << " " << camera->up[2] << std::endl;
 
     camera->update_planes();
+    app->frameRequested = true;
 }
 
 void SceneViewer::mouse_control_callback(GLFWwindow* window, int button, int action, int mods) {
@@ -344,6 +406,7 @@ void SceneViewer::scroll_callback(GLFWwindow* window, double xoffset, double yof
 
     cglm::Vec3f new_pos = camera->position + dir * 0.1f * static_cast<float>(yoffset);
     camera->position = new_pos;
+    app->frameRequested = true;
 }
 
 void SceneViewer::cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
@@ -394,11 +457,18 @@ void SceneViewer::cursor_position_callback(GLFWwindow* window, double xpos, doub
         camera->up = new_up;
         camera->dir = new_dir;
     }
+
+    // both branches above need the left button, plain hovering changes nothing
+    if (leftMouseButtonPressed) {
+        app->frameRequested = true;
+    }
 }
 
 void SceneViewer::setup_frame_instances(double inTime) {
     // start from root, make each dfs, using currentFrame
-    frame_material_meshInnerId2ModelMatrices[currentFrame].clear();
+    frameDrawLists[currentFrame].models.clear();
+    frameDrawLists[currentFrame].bounds.clear();
+    frameDrawLists[currentFrame].items.clear();
 
     cglm::Mat44f identity_m = cglm::identity(1.0f);
 
@@ -420,7 +490,7 @@ void SceneViewer::setup_frame_instances(double inTime) {
                 int node_id = driver->node;
                 std::shared_ptr<sconfig::Node> light_node = scene_config.id2node[node_id];
                 int light_id = light_node->light_id;
-                std::shared_ptr<sconfig::Light> light = scene_config.id2lights[light_id];
+                std::shared_ptr<sconfig::Light> light = scene_config.findLight(light_id);
                 if (driver->channel == "translation") {
                     cglm::Vec4f npos = animation_transform * cglm::Vec4f(0.0f, 0.0f, 0.0f, 1.0f);
                     light->position = { npos[0] / npos[3], npos[1] / npos[3], npos[2] / npos[3] };
@@ -448,6 +518,7 @@ void SceneViewer::setup_frame_instances(double inTime) {
         dfs_instance(node_id, currentFrame, identity_m);
     }
 
+    buildFrameDrawList(currentFrame);
 }
 
 void SceneViewer::dfs_instance(int node_id, int currentFrame, cglm::Mat44f parent_transform) {
@@ -471,7 +542,8 @@ void SceneViewer::dfs_instance(int node_id, int currentFrame, cglm::Mat44f paren
         float new_radius = bound_sphere->radius * std::max(scale_x, std::max(scale_y, scale_z));
         
         // check with boundaries
-        std::vector<std::shared_ptr<sconfig::Plane>> planes = scene_config.cameras[scene_config.cur_camera]->bounds;
+        std::shared_ptr<sconfig::Camera>& camera = scene_config.cameras[scene_config.cur_camera];
+        const std::vector<std::shared_ptr<sconfig::Plane>>& planes = camera->bounds;
         bool visible = true;
         int ii = 0;
         for (auto& plane : planes) {
@@ -493,8 +565,79 @@ void SceneViewer::dfs_instance(int node_id, int currentFrame, cglm::Mat44f paren
         // std::cout << "Material Id: " << material_id << std::endl;
         MaterialType materialType = scene_config.id2material[material_id]->matetial_type;
         int inner_id = scene_config.id2mesh[mesh_id]->inner_id;
-        frame_material_meshInnerId2ModelMatrices[currentFrame][materialType][inner_id].push_back(curTransform);
+
+        // every material is opaque, so no view depth in the key: the sort is stable and instances keep their
+        // traversal order inside a batch, which leaves their instanceModels slots unchanged while the camera moves
+        FrameDrawList& drawList = frameDrawLists[currentFrame];
+        drawList.items.push_back({
+            .key = (static_cast<uint64_t>(materialType) << 56) | (static_cast<uint64_t>(inner_id & 0xffffff) << 32),
+            .instance = static_cast<uint32_t>(drawList.models.size()),
+        });
+        drawList.models.push_back(curTransform);
+        drawList.bounds.push_back(cglm::Vec4f(new_center, new_radius));
         // std::cout << "Material " << materialType << " InnerId " << inner_id << std::endl;
     }
 
 }
+
+
+// LSD radix sort on 8 bit digits, a digit every key shares is skipped
+static void radixSortDrawItems(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch) {
+    if (items.empty()) {
+        return;
+    }
+    scratch.resize(items.size());
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::array<uint32_t, 256> counts{};
+        for (const auto& item : items) {
+            counts[(item.key >> shift) & 0xff]++;
+        }
+        if (counts[(items[0].key >> shift) & 0xff] == items.size()) {
+            continue;
+        }
+
+        uint32_t sum = 0;
+        for (auto& count : counts) {
+            uint32_t c = count;
+            count = sum;
+            sum += c;
+        }
+        for (const auto& item : items) {
+            scratch[counts[(item.key >> shift) & 0xff]++] = item;
+        }
+        items.swap(scratch);
+    }
+}
+
+void SceneViewer::buildFrameDrawList(int currentFrame) {
+    FrameDrawList& drawList = frameDrawLists[currentFrame];
+    radixSortDrawItems(drawList.items, drawList.scratch);
+
+    // run-length encode equal (material, mesh) into batches, instance order is now draw order. instances past
+    // MAX_INSTANCE have no slot in instanceModels and are dropped
+    drawList.sortedModels.clear();
+    drawList.sortedBounds.clear();
+    drawList.batches.clear();
+    for (const auto& item : drawList.items) {
+        if (drawList.sortedModels.size() == MAX_INSTANCE) {
+            break;
+        }
+        MaterialType materialType = static_cast<MaterialType>(item.key >> 56);
+        int inner_id = static_cast<int>((item.key >> 32) & 0xffffff);
+
+        if (drawList.batches.empty() || drawList.batches.back().material != materialType || drawList.batches.back().meshInnerId != inner_id) {
+            drawList.batches.push_back({
+                .material = materialType,
+                .meshInnerId = inner_id,
+                .firstVertex = static_cast<uint32_t>(meshInnerId2Offset[inner_id]),
+                .vertexCount = static_cast<uint32_t>(scene_config.id2mesh[scene_config.innerId2meshId[inner_id]]->vertex_count),
+                .firstInstance = static_cast<uint32_t>(drawList.sortedModels.size()),
+                .instanceCount = 0,
+            });
+        }
+        drawList.batches.back().instanceCount++;
+        drawList.sortedModels.push_back(drawList.models[item.instance]);
+        drawList.sortedBounds.push_back(drawList.bounds[item.instance]);
+    }
+}
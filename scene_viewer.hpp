@@ -15,11 +15,22 @@
 #include <fstream>
 #include <chrono>
 #include <map>
+#include <bitset>
 
 #include "scene_config.hpp"
+#include "memory_allocator.hpp"
 
 const int MAX_INSTANCE = 32;
-const int MAX_LIGHT = 8;
+const int MAX_LIGHT = 8;                // shadow casting lights, the rest only go through the light clusters
+const int MAX_SHADOW_SAMPLES = 64;      // poisson disk size in the material shaders
+const int SUN_CASCADES = 4;             // shadow cascades per sun, their split depths fill a vec4 of metadata1
+
+// froxel grid of clustered shading, CLUSTER_Z slices are logarithmic in view depth
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 9;
+const int CLUSTER_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+const int MAX_CLUSTER_INDICES = CLUSTER_COUNT * 32;
 
 struct CloudVertex {
     cglm::Vec3f pos;
@@ -44,122 +55,149 @@ struct CloudVertex {
 
 };
 
-struct Vertex {
+// vertices are split into two streams so the shadow passes only fetch what they read.
+// binding 0, position and normal, read by every pipeline
+struct VertexPosition {
     cglm::Vec3f pos;
     cglm::Vec3f normal;
-    cglm::Vec3f color;
-    cglm::Vec2f texCoord;
-    cglm::Vec3f mappingIdxs; // if last element is 0, then it's a 2D texture, otherwise it's a cube texture
-    cglm::Vec2f normalMappingIdxs;
-    cglm::Vec3f pbrs;
 
     static VkVertexInputBindingDescription getBindingDescription() {
         VkVertexInputBindingDescription bindingDescription{
             .binding = 0,
-            .stride = sizeof(Vertex),
+            .stride = sizeof(VertexPosition),
             .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
         };
         return bindingDescription;
     }
 
-    static std::vector<VkVertexInputAttributeDescription> getSimpleAttributeDescriptions() {
-        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(3);
+    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
         attributeDescriptions[0].binding = 0;
         attributeDescriptions[0].location = 0;
         attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
+        attributeDescriptions[0].offset = offsetof(VertexPosition, pos);
         attributeDescriptions[1].binding = 0;
         attributeDescriptions[1].location = 1;
         attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, normal);
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, color);
+        attributeDescriptions[1].offset = offsetof(VertexPosition, normal);
         return attributeDescriptions;
     }
+};
 
-    static std::vector<VkVertexInputAttributeDescription> getEnvAttributeDescriptions() {
-        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, normal);
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, normalMappingIdxs);
+// binding 1, shading only, material data is looked up in materialParams with the per draw push constant
+struct VertexAttributes {
+    cglm::Vec3f color;
+    cglm::Vec2f texCoord;
 
-        return attributeDescriptions;
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{
+            .binding = 1,
+            .stride = sizeof(VertexAttributes),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        };
+        return bindingDescription;
     }
 
-    static std::vector<VkVertexInputAttributeDescription> getLambertianAttributeDescriptions() {
-        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(5);
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
+    static std::vector<VkVertexInputAttributeDescription> getSimpleAttributeDescriptions() {
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 2;
         attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, normal);
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-        attributeDescriptions[3].binding = 0;
-        attributeDescriptions[3].location = 3;
-        attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[3].offset = offsetof(Vertex, mappingIdxs);
-        attributeDescriptions[4].binding = 0;
-        attributeDescriptions[4].location = 4;
-        attributeDescriptions[4].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[4].offset = offsetof(Vertex, normalMappingIdxs);
+        attributeDescriptions[0].offset = offsetof(VertexAttributes, color);
+        return attributeDescriptions;
+    }
 
+    // environment, mirror, lambertian and pbr
+    static std::vector<VkVertexInputAttributeDescription> getTexturedAttributeDescriptions() {
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 2;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(VertexAttributes, texCoord);
         return attributeDescriptions;
     }
+};
+
+// --vertex-format compact: 12 + 8 bytes instead of 24 + 20, same bindings and locations as above.
+// position is relative to the mesh bounds (MeshPushConstants), normal is octahedral
+struct CompactVertexPosition {
+    uint16_t pos[4];            // R16G16B16A16_UNORM, w unused
+    int16_t normal[2];          // R16G16_SNORM
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{
+            .binding = 0,
+            .stride = sizeof(CompactVertexPosition),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        };
+        return bindingDescription;
+    }
 
-    static std::vector<VkVertexInputAttributeDescription> getPbrAttributeDescriptions() {
-        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(6);
+    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
         attributeDescriptions[0].binding = 0;
         attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
+        attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attributeDescriptions[0].offset = offsetof(CompactVertexPosition, pos);
         attributeDescriptions[1].binding = 0;
         attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, normal);
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-        attributeDescriptions[3].binding = 0;
-        attributeDescriptions[3].location = 3;
-        attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[3].offset = offsetof(Vertex, mappingIdxs);
-        attributeDescriptions[4].binding = 0;
-        attributeDescriptions[4].location = 4;
-        attributeDescriptions[4].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[4].offset = offsetof(Vertex, normalMappingIdxs);
-        attributeDescriptions[5].binding = 0;
-        attributeDescriptions[5].location = 5;
-        attributeDescriptions[5].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[5].offset = offsetof(Vertex, pbrs);
+        attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+        attributeDescriptions[1].offset = offsetof(CompactVertexPosition, normal);
+        return attributeDescriptions;
+    }
+};
 
+struct CompactVertexAttributes {
+    uint16_t texCoord[2];       // R16G16_SFLOAT
+    uint8_t color[4];           // R8G8B8A8_UNORM
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{
+            .binding = 1,
+            .stride = sizeof(CompactVertexAttributes),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        };
+        return bindingDescription;
+    }
+
+    static std::vector<VkVertexInputAttributeDescription> getSimpleAttributeDescriptions() {
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 2;
+        attributeDescriptions[0].format = VK_FORMAT_R8G8B8A8_UNORM;
+        attributeDescriptions[0].offset = offsetof(CompactVertexAttributes, color);
+        return attributeDescriptions;
+    }
+
+    static std::vector<VkVertexInputAttributeDescription> getTexturedAttributeDescriptions() {
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 2;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(CompactVertexAttributes, texCoord);
         return attributeDescriptions;
     }
 };
 
+// per mesh push constants, the material pipelines get all of it and the shadow pipeline the position part
+struct MeshPushConstants {
+    cglm::Vec4f positionScale;      // compact vertices: object position = position * scale + offset
+    cglm::Vec4f positionOffset;
+    int32_t materialSlot;           // index into materialParams
+};
+
+// std140 mat3, three vec4 columns with w unused
+struct NormalMatrix {
+    cglm::Vec4f columns[3];
+};
+
 struct UniformBufferObject {
     cglm::Vec3f cameraPos;
     alignas(16) cglm::Mat44f model;
     cglm::Mat44f view;
     cglm::Mat44f proj;
     cglm::Mat44f instanceModels[MAX_INSTANCE];
+    NormalMatrix instanceNormals[MAX_INSTANCE];     // transpose(inverse(model)), recomputed only when the model changes
 };
 
 struct LightUniformBufferObject {
@@ -172,16 +210,212 @@ struct LightUniformBufferObject {
 
     alignas(16)cglm::Vec4f metadata1[MAX_LIGHT];
     alignas(16)cglm::Vec4f metadata2[MAX_LIGHT];
+    alignas(16)cglm::Vec4f shadowRects[MAX_LIGHT];      // spot tile in the atlas (offset, scale), (0, 0, 1, 1) without it
+    alignas(16)cglm::Mat44f cascadeMatrices[MAX_LIGHT * SUN_CASCADES];  // suns only, light view projection per cascade
+
+    // sphere lights only, read by shadow.vert. the masks are uvec4[] in glsl: bit f of
+    // [light * MAX_INSTANCE + instance] is set when that instance touches cube face f
+    alignas(16)cglm::Mat44f cubeFaceViews[MAX_LIGHT * 6];
+    alignas(16)uint32_t cubeFaceMasks[MAX_LIGHT * MAX_INSTANCE];
+};
+
+// one per scene light, std430 layout of ClusterLight in the shaders (binding 8). suns come first, then shadow casters,
+// which carry their LightUniformBufferObject slot in color.a, -1 when they cast no shadow this frame
+struct ClusterLight {
+    alignas(16)cglm::Vec4f position;   // xyz, w is the type: 0 spot, 1 sphere, 2 sun
+    alignas(16)cglm::Vec4f direction;  // xyz, w is the power, the strength for suns
+    alignas(16)cglm::Vec4f color;
+    alignas(16)cglm::Vec4f metadata;   // spot: radius, fov / 2, limit, blend. sphere: radius, limit. sun: angle
 };
 
+// start of the cluster buffer (binding 9), followed by CLUSTER_COUNT (first, count) pairs and the light indices
+struct ClusterHeader {
+    alignas(16)cglm::Vec4f viewport;   // x, y, 1 / width, 1 / height of the main pass
+    alignas(16)cglm::Vec4f cameraPos;  // w is near
+    alignas(16)cglm::Vec4f cameraDir;  // w is far
+    alignas(16)uint32_t lightCounts[4];     // x is the number of suns, which lead the light buffer and are in no cluster
+};
+
+// one per scene material, std430 layout of MaterialParams in the shaders (binding 6).
+// texture indices point into the tex2DSampler / texCubeSampler arrays, -1 when unused
+struct MaterialParams {
+    cglm::Vec4f albedo;         // linear
+    float roughness;
+    float metalness;
+    uint32_t flags;             // MATERIAL_* bits
+    int32_t normalMap;
+    int32_t albedoTexture;      // cube texture when MATERIAL_ALBEDO_CUBE is set
+    int32_t roughnessTexture;
+    int32_t metalnessTexture;
+    int32_t pad;
+};
+
+const uint32_t MATERIAL_CONST_ALBEDO = 1u << 0;
+const uint32_t MATERIAL_CONST_ROUGHNESS = 1u << 1;
+const uint32_t MATERIAL_CONST_METALNESS = 1u << 2;
+const uint32_t MATERIAL_ALBEDO_CUBE = 1u << 3;
+const uint32_t MATERIAL_NORMAL_XY = 1u << 4;            // two channel (bc5) normal map, z is rebuilt in the shader
+const uint32_t MATERIAL_LINEAR_NORMAL = 1u << 5;        // unorm ktx2, sampled without the srgb round trip
+const uint32_t MATERIAL_LINEAR_ROUGHNESS = 1u << 6;
+const uint32_t MATERIAL_LINEAR_METALNESS = 1u << 7;
+
 struct CloudUniformBufferObject {
     alignas(16) cglm::Vec4f lightPos;
     alignas(16) cglm::Vec4f lightColor;
     alignas(16) cglm::Vec4f metadata;
 };
 
-extern std::vector<Vertex> static_vertices;
-extern std::vector<std::vector<Vertex>> frame_vertices_static;
+// one visible mesh instance, key = material (8) | mesh inner id (24) | unused (32)
+struct DrawItem {
+    uint64_t key;
+    uint32_t instance;      // index into FrameDrawList::models
+};
+
+// run of sorted items sharing material and mesh, drawn with one instanced vkCmdDraw
+struct DrawBatch {
+    MaterialType material;
+    int meshInnerId;
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+
+    bool operator==(const DrawBatch&) const = default;
+};
+
+// everything needed to draw one frame, vectors are only cleared so capacity is reused
+struct FrameDrawList {
+    std::vector<cglm::Mat44f> models;           // in scene traversal order
+    std::vector<cglm::Vec4f> bounds;            // world bounding sphere (center, radius) per model
+    std::vector<DrawItem> items;
+    std::vector<DrawItem> scratch;              // radix sort ping-pong buffer
+    std::vector<cglm::Mat44f> sortedModels;     // in draw order, this is what instanceModels gets
+    std::vector<cglm::Vec4f> sortedBounds;      // bounds in draw order
+    std::vector<DrawBatch> batches;
+    std::vector<uint32_t> casterMasks;          // per sorted instance, bit per view of the light being culled
+    std::vector<std::vector<DrawBatch>> shadowBatches;  // [light index * 6 + face] casters of one shadow view, spots use face 0, suns one per cascade
+};
+
+enum class RecordTaskType {
+    spotShadow,
+    cubeShadowFace,
+    sunCascade,
+    material,
+    cloud,
+};
+
+// one unit of parallel recording, ends up as one secondary command buffer
+struct RecordTask {
+    RecordTaskType type;
+    int lightId;
+    int spotIdx;
+    int sphereIdx;
+    int sunIdx;
+    int face;                   // cube face for cubeShadowFace (always 0 with multiview), cascade for sunCascade, -1 otherwise
+    size_t firstBatch;          // batch range for material
+    size_t lastBatch;
+    VkCommandBuffer secondary;
+};
+
+// pool owned by one recording thread for one frame in flight, secondaries are reused after a pool reset
+struct RecordThreadContext {
+    VkCommandPool pool;
+    std::vector<VkCommandBuffer> secondaries;
+    size_t used;
+    std::string error;          // first failed task on this thread, rethrown after the parallel region
+};
+
+// square tile of the spot shadow atlas, in texels
+struct ShadowAtlasTile {
+    uint32_t x;
+    uint32_t y;
+    uint32_t size;
+
+    bool operator==(const ShadowAtlasTile&) const = default;
+};
+
+// --shadow-update: re-render every shadow view each frame, only the views whose light or casters changed,
+// or like cached but distant sphere lights catch up one cube face per frame
+enum class ShadowUpdate {
+    always,
+    cached,
+    amortized,
+};
+
+// what a light's shadow views were last rendered from, one view for spots, one per cube face or sun cascade
+struct ShadowCacheEntry {
+    uint64_t hashes[6];
+    uint32_t pending;           // bit per view that is out of date
+    int nextFace;               // round-robin start for amortized updates
+};
+
+// per light, ranked every frame by updateLightBudget
+struct LightBudget {
+    bool visible;               // its limit sphere touches the view frustum, only these are shaded
+    bool shadowed;              // among the --shadow-budget best scored visible lights
+    float coverage;             // share of the vertical fov its reach covers
+    float score;
+    uint32_t shadowSize;        // spot map resolution it gets, 0 without shadows
+};
+
+// bounding sphere of one cascade's slice of the camera frustum, snapped to whole texels of the sun's view
+struct SunCascade {
+    cglm::Vec3f center;
+    float radius;
+};
+
+// prefiltered shadow of a light with the evsm filter, rebuilt from its depth map or distance cube whenever
+// that is re-rendered. size 0 for lights that filter with pcss
+struct ShadowMomentMap {
+    uint32_t size;
+    uint32_t layers;                // 1 for spots, 6 for sphere cubes
+    uint32_t mipLevels;
+    VkImage image;
+    MemoryAllocation memory;
+    VkImageView view;               // sampled, 2D or cube over every mip
+    VkImageView storageView;        // mip 0 as a 2D array, written by the column blur
+    VkImage blurImage;              // row blur result
+    MemoryAllocation blurMemory;
+    VkImageView blurView;
+    VkImageView sourceView;         // the depth map or distance cube as a 2D array
+    std::vector<VkDescriptorSet> descriptorSets;     // per frame in flight, the light ubo differs
+};
+
+// everything baked into a recorded frame, the rest reaches the gpu through uniforms
+struct RecordState {
+    std::vector<DrawBatch> batches;
+    std::vector<ShadowAtlasTile> shadowAtlasTiles;  // viewports of the atlas pass
+    std::vector<uint8_t> shadowRenderViews;         // which shadow passes are recorded
+    std::vector<std::vector<DrawBatch>> shadowBatches;
+    VkViewport viewport{};
+    VkRect2D scissor{};
+    uint64_t pipelineVersion = 0;
+};
+
+// a pending copy into a static (vertex) buffer, executed in one batch by flushBufferUploads
+struct BufferUpload {
+    const void* data;           // must stay alive until the flush
+    VkDeviceSize size;
+    VkBuffer dst;
+};
+
+// one submit of the upload engine, owns a fixed segment of the staging ring
+struct UploadBatch {
+    VkCommandBuffer transferCommandBuffer;
+    VkCommandBuffer acquireCommandBuffer;   // graphics queue ownership acquire, only used with a transfer queue
+    VkSemaphore transferDone;
+    VkFence fence;                          // signaled once the batch is usable on the graphics queue
+    VkDeviceSize used;                      // bytes taken from the batch's ring segment
+    size_t uploadCount;
+    bool recording;
+    bool inFlight;
+    std::vector<std::pair<VkBuffer, MemoryAllocation>> oversizeStaging;    // uploads larger than a ring segment
+};
+
+extern std::vector<VertexPosition> static_vertex_positions;
+extern std::vector<VertexAttributes> static_vertex_attributes;
+extern std::vector<CompactVertexPosition> static_compact_vertex_positions;
+extern std::vector<CompactVertexAttributes> static_compact_vertex_attributes;
 
 const std::vector<const char*> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -192,6 +426,12 @@ const std::vector<const char*> validationLayers = {
 };
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
+const int RECORD_TIME_REPORT_FRAMES = 120;     // average command recording time over this many frames
+const int UPLOAD_BATCH_COUNT = 4;               // upload submits in flight, each with its own ring segment
+const VkDeviceSize UPLOAD_RING_SIZE = 32ull << 20;
+const VkDeviceSize TEXTURE_DECODE_BUDGET = 256ull << 20;    // decoded texture bytes waiting for their upload
+const double ON_DEMAND_IDLE_TIMEOUT = 0.5;          // seconds, render-on-demand wakes up at least this often
+const double TIMED_EFFECT_FRAME_INTERVAL = 1.0 / 30.0;   // seconds between frames for time driven effects (clouds)
 
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
@@ -207,6 +447,7 @@ enum ASSIGN_RESULT {
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily;     // transfer-only family, empty when the device has none
 
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -222,6 +463,8 @@ struct SwapChainSupportDetails {
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger);
 void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator);
 
+struct Ktx2Texture;     // parsed KTX2 header, texture.cpp
+
 // -------------------------------------------------------------------------|
 //                              SceneViewer class                           |
 // -------------------------------------------------------------------------|
@@ -232,6 +475,13 @@ public:
     std::string scene_file = "";
     std::string camera_name = "debug";
     std::string culling = "none";
+    bool compactVertices = false;       // --vertex-format compact
+    bool multiviewCubeShadows = false;  // --cube-shadows multiview, cleared when the device lacks multiview
+    uint32_t shadowAtlasSize = 0;       // --shadow-atlas <size>, 0 keeps one shadow map per spot light
+    ShadowUpdate shadowUpdate = ShadowUpdate::cached;   // --shadow-update
+    int shadowBudget = MAX_LIGHT;       // --shadow-budget <count>, lights that may cast shadows
+    int shadowSamples = 16;             // --shadow-samples <count>, poisson taps of the soft spot shadows
+    sconfig::ShadowFilter shadowFilter = sconfig::ShadowFilter::pcss;  // --shadow-filter, for lights without a shadowFilter
     std::string events;
     bool is_headless = false;
     std::optional < std::string > device_name = std::nullopt;
@@ -258,7 +508,15 @@ public:
     VkDevice device;                    // logical device       
     VkQueue graphicsQueue;              // graphics queue with logical device
     VkQueue presentQueue;               // present queue with logical device
+    VkQueue transferQueue;              // dedicated transfer queue, graphicsQueue when there is none
+    uint32_t transferQueueFamily;
+    uint32_t graphicsQueueFamily;
+    bool dedicatedTransferQueue = false;
     VkSurfaceKHR surface;
+    MemoryAllocator memoryAllocator;    // every buffer and image memory comes from here
+    bool memoryBudgetEnabled = false;   // VK_EXT_memory_budget supported and enabled
+    bool textureCompressionBCEnabled = false;
+    bool nonUniformIndexing = false;    // VK_EXT_descriptor_indexing non uniform sampler indexing, picks the frag_nonuniform.spv builds
 
     // headless 
     uint32_t queueFamilyIndex;
@@ -283,92 +541,157 @@ public:
     uint32_t currentFrame = 0;
     bool framebufferResized = false;
 
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
-    std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
-    std::vector<void*> uniformBuffersMapped;
+    VkBuffer vertexPositionBuffer;              // binding 0, the only stream the shadow passes bind
+    MemoryAllocation vertexPositionBufferMemory;
+    VkBuffer vertexAttributeBuffer;             // binding 1, shading attributes
+    MemoryAllocation vertexAttributeBufferMemory;
+    bool staticBuffersHostVisible = false;      // unified memory: static buffers are written in place, no staging
+    std::vector<BufferUpload> pendingBufferUploads;
+    // one MaterialParams per scene material, indexed by the slot in MeshPushConstants
+    std::vector<MaterialParams> materialParams;
+    std::unordered_map<int, int> materialId2Slot;
+    VkBuffer materialBuffer;
+    MemoryAllocation materialBufferMemory;
+    // upload engine: persistently mapped staging ring, batched copies on the transfer queue
+    VkCommandPool transferCommandPool;
+    VkBuffer uploadRingBuffer;
+    MemoryAllocation uploadRingMemory;
+    std::vector<UploadBatch> uploadBatches;
+    size_t currentUploadBatch = 0;
+    // instance ring: one persistently mapped buffer, one UniformBufferObject region per frame in flight
+    VkBuffer instanceRingBuffer;
+    MemoryAllocation instanceRingMemory;
+    void* instanceRingMapped;
+    VkDeviceSize instanceRingStride;                        // region size, aligned for descriptor offsets and flushes
+    VkDeviceSize nonCoherentAtomSize;
+    bool instanceRingCoherent;
+    std::vector<UniformBufferObject> instanceRingShadows;   // cpu copy of what each region currently holds
+    std::vector<VkMappedMemoryRange> instanceRingDirtyRanges;
     VkDescriptorSetLayout descriptorSetLayout;
     VkDescriptorPool descriptorPool;
     std::vector<VkDescriptorSet> descriptorSets;
 
     VkImage depthImage;                 // depth test over image
-    VkDeviceMemory depthImageMemory;
+    MemoryAllocation depthImageMemory;
     VkImageView depthImageView;
 
     std::vector<VkImage> texture2DImages;
     std::vector<VkImage> textureCubeImages;
-    std::vector<VkDeviceMemory> texture2DImageMemorys;
-    std::vector<VkDeviceMemory> textureCubeImageMemorys;
+    std::vector<MemoryAllocation> texture2DImageMemorys;
+    std::vector<MemoryAllocation> textureCubeImageMemorys;
     std::vector<VkImageView> texture2DImageViews;
+    std::vector<uint8_t> texture2DNormalXY;     // uploaded as bc5, only x and y are stored
+    std::vector<uint8_t> texture2DLinear;       // unorm ktx2, stored values are sampled as is
     std::vector<VkImageView> textureCubeImageViews;
     VkSampler textureSampler2D;
     VkSampler textureSamplerCube;
 
     // VkBuffer stagingBuffer;
-    // VkDeviceMemory stagingBufferMemory; 
+    // MemoryAllocation stagingBufferMemory; 
 
     VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
+    MemoryAllocation colorImageMemory;
     VkImageView colorImageView;
 
-    // light corresponding
+    // light corresponding, spot maps are depth only, sphere cubes keep distance / limit in one channel
+    VkFormat shadowMapFormat;                   // D32_SFLOAT or D16_UNORM
     std::vector<VkImage> shadowMapImages;
-    std::vector<VkDeviceMemory> shadowMapImageMemorys;
+    std::vector<MemoryAllocation> shadowMapImageMemorys;
     std::vector<VkImageView> shadowMapImageViews;
-    VkSampler shadowMapSampler;
+    VkSampler shadowMapSampler;                 // depth compare, for pcf
+    VkSampler shadowMapDepthSampler;            // raw depth, for the pcss blocker search
+    std::vector<ShadowAtlasTile> shadowAtlasTiles;  // per spot light, its square in the atlas (shadowMapImages[0]) or its own map
+    std::vector<std::pair<uint32_t, int>> shadowAtlasRequests;     // packer scratch, (tile size, spot index)
+    std::vector<ShadowAtlasTile> shadowAtlasFreeTiles;
+    std::vector<ShadowCacheEntry> shadowCache;      // per light, in id2lights order
+    std::vector<LightBudget> lightBudgets;          // per light, in id2lights order
+    std::vector<int> lightRanking;                  // scratch, light indices by score
+    std::vector<uint8_t> shadowRenderViews;         // per light, bit per framebuffer (spot map, cube face) rendered this frame
     std::vector<VkImage> shadowMapCubeImages;
-    std::vector<VkDeviceMemory> shadowMapCubeImageMemorys;
+    std::vector<MemoryAllocation> shadowMapCubeImageMemorys;
     std::vector<VkImageView> shadowMapCubeImageViews;
-    std::vector<std::vector<VkImageView>> shadowMapCubeFacesImageViews;
+    std::vector<std::vector<VkImageView>> shadowMapCubeFacesImageViews;     // six 2D views, or one 2D_ARRAY view with multiview
     VkSampler shadowMapCubeSampler;
 
-    VkRenderPass shadowRenderPass;
+    VkRenderPass shadowRenderPass;              // spot, depth attachment only
+    VkRenderPass shadowCubeRenderPass;          // sphere faces, R32_SFLOAT distance + depth test, view mask 0x3f with multiview
     std::vector<VkFramebuffer> shadowMapFramebuffers;
-    std::vector<std::vector<VkFramebuffer>> shadowMapCubeFramebuffers;
+    std::vector<std::vector<VkFramebuffer>> shadowMapCubeFramebuffers;     // per face, a single one with multiview
     
     VkPipelineLayout shadowPipelineLayout;
-    VkPipeline shadowGraphicsPipeline;
+    VkPipeline shadowGraphicsPipeline;          // vertex stage only
+    VkPipeline shadowCubeGraphicsPipeline;
     VkDescriptorSetLayout shadowDescriptorSetLayout;
     std::vector<VkBuffer> shadowUniformBuffers;
-    std::vector<VkDeviceMemory> shadowUniformBuffersMemory;
+    std::vector<MemoryAllocation> shadowUniformBuffersMemory;
     std::vector<void*> shadowUniformBuffersMapped;
     VkDescriptorPool shadowDescriptorPool;
     std::vector<VkDescriptorSet> shadowDescriptorSets;
 
-    std::vector<VkImage> shadowDepthImages;                 // depth test over image
-    std::vector<VkDeviceMemory> shadowDepthImageMemorys;
-    std::vector<VkImageView> shadowDepthImageViews;
-    std::vector<VkImage> shadowCubeDepthImages;                 // depth test over image
-    std::vector<VkDeviceMemory> shadowCubeDepthImageMemorys;
+    // clustered lighting, one light buffer and one cluster buffer per frame in flight
+    std::vector<VkBuffer> clusterLightBuffers;
+    std::vector<MemoryAllocation> clusterLightBuffersMemory;
+    std::vector<VkBuffer> clusterBuffers;
+    std::vector<MemoryAllocation> clusterBuffersMemory;
+    size_t clusterLightCapacity = 0;
+    std::vector<ClusterLight> clusterLights;        // this frame's lights, shadow casters first
+    std::vector<std::array<int, 6>> clusterBounds;  // per light, x0 x1 y0 y1 z0 z1 of the clusters it reaches, x0 > x1 when none
+    std::vector<uint32_t> clusterData;              // (first, count) per cluster, then the light indices
+
+    // evsm, the positive and negative warped moments of the light distance, blurred by a compute pass and sampled with mips.
+    // rgba32f is a core storage format, so the blur needs no extended formats
+    VkFormat shadowMomentFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    bool shadowMomentLinear;                            // the format filters linearly, for sampling and mip blits
+    std::vector<ShadowMomentMap> shadowMomentMaps;      // per light, in id2lights order
+    VkImage shadowMomentDummyImage;                     // fills the sampler slots of pcss lights, never read
+    MemoryAllocation shadowMomentDummyMemory;
+    VkImageView shadowMomentDummyView;
+    VkImageView shadowMomentDummyCubeView;
+    VkSampler shadowMomentSampler;
+    VkDescriptorSetLayout shadowMomentSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool shadowMomentDescriptorPool = VK_NULL_HANDLE;
+    VkPipelineLayout shadowMomentPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline shadowMomentPipeline = VK_NULL_HANDLE;
+
+    // sun cascades, one layered depth image with SUN_CASCADES layers per sun at the largest sun shadow size
+    uint32_t sunCascadeSize = 1;
+    VkImage sunCascadeImage;
+    MemoryAllocation sunCascadeMemory;
+    VkImageView sunCascadeView;                         // every layer as a 2D array, for sampling
+    std::vector<VkImageView> sunCascadeLayerViews;      // [sun index * SUN_CASCADES + cascade], one per framebuffer
+    std::vector<VkFramebuffer> sunCascadeFramebuffers;
+    std::vector<SunCascade> sunCascades;                // [light index * SUN_CASCADES + cascade], this frame's cascades
+
+    std::vector<VkImage> shadowCubeDepthImages;                 // depth test over image, 6 layers with multiview
+    std::vector<MemoryAllocation> shadowCubeDepthImageMemorys;
     std::vector<VkImageView> shadowCubeDepthImageViews;
 
     // clouds
     std::vector<VkBuffer> cloudVertexBuffers;
-    std::vector<VkDeviceMemory> cloudVertexBufferMemorys;
+    std::vector<MemoryAllocation> cloudVertexBufferMemorys;
     VkBuffer cloudIndexBuffer;
-    VkDeviceMemory cloudIndexBufferMemory;
+    MemoryAllocation cloudIndexBufferMemory;
     VkPipelineLayout cloudPipelineLayout;
     VkPipeline cloudPipeline;
     VkDescriptorSetLayout cloudDescriptorSetLayout;
     VkDescriptorPool cloudDescriptorPool;
     std::vector<VkDescriptorSet> cloudDescriptorSets;
     std::vector<VkImage> cloudImages;
-    std::vector<VkDeviceMemory> cloudImageMemorys;
+    std::vector<MemoryAllocation> cloudImageMemorys;
     std::vector<VkImageView> cloudImageViews;
     VkSampler cloudSampler;
     VkImage cloudNoiseImage;
-    VkDeviceMemory cloudNoiseImageMemory;
+    MemoryAllocation cloudNoiseImageMemory;
     VkImageView cloudNoiseImageView;
     VkSampler cloudNoiseSampler;
     std::vector<VkBuffer> cloudUniformBuffers;
-    std::vector<VkDeviceMemory> cloudUniformBuffersMemory;
+    std::vector<MemoryAllocation> cloudUniformBuffersMemory;
     std::vector<void*> cloudUniformBuffersMapped;
 
     // headless specs
     VkFramebuffer headlessFramebuffer;
     VkImage dstImage;
-    VkDeviceMemory dstImageMemory;
+    MemoryAllocation dstImageMemory;
     VkMemoryRequirements memRequirements;
 
     std::chrono::high_resolution_clock::time_point startTime;
@@ -378,26 +701,50 @@ public:
     static double lastXPos, lastYPos;
     bool animationPlay = false;
 
+    // render-on-demand: only draw when input, animation or a timed effect needs it
+    bool renderOnDemand = false;
+    bool frameRequested = true;         // set by input callbacks, the first frame is always drawn
+    double nextTimedFrame = 0.0;        // glfwGetTime() of the next cloud frame
+
     std::unordered_map<int, int> meshInnerId2Offset;
-    std::vector<std::map<MaterialType, std::map<int, std::vector<cglm::Mat44f>>>> frame_material_meshInnerId2ModelMatrices; // this is used for drawing
+    std::vector<MeshPushConstants> meshInnerId2PushConstants;
+    std::vector<FrameDrawList> frameDrawLists;      // this is used for drawing, one per frame in flight
+
+    // parallel command recording, recordThreads > 1 turns it on
+    int recordThreads = 1;
+    std::vector<std::vector<RecordThreadContext>> recordThreadContexts;    // [frame * recordImageSlots + image][thread]
+    std::vector<RecordTask> recordTasks;
+    double recordTimeAccum = 0.0;
+    int recordTimeFrames = 0;
+
+    // command buffer cache, [frame][swapchain image], re-recorded only when recordStateVersion moves
+    std::vector<std::vector<VkCommandBuffer>> cachedCommandBuffers;
+    std::vector<std::vector<uint64_t>> cachedCommandVersions;      // 0 = never recorded / invalidated
+    RecordState recordedState;
+    uint64_t recordStateVersion = 1;
+    uint64_t pipelineVersion = 0;
+    size_t recordImageSlots = 1;
 
     // interfaces
     void initWindow();
     void initVulkan();
     void initHeadlessVulkan();
     void mainLoop();
+    bool waitForFrameRequest();
     void cleanup();
     void headlessCleanup();
     void loadCheck();
 
     static void mouse_control_callback(GLFWwindow* window, int button, int action, int mods);
     static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+    static void windowRefreshCallback(GLFWwindow* window);
     static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos);
     static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
     static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
     // =================== inner functions ===================
     void setup_frame_instances(double inTime);
     void dfs_instance(int node_id, int currentFrame, cglm::Mat44f parent_transform);
+    void buildFrameDrawList(int currentFrame);
     void saveImage(std::string filename);
     void createDstImage();
     void copyToDstImage();
@@ -406,7 +753,7 @@ public:
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
 
     void createInstance();
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory);
 
     // depth management
     void createDepthResources();
@@ -434,6 +781,7 @@ public:
     void lightSetup();
     void createLightResources();
     void createShadowDescriptorSetLayout();
+    void createShadowRenderPasses();
     void createShadowGraphicsPipeline();
     void createLightFrameBuffers();
     void createLightImagewithViews();
@@ -444,9 +792,29 @@ public:
     void updateLightUniformBuffer(uint32_t currentImage, int idx, int light_id);
     void updateWholeLightUniformBuffer(uint32_t currentImage, LightUniformBufferObject& lubo);
     void updateCurLightUBOIndex(uint32_t currentFrame, int idx, LightUniformBufferObject& lubo);
-    void singleShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int light_id);
-    void singleCubeShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int light_id);
+    void singleShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id);
+    void singleCubeShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id, uint32_t faces);
+    void singleSunShadowRenderPass(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id, uint32_t cascades);
+    void beginShadowRenderPass(VkCommandBuffer commandBuffer, VkFramebuffer framebuffer, bool cube, int light_id, VkSubpassContents contents);
+    cglm::Mat44f fitShadowProjection(const cglm::Vec3f& position, float fovy, float limit);
+    void updateCubeFaceMasks(int idx, const cglm::Vec3f& position, float limit, LightUniformBufferObject& lubo);
+    void updateLightBudget();
+    void packShadowAtlas();
+    void updateShadowCache(const LightUniformBufferObject& lubo);
+    void buildShadowDrawLists();
+    void recordShadowAtlas(VkCommandBuffer commandBuffer);
+    void recordShadowView(VkCommandBuffer commandBuffer, int spot_idx, int sphere_idx, int sun_idx, int light_id, int face);
     void cleanShadowResources();
+    void createClusterBuffers();
+    void updateLightClusters(uint32_t currentImage);
+    void cleanClusterResources();
+    bool usesShadowMoments(const sconfig::Light& light) const;
+    void createShadowMoments();
+    void recordShadowMoments(VkCommandBuffer commandBuffer);
+    void cleanShadowMomentResources();
+    void createSunCascades();
+    void updateSunCascades(int idx, const sconfig::Light& light, LightUniformBufferObject& lubo);
+    void cleanSunCascadeResources();
 
     // texture
     void createTextureImage();
@@ -454,25 +822,44 @@ public:
     void createTextureImageView();
     void createTextureSampler();
     void texturePrepare();
+    int registerTexture(const std::string& file_name, TextureType type);
+    void createMaterialBuffer();
     void createTextureImagesWithViews();
-    void createTextureImage2D(const std::string& file_name, int idx);
-    void createTextureImageCube(const std::string& file_name, int idx);
+    void createTextureImage2D(const uint8_t* pixels, int texWidth, int texHeight, int idx);
+    void createTextureImageCube(const uint8_t* pixels, int texWidth, int idx);
+    bool compressedTextureSupported(VkFormat format);
+    void createCompressedTexture(const std::vector<uint8_t>& file, const Ktx2Texture& ktx, bool cube, int idx);
 
     // Uniform buffer
     void createDescriptorSetLayout();
     void createUniformBuffers();
     void updateUniformBuffer(uint32_t currentImage);
+    void markInstanceRingDirty(uint32_t currentImage, VkDeviceSize offset, VkDeviceSize size);
+    void flushInstanceRing();
     void createDescriptorPool();
     void createDescriptorSets();
 
     // vertexbuffer
     void createVertexBuffer();
     void createIndexBuffer();
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void copyVertexToBuffer();
+    VkMemoryPropertyFlags staticBufferMemoryProperties();
+    void queueBufferUpload(const void* data, VkDeviceSize size, VkBuffer dst, const MemoryAllocation& dstMemory);
+    void flushBufferUploads();
+
     void copyAllMeshVertexToBuffer();
 
+    // upload engine
+    void createUploadEngine();
+    void destroyUploadEngine();
+    void uploadImage(VkImage image, const void* data, VkDeviceSize size, VkExtent3D extent, uint32_t layerCount);
+    void uploadImageRegions(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions, uint32_t mipLevels, uint32_t layerCount);
+    void uploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+    void submitUploads();
+    void waitUploads();
+    UploadBatch& beginUploadBatch(VkDeviceSize size);
+    void stageUploadData(UploadBatch& batch, const void* data, VkDeviceSize size, VkBuffer& srcBuffer, VkDeviceSize& srcOffset);
+
     // framebuffer
     void createFramebuffers();
     void createHeadlessFramebuffers();
@@ -482,25 +869,38 @@ public:
     void createCommandBuffers();
     void createHeadlessCommandBuffers();
     void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void updateFrameUniforms();
+    void recordFrameCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    uint64_t currentRecordStateVersion();
+    void recordCommandBufferSerial(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void recordCommandBufferParallel(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void beginMainRenderPass(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkSubpassContents contents);
+    void mainPassViewport(VkViewport& viewport, VkRect2D& scissor);
+    void recordMaterialDraws(VkCommandBuffer commandBuffer, size_t firstBatch, size_t lastBatch);
+    void recordCloudDraws(VkCommandBuffer commandBuffer);
+    void createRecordThreadPools(uint32_t queueFamily);
+    void destroyRecordThreadPools();
+    VkCommandBuffer beginSecondaryCommandBuffer(int thread, uint32_t imageIndex, VkRenderPass pass, VkFramebuffer framebuffer);
+    void reportRecordTime(double ms);
     void recordHeadlessCommandBuffer(VkCommandBuffer commandBuffer);
     void drawFrame();
     void drawHeadlessFrame();
     void createSyncObjects();
-    void frameRealDraw(VkCommandBuffer commandBuffer, int& currentInstanceIdx, const std::map<int, std::vector<cglm::Mat44f>>& meshInnerId2ModelMatrices);
+    void frameRealDraw(VkCommandBuffer commandBuffer, const std::vector<DrawBatch>& batches, size_t firstBatch, size_t lastBatch, VkPipelineLayout layout, VkShaderStageFlags pushStages, uint32_t pushOffset, uint32_t pushSize);
     void headlessFrameFetch();
 
     // graphics pipeline
     void createGraphicsPipeline(MaterialType mt);
     void createGraphicsPipelines();
     VkShaderModule createShaderModule(const std::vector<char>& code);
-    void createRenderPass(VkFormat format, VkRenderPass& pRenderpass, VkImageLayout colorFinalLayout);
+    void createRenderPass(VkFormat format, VkRenderPass& pRenderpass, VkImageLayout colorFinalLayout, uint32_t viewMask = 0);
     void createHeadlessRenderPass();
 
     // image views
     void createImageViews();
-    VkImageView createImageView2D(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
-    VkImageView createImageViewCube(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
-    void createImage(uint32_t width, uint32_t height, VkImageCreateFlags flags, VkImageType imageType, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, int layers);
+    VkImageView createImageView2D(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1);
+    VkImageView createImageViewCube(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1);
+    void createImage(uint32_t width, uint32_t height, VkImageCreateFlags flags, VkImageType imageType, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, int layers, uint32_t mipLevels = 1);
 
     // swap chain
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
@@ -519,6 +919,10 @@ public:
     // logic device
     void createLogicalDevice();
     void createHeadlessLogicalDevice();
+    void addMemoryBudgetExtension(std::vector<const char*>& extensions);
+    void enableMultiviewFeature(VkDeviceCreateInfo& createInfo, VkPhysicalDeviceMultiviewFeatures& multiviewFeatures);
+    void addDescriptorIndexingExtension(std::vector<const char*>& extensions);
+    void enableDescriptorIndexingFeature(VkDeviceCreateInfo& createInfo, VkPhysicalDeviceDescriptorIndexingFeaturesEXT& indexingFeatures);
 
     // physical device
     void pickPhysicalDevice();
@@ -0,0 +1,73 @@
+// soft spot shadows shared by the lambertian and simple materials. the including shader declares lubo, shadowMapSampler,
+// shadowDepthSampler, spotViewDepth, spotShadowUV and NONUNIFORM before including this
+
+// sample budget of the poisson pcss, specialized from --shadow-samples
+layout(constant_id = 1) const int SHADOW_SAMPLES = 16;
+const int MAX_SHADOW_SAMPLES = 64;
+
+// poisson disk in the unit disk, built one farthest point at a time so every prefix is spread as well
+const vec2 POISSON_DISK[MAX_SHADOW_SAMPLES] = vec2[](
+    vec2(0.3320, 0.4622), vec2(-0.5448, -0.8267), vec2(-0.8835, 0.2925), vec2(0.7022, -0.5714),
+    vec2(-0.2130, -0.0962), vec2(-0.2493, 0.9536), vec2(0.9733, 0.2119), vec2(0.0747, -0.9626),
+    vec2(-0.9047, -0.3027), vec2(0.4269, -0.1201), vec2(-0.3165, 0.4256), vec2(0.2706, 0.9468),
+    vec2(0.7276, 0.6757), vec2(0.1422, -0.4901), vec2(0.9720, -0.2346), vec2(-0.6563, 0.7187),
+    vec2(-0.6256, -0.0145), vec2(-0.3821, -0.4570), vec2(0.0839, 0.1556), vec2(0.4020, -0.7791),
+    vec2(-0.0087, 0.6689), vec2(0.6273, 0.2053), vec2(-0.2055, -0.7649), vec2(-0.6861, -0.5319),
+    vec2(0.1109, -0.1737), vec2(0.7282, -0.0728), vec2(-0.9859, -0.0158), vec2(0.4366, -0.4319),
+    vec2(-0.5761, 0.2814), vec2(0.4529, 0.7220), vec2(-0.1134, -0.3870), vec2(-0.3738, 0.6957),
+    vec2(0.3522, 0.1887), vec2(-0.5966, -0.2782), vec2(-0.1871, 0.1847), vec2(0.8182, 0.4194),
+    vec2(0.0105, 0.9902), vec2(0.0457, 0.4145), vec2(0.6868, -0.3259), vec2(-0.7257, 0.4827),
+    vec2(0.5785, 0.4547), vec2(0.0212, -0.7048), vec2(-0.4078, 0.1162), vec2(0.2189, 0.7287),
+    vec2(0.9405, -0.0171), vec2(-0.1724, -0.9810), vec2(0.6286, -0.7732), vec2(0.8775, -0.4377),
+    vec2(-0.4278, -0.1273), vec2(0.2456, 0.0001), vec2(-0.7973, 0.1027), vec2(-0.5239, 0.5249),
+    vec2(0.2896, -0.9570), vec2(-0.5001, 0.8648), vec2(-0.3836, -0.6665), vec2(0.2666, -0.3094),
+    vec2(0.2222, -0.6725), vec2(-0.8070, -0.1093), vec2(-0.3592, -0.9063), vec2(-0.0287, -0.0197),
+    vec2(-0.1992, 0.5858), vec2(-0.2841, -0.2753), vec2(0.7972, 0.1198), vec2(-0.1757, 0.7798)
+);
+
+// rotates the disk per pixel, interleaved gradient noise turns banding into fine grain
+mat2 poissonRotation() {
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    float s = sin(angle);
+    float c = cos(angle);
+    return mat2(c, s, -s, c);
+}
+
+// pcss with a fixed sample budget. the blocker search takes half of SHADOW_SAMPLES over blockerRadius texels and
+// stops when every sample agrees, the filter spreads up to SHADOW_SAMPLES taps over the estimated penumbra and
+// takes fewer when the penumbra covers fewer texels
+float spotPCSS(int shadowIdx, mat4 proj, vec2 uv, float receiverDepth, float compareDepth, float lightRadius, float halfFov,
+               float blockerRadius, float penumbraScale, float maxRadius) {
+    int shadowSlot = int(lubo.metadata2[shadowIdx].x);
+    float shadowMapSize = lubo.metadata2[shadowIdx].w;
+    mat2 rotation = poissonRotation();
+
+    int blockerSamples = clamp(SHADOW_SAMPLES / 2, 4, MAX_SHADOW_SAMPLES);
+    int blockers = 0;
+    float avgDepth = 0.0;
+    for (int i = 0; i < blockerSamples; i++) {
+        vec2 offset = rotation * POISSON_DISK[i] * (blockerRadius / shadowMapSize);
+        float storedDepth = spotViewDepth(proj, texture(shadowDepthSampler[NONUNIFORM(shadowSlot)], spotShadowUV(shadowIdx, uv + offset)).r);
+        if (storedDepth < receiverDepth) {
+            avgDepth += storedDepth;
+            ++blockers;
+        }
+    }
+    if (blockers == 0) {
+        return 1.0;
+    }
+    if (blockers == blockerSamples) {
+        return 0.0;
+    }
+    avgDepth /= float(blockers);
+
+    float w = shadowMapSize * lightRadius * (receiverDepth - avgDepth) / avgDepth / (receiverDepth * tan(halfFov));
+    float radius = clamp(w * penumbraScale, 1.0, maxRadius);
+    int samples = clamp(int(3.1415926 * radius * radius), min(8, SHADOW_SAMPLES), SHADOW_SAMPLES);
+    float lit = 0.0;
+    for (int i = 0; i < samples; i++) {
+        vec2 offset = rotation * POISSON_DISK[i] * (radius / shadowMapSize);
+        lit += texture(shadowMapSampler[NONUNIFORM(shadowSlot)], vec3(spotShadowUV(shadowIdx, uv + offset), compareDepth));
+    }
+    return lit / float(samples);
+}
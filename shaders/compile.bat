@@ -3,18 +3,23 @@ D:\STUDY\Vulkan\Bin\glslc.exe env\shader.env.frag -o env\frag.spv
 
 D:\STUDY\Vulkan\Bin\glslc.exe simple\shader.simple.vert -o simple\vert.spv
 D:\STUDY\Vulkan\Bin\glslc.exe simple\shader.simple.frag -o simple\frag.spv
+D:\STUDY\Vulkan\Bin\glslc.exe -DNONUNIFORM_INDEXING simple\shader.simple.frag -o simple\frag_nonuniform.spv
 
 D:\STUDY\Vulkan\Bin\glslc.exe mirror\shader.mirror.vert -o mirror\vert.spv
 D:\STUDY\Vulkan\Bin\glslc.exe mirror\shader.mirror.frag -o mirror\frag.spv
 
 D:\STUDY\Vulkan\Bin\glslc.exe lambertian\shader.lambertian.vert -o lambertian\vert.spv
 D:\STUDY\Vulkan\Bin\glslc.exe lambertian\shader.lambertian.frag -o lambertian\frag.spv
+D:\STUDY\Vulkan\Bin\glslc.exe -DNONUNIFORM_INDEXING lambertian\shader.lambertian.frag -o lambertian\frag_nonuniform.spv
 
 D:\STUDY\Vulkan\Bin\glslc.exe pbr\shader.pbr.vert -o pbr\vert.spv
 D:\STUDY\Vulkan\Bin\glslc.exe pbr\shader.pbr.frag -o pbr\frag.spv
+D:\STUDY\Vulkan\Bin\glslc.exe -DNONUNIFORM_INDEXING pbr\shader.pbr.frag -o pbr\frag_nonuniform.spv
 
 D:\STUDY\Vulkan\Bin\glslc.exe shadow\shader.shadow.vert -o shadow\vert.spv
+D:\STUDY\Vulkan\Bin\glslc.exe -DMULTIVIEW shadow\shader.shadow.vert -o shadow\vert_multiview.spv
 D:\STUDY\Vulkan\Bin\glslc.exe shadow\shader.shadow.frag -o shadow\frag.spv
+D:\STUDY\Vulkan\Bin\glslc.exe shadow\shader.moments.comp -o shadow\moments.spv
 
 D:\STUDY\Vulkan\Bin\glslc.exe cloud\shader.cloud.vert -o cloud\vert.spv
 D:\STUDY\Vulkan\Bin\glslc.exe cloud\shader.cloud.frag -o cloud\frag.spv
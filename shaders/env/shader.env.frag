@@ -5,15 +5,33 @@ const int MAX_INSTANCE = 32;
 layout(binding = 1) uniform sampler2D tex2DSampler[MAX_INSTANCE];
 layout(binding = 2) uniform samplerCube texCubeSampler[MAX_INSTANCE];
 
-struct InputBlock {
-    int inNormalMapIdx;
-    int textForm[2];
-    mat4 inNormalMatrix;
+// per material values, the draw pushes its slot. only the normal map is read here
+const int MATERIAL_NORMAL_XY = 16;
+
+struct MaterialParams {
+    vec4 albedo;
+    float roughness;
+    float metalness;
+    int flags;
+    int normalMap;
+    int albedoTexture;
+    int roughnessTexture;
+    int metalnessTexture;
+    int pad;
 };
 
+layout(std430, binding = 6) readonly buffer MaterialBuffer {
+    MaterialParams params[];
+} materials;
+
+layout(push_constant) uniform MaterialPush {
+    vec4 positionScale;     // compact positions are relative to the mesh bounds
+    vec4 positionOffset;
+    int materialIdx;
+} pc;
+
 layout(location = 0) in vec3 fragNormal;
 layout(location = 1) in vec2 fragTexCoord;
-layout(location = 2) flat in InputBlock inputData;
 
 
 layout(location = 0) out vec4 outColor;
@@ -38,14 +56,19 @@ vec3 decodeRGBE(vec4 rgbe)
 }
 
 void main() {
+    MaterialParams material = materials.params[pc.materialIdx];
 
     vec3 rNormal = normalize(fragNormal);
 
-    if (inputData.inNormalMapIdx != -1) {
-        vec4 mNormal = texture(tex2DSampler[inputData.inNormalMapIdx], fragTexCoord);
+    if (material.normalMap != -1) {
+        vec4 mNormal = texture(tex2DSampler[material.normalMap], fragTexCoord);
         rNormal = mNormal.rgb;
         rNormal -= 0.5f;
         rNormal = rNormal * 2.0f;
+        if ((material.flags & MATERIAL_NORMAL_XY) != 0) {
+            // bc5 keeps x and y only, z comes from the unit length
+            rNormal.z = sqrt(max(1.0f - dot(rNormal.xy, rNormal.xy), 0.0f));
+        }
     }
 
     vec4 rgbeColor = texture(texCubeSampler[0], rNormal);
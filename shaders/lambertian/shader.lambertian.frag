@@ -1,7 +1,18 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+// shadow samplers are indexed by the cluster's lights, which differ between neighbouring fragments.
+// frag_nonuniform.spv is built with NONUNIFORM_INDEXING for devices with non uniform sampled image indexing
+#ifdef NONUNIFORM_INDEXING
+#extension GL_EXT_nonuniform_qualifier : require
+#define NONUNIFORM(i) nonuniformEXT(i)
+#else
+#define NONUNIFORM(i) (i)
+#endif
 
 const int MAX_INSTANCE = 32;
 const int MAX_LIGHT = 8;
+const int SUN_CASCADES = 4;
 
 const float BIAS = 0;
 
@@ -22,16 +33,78 @@ layout(binding = 3) uniform LightUniformBufferObject {
 
     vec4 metadata1[MAX_LIGHT];  // radius - fov/2 - limit - blend
     vec4 metadata2[MAX_LIGHT];
+    vec4 shadowRects[MAX_LIGHT];      // spot tile (offset, scale) in the shadow atlas
+    mat4 cascadeMatrices[MAX_LIGHT * SUN_CASCADES];     // proj * view of every sun cascade
 } lubo;
 
-layout(binding = 4) uniform sampler2D shadowMapSampler[MAX_LIGHT];
+layout(binding = 4) uniform sampler2DShadow shadowMapSampler[MAX_LIGHT];
 layout(binding = 5) uniform samplerCube shadowCubeMapSampler[MAX_LIGHT];
+layout(binding = 7) uniform sampler2D shadowDepthSampler[MAX_LIGHT];       // same maps, no compare
+layout(binding = 10) uniform sampler2D shadowMomentSampler[MAX_LIGHT];        // evsm lights, by lubo slot
+layout(binding = 11) uniform samplerCube shadowMomentCubeSampler[MAX_LIGHT];
+layout(binding = 12) uniform sampler2DArrayShadow sunCascadeSampler;      // SUN_CASCADES layers per sun
+
+// every light in the scene, suns first then shadow casters. color.a is the light's slot in lubo, -1 without shadows
+struct ClusterLight {
+    vec4 position;      // xyz, w is the type
+    vec4 direction;     // xyz, w is the power
+    vec4 color;
+    vec4 metadata;      // radius - fov/2 - limit - blend for spots, radius - limit for spheres, angle for suns
+};
+
+layout(std430, binding = 8) readonly buffer LightBuffer {
+    ClusterLight lights[];
+} sceneLights;
+
+// froxel grid over the main viewport, depth slices are logarithmic between the camera's near and far
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 9;
+const int CLUSTER_Z = 24;
+
+layout(std430, binding = 9) readonly buffer ClusterBuffer {
+    vec4 viewport;      // x, y, 1 / width, 1 / height
+    vec4 cameraPos;     // w is near
+    vec4 cameraDir;     // w is far
+    uvec4 lightCounts;  // x is the number of suns leading the light buffer
+    uvec2 ranges[CLUSTER_X * CLUSTER_Y * CLUSTER_Z];     // (first, count) in indices
+    uint indices[];
+} clusters;
+
+// per material values, the draw pushes its slot
+const int MATERIAL_CONST_ALBEDO = 1;
+const int MATERIAL_CONST_ROUGHNESS = 2;
+const int MATERIAL_CONST_METALNESS = 4;
+const int MATERIAL_ALBEDO_CUBE = 8;
+const int MATERIAL_NORMAL_XY = 16;
+const int MATERIAL_LINEAR_NORMAL = 32;
+const int MATERIAL_LINEAR_ROUGHNESS = 64;
+const int MATERIAL_LINEAR_METALNESS = 128;
+
+struct MaterialParams {
+    vec4 albedo;
+    float roughness;
+    float metalness;
+    int flags;
+    int normalMap;
+    int albedoTexture;
+    int roughnessTexture;
+    int metalnessTexture;
+    int pad;
+};
+
+layout(std430, binding = 6) readonly buffer MaterialBuffer {
+    MaterialParams params[];
+} materials;
+
+layout(push_constant) uniform MaterialPush {
+    vec4 positionScale;     // compact positions are relative to the mesh bounds
+    vec4 positionOffset;
+    int materialIdx;
+} pc;
 
 
 struct InputBlock {
-    int inNormalMapIdx;
-    int textForm[2];
-    mat4 inNormalMatrix;
+    mat3 inNormalMatrix;
 };
 
 layout(location = 0) in vec3 fragNormal;
@@ -42,6 +115,123 @@ layout(location = 3) flat in InputBlock inputData;
 layout(location = 0) out vec4 outColor;
 
 
+// spot maps hold [0, 1] depth from lightProjMatrix, convert to and from view depth
+float spotViewDepth(mat4 proj, float depth) {
+    return proj[3][2] / (depth + proj[2][2]);
+}
+
+float spotShadowDepth(mat4 proj, float viewDepth) {
+    return -proj[2][2] + proj[3][2] / viewDepth;
+}
+
+// spot map uv into the light's tile, clamped half a texel inside so filtering never reads a neighbouring tile
+vec2 spotShadowUV(int shadowIdx, vec2 uv) {
+    float size = lubo.metadata2[shadowIdx].w;
+    vec4 rect = lubo.shadowRects[shadowIdx];
+    return rect.xy + clamp(uv, vec2(0.5 / size), vec2(1.0 - 0.5 / size)) * rect.zw;
+}
+
+#include "../common/pcss.glsl"
+
+// evsm warp exponents, keep in sync with shadow/shader.moments.comp
+const float EVSM_POSITIVE = 40.0;
+const float EVSM_NEGATIVE = 5.0;
+const float EVSM_BLEED = 0.2;       // tail of the chebyshev bound cut off against light bleeding
+
+// screen space change of the world position, taken in uniform control flow so the moment maps can be sampled
+// with textureGrad inside the light loop, whose lights differ between neighbouring clusters
+vec3 worldDx;
+vec3 worldDy;
+
+// chebyshev upper bound on the lit fraction for one warped pair
+float chebyshevBound(vec2 moments, float warped, float minVariance) {
+    if (warped <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float delta = warped - moments.x;
+    float pMax = variance / (variance + delta * delta);
+    return clamp((pMax - EVSM_BLEED) / (1.0 - EVSM_BLEED), 0.0, 1.0);
+}
+
+// lit fraction from prefiltered moments, distance is over the light's limit like the moment maps
+float evsmVisibility(vec4 moments, float distance) {
+    float d = 2.0 * clamp(distance, 0.0, 1.0) - 1.0;
+    float positive = exp(EVSM_POSITIVE * d);
+    float negative = -exp(-EVSM_NEGATIVE * d);
+    float positiveScale = 0.005 * EVSM_POSITIVE * positive;
+    float negativeScale = 0.005 * EVSM_NEGATIVE * negative;
+    return min(chebyshevBound(moments.xy, positive, positiveScale * positiveScale),
+        chebyshevBound(moments.zw, negative, negativeScale * negativeScale));
+}
+
+// spot map uv of a world position
+vec2 spotMapUV(mat4 viewProj, vec3 pos) {
+    vec4 clip = viewProj * vec4(pos, 1.0);
+    return (clip.xy / clip.w + 1.0) / 2.0;
+}
+
+// share of a cascade's depth range over which it fades into the next one
+const float CASCADE_BLEND = 0.1;
+
+// lit fraction from one sun cascade. the receiver is pushed along its normal by about a texel, more on slopes,
+// then a rotated poisson pcf over 1.5 texels
+float sunCascadeVisibility(int shadowIdx, int cascade, vec3 normal, vec3 sunDir) {
+    mat4 cascadeMat = lubo.cascadeMatrices[shadowIdx * SUN_CASCADES + cascade];
+    float shadowMapSize = lubo.metadata2[shadowIdx].w;
+    float texelWorld = 2.0 / (length(vec3(cascadeMat[0][0], cascadeMat[1][0], cascadeMat[2][0])) * shadowMapSize);
+    float cosTheta = clamp(dot(normal, -sunDir), 0.05, 1.0);
+    float slope = min(sqrt(1.0 - cosTheta * cosTheta) / cosTheta, 4.0);
+
+    vec4 clip = cascadeMat * vec4(fragWorldPos + normal * texelWorld * (0.5 + 1.5 * slope), 1.0);
+    vec2 uv = clip.xy * 0.5 + 0.5;
+    float layer = lubo.metadata2[shadowIdx].x * SUN_CASCADES + cascade;
+    float compareDepth = clip.z - 0.0005;
+
+    mat2 rotation = poissonRotation();
+    int samples = min(SHADOW_SAMPLES, 16);
+    float lit = 0.0;
+    for (int i = 0; i < samples; i++) {
+        vec2 offset = rotation * POISSON_DISK[i] * (1.5 / shadowMapSize);
+        lit += texture(sunCascadeSampler, vec4(uv + offset, layer, compareDepth));
+    }
+    return lit / float(samples);
+}
+
+// picks the cascade by view depth against the split depths in metadata1 and fades into the next one near the far
+// end of each, past the last cascade everything is lit
+float sunVisibility(int shadowIdx, vec3 normal, vec3 sunDir) {
+    float viewDepth = dot(fragWorldPos - clusters.cameraPos.xyz, clusters.cameraDir.xyz);
+    vec4 splits = lubo.metadata1[shadowIdx];
+    float splitNear = clusters.cameraPos.w;
+    for (int c = 0; c < SUN_CASCADES; c++) {
+        float splitFar = splits[c];
+        if (viewDepth <= splitFar) {
+            float visibility = sunCascadeVisibility(shadowIdx, c, normal, sunDir);
+            float fade = (splitFar - viewDepth) / ((splitFar - splitNear) * CASCADE_BLEND);
+            if (fade < 1.0) {
+                float next = c + 1 < SUN_CASCADES ? sunCascadeVisibility(shadowIdx, c + 1, normal, sunDir) : 1.0;
+                visibility = mix(next, visibility, fade);
+            }
+            return visibility;
+        }
+        splitNear = splitFar;
+    }
+    return 1.0;
+}
+
+// the lights binned into the cluster this fragment falls in
+uvec2 clusterRange(vec3 pos) {
+    vec2 screen = (gl_FragCoord.xy - clusters.viewport.xy) * clusters.viewport.zw;
+    float zNear = clusters.cameraPos.w;
+    float zFar = clusters.cameraDir.w;
+    float depth = max(dot(pos - clusters.cameraPos.xyz, clusters.cameraDir.xyz), zNear);
+    int x = clamp(int(screen.x * CLUSTER_X), 0, CLUSTER_X - 1);
+    int y = clamp(int(screen.y * CLUSTER_Y), 0, CLUSTER_Y - 1);
+    int z = clamp(int(log(depth / zNear) / log(zFar / zNear) * CLUSTER_Z), 0, CLUSTER_Z - 1);
+    return clusters.ranges[(z * CLUSTER_Y + y) * CLUSTER_X + x];
+}
+
 float linear_to_srgb(float x) {
     if (x <= 0.0031308) {
 		return x * 12.92;
@@ -64,11 +254,15 @@ vec3 decodeRGBE(vec4 rgbe)
     return res;
 }
 
-vec3 renderSphere(int lightIdx, int sphere_idx) {
-    vec3 curLightPos = lubo.lightPos[lightIdx].xyz;
-    float shadowMapSize = lubo.metadata2[lightIdx].w;
-    float limit = lubo.metadata1[lightIdx][1];
-    float power = lubo.lightDir[lightIdx].w;
+vec3 renderSphere(int lightIdx) {
+    // lubo slot of the light's shadow, clamped so unshadowed lights still index in bounds
+    int shadowIdx = int(sceneLights.lights[lightIdx].color.a);
+    bool shadowed = shadowIdx >= 0;
+    shadowIdx = max(shadowIdx, 0);
+    vec3 curLightPos = sceneLights.lights[lightIdx].position.xyz;
+    float shadowMapSize = lubo.metadata2[shadowIdx].w;
+    float limit = sceneLights.lights[lightIdx].metadata[1];
+    float power = sceneLights.lights[lightIdx].direction.w;
 
     if (limit < 5.0) {
         return vec3(0.0, 0.0, 0.0);
@@ -77,35 +271,59 @@ vec3 renderSphere(int lightIdx, int sphere_idx) {
     vec3 ptr = fragWorldPos - curLightPos;
 
     float curDistance = length(ptr);
-    float storedDepth = texture(shadowCubeMapSampler[sphere_idx], normalize(ptr)).r * limit;
-
-    if (curDistance > storedDepth) {
-        return vec3(0.0, 0.0, 0.0);
+    float visibility = 1.0;
+    if (shadowed && lubo.metadata2[shadowIdx].y > 0.5) {
+        vec4 moments = textureGrad(shadowMomentCubeSampler[NONUNIFORM(shadowIdx)], ptr, worldDx, worldDy);
+        visibility = evsmVisibility(moments, curDistance / limit);
+    }
+    else if (shadowed) {
+        float storedDepth = texture(shadowCubeMapSampler[NONUNIFORM(int(lubo.metadata2[shadowIdx].x))], normalize(ptr)).r * limit;
+        if (curDistance > storedDepth) {
+            return vec3(0.0, 0.0, 0.0);
+        }
     }
 
     float NdotL = dot(fragNormal, normalize(-ptr));
-    vec3 lightColor = lubo.lightColor[lightIdx].xyz;
+    vec3 lightColor = sceneLights.lights[lightIdx].color.xyz;
 
     float dis_dec_factor = max(0, pow(1 - (curDistance / limit), 4));
     float normal_dec_factor = power / (4 * 3.1415926 * pow(curDistance, 2));
 
     dis_dec_factor *= normal_dec_factor;
-    float fct = dis_dec_factor * NdotL;
+    float fct = dis_dec_factor * NdotL * visibility;
 
     vec3 res = lightColor * vec3(fct, fct, fct);
     return res;
 }
 
 
-vec3 renderSpot(int lightIdx, int spot_idx) {
-    vec3 curLightPos = lubo.lightPos[lightIdx].xyz;
-    vec3 curLightDir = lubo.lightDir[lightIdx].xyz;
-    mat4 curViewMat = lubo.lightViewMatrix[lightIdx];   
-    mat4 curProjMat = lubo.lightProjMatrix[lightIdx];
-    float halfFov = lubo.metadata1[lightIdx][1];
-    float shadowMapSize = lubo.metadata2[lightIdx].w;
-    float lightRadius = lubo.metadata1[lightIdx][0];
-    float limit = lubo.metadata1[lightIdx][2];
+vec3 renderSun(int lightIdx) {
+    int shadowIdx = int(sceneLights.lights[lightIdx].color.a);
+    vec3 sunDir = sceneLights.lights[lightIdx].direction.xyz;
+    float strength = sceneLights.lights[lightIdx].direction.w;
+
+    float NdotL = dot(fragNormal, -sunDir);
+    if (NdotL <= 0.0) {
+        return vec3(0.0, 0.0, 0.0);
+    }
+
+    float visibility = shadowIdx >= 0 ? sunVisibility(shadowIdx, fragNormal, sunDir) : 1.0;
+    return sceneLights.lights[lightIdx].color.xyz * strength * NdotL * visibility;
+}
+
+
+vec3 renderSpot(int lightIdx) {
+    // lubo slot of the light's shadow, clamped so unshadowed lights still index in bounds
+    int shadowIdx = int(sceneLights.lights[lightIdx].color.a);
+    bool shadowed = shadowIdx >= 0;
+    shadowIdx = max(shadowIdx, 0);
+    vec3 curLightPos = sceneLights.lights[lightIdx].position.xyz;
+    vec3 curLightDir = sceneLights.lights[lightIdx].direction.xyz;
+    mat4 curViewMat = lubo.lightViewMatrix[shadowIdx];   
+    mat4 curProjMat = lubo.lightProjMatrix[shadowIdx];
+    float halfFov = sceneLights.lights[lightIdx].metadata[1];
+    float lightRadius = sceneLights.lights[lightIdx].metadata[0];
+    float limit = sceneLights.lights[lightIdx].metadata[2];
 
     if (limit < 5.0) {
         return vec3(0.0, 0.0, 0.0);
@@ -123,65 +341,20 @@ vec3 renderSpot(int lightIdx, int spot_idx) {
     float u = (frag_coord[0]/frag_coord[3] + 1.0) / 2.0;
     float v = (frag_coord[1]/frag_coord[3] + 1.0) / 2.0;
 
-    int diff = 3;
-    int tt_num = 0;
-    float avgDepth = 0.0;
-
-    float pcfVal = 0.0;
-
-    float centerDepth = texture(shadowMapSampler[spot_idx], vec2(u, v)).r * limit;
-    float frac1 = (curDistance - centerDepth) / centerDepth;
-    float w = shadowMapSize * lightRadius * frac1 / (curDistance * tan(halfFov));
-    int rw = int(w) / 2;
-    // rw = min(8, rw);
-    rw = 3;
-    // if (rw > 10) {
-    //     return vec3(1.0, 0.0, 0.0);
-    // }
-
-    for (int i=-rw; i<=rw; i++) {
-        for (int j=-rw; j<=rw; j++) {
-            float stored_pre_d = texture(shadowMapSampler[spot_idx], vec2(u+float(i)/shadowMapSize, v+float(j)/shadowMapSize)).r;
-            float storedDepth = stored_pre_d * limit;
-
-            if (storedDepth < curDistance) {
-                avgDepth += storedDepth;
-                ++tt_num;
-            }
-        }
+    float pcfVal = 1.0;
+    if (shadowed && lubo.metadata2[shadowIdx].y > 0.5) {
+        // evsm, the moment map covers the light's whole view
+        mat4 viewProj = curProjMat * curViewMat;
+        vec2 uv = vec2(u, v);
+        vec4 moments = textureGrad(shadowMomentSampler[NONUNIFORM(shadowIdx)], uv,
+            spotMapUV(viewProj, fragWorldPos + worldDx) - uv, spotMapUV(viewProj, fragWorldPos + worldDy) - uv);
+        pcfVal = evsmVisibility(moments, frag_coord[3] / limit);
     }
-
-    avgDepth /= float(tt_num);
-
-    if (tt_num == 0) {
-        pcfVal = 1.0;
-    }
-    else {
-        float frac1 = (curDistance - avgDepth) / avgDepth;
-        float w = shadowMapSize * lightRadius * frac1 / (curDistance * tan(halfFov));
-        int rw = int(w) / 2;
-
-        // LIMIT this value if too slow for larger values
-        rw = min(30, rw);
-
-        tt_num = 0;
-        for (int i=-rw; i<=rw; i++) {
-            for (int j=-rw; j<=rw; j++) {
-                float stored_pre_d = texture(shadowMapSampler[spot_idx], vec2(u+float(i)/shadowMapSize, v+float(j)/shadowMapSize)).r;
-                float storedDepth = stored_pre_d * limit;
-
-                if (curDistance - 0.1 <= storedDepth) {
-                    pcfVal += 1.0;
-                }
-                tt_num++;
-            }
-        }
-        pcfVal /= float(tt_num);
-
-        /* !!!!!!!!!!!!!!!!!!!!!! TRICKY !!!!!!!!!!!!!!!!!!!!!! */
-        pcfVal /= 0.4;
-        pcfVal = min(1.0, pcfVal);
-        ////////////////////////////////////// comment these two for normal results
+    else if (shadowed) {
+        // blocker search and penumbra in light view depth
+        float receiverDepth = frag_coord[3] - BIAS;
+        float compareDepth = spotShadowDepth(curProjMat, receiverDepth - 0.1);
+        pcfVal = spotPCSS(shadowIdx, curProjMat, vec2(u, v), receiverDepth, compareDepth, lightRadius, halfFov, 3.0, 0.5, 30.0);
     }
 
     // if (pcfVal > 0.4) {
@@ -194,7 +367,7 @@ vec3 renderSpot(int lightIdx, int spot_idx) {
 
     vec3 res = vec3(pcfVal, pcfVal, pcfVal);
 
-    float blend = lubo.metadata1[lightIdx][3];
+    float blend = sceneLights.lights[lightIdx].metadata[3];
     float edge = halfFov*(1-blend);
     if (viewAngle > edge) {
         float px = viewAngle - edge;
@@ -205,28 +378,40 @@ vec3 renderSpot(int lightIdx, int spot_idx) {
     }
 
     float dis_dec_factor = max(0, pow(1 - (curDistance / limit), 4));
-    float normal_dec_factor = lubo.lightDir[lightIdx].w / (4 * 3.1415926 * pow(curDistance, 2));
+    float normal_dec_factor = sceneLights.lights[lightIdx].direction.w / (4 * 3.1415926 * pow(curDistance, 2));
     dis_dec_factor *= normal_dec_factor;
     vec3 fct = vec3(dis_dec_factor, dis_dec_factor, dis_dec_factor);
 
-    res *= fct * lubo.lightColor[lightIdx].xyz;
+    res *= fct * sceneLights.lights[lightIdx].color.xyz;
 
     return res;
 }
 
 
 void main() {
+    MaterialParams material = materials.params[pc.materialIdx];
 
     vec3 rNormal = fragNormal;
 
-    if (inputData.inNormalMapIdx != -1) {
-        vec4 mNormal = texture(tex2DSampler[inputData.inNormalMapIdx], fragTexCoord);
-        rNormal.r = linear_to_srgb(mNormal.r);
-        rNormal.g = linear_to_srgb(mNormal.g);
-        rNormal.b = linear_to_srgb(mNormal.b);
-        rNormal -= 0.5f;
-        rNormal = rNormal * 2.0f;
-        rNormal = mat3(inputData.inNormalMatrix) * rNormal;
+    if (material.normalMap != -1) {
+        vec4 mNormal = texture(tex2DSampler[material.normalMap], fragTexCoord);
+        if ((material.flags & MATERIAL_NORMAL_XY) != 0) {
+            // bc5 is linear and keeps x and y only, z comes from the unit length
+            rNormal.xy = mNormal.rg * 2.0f - 1.0f;
+            rNormal.z = sqrt(max(1.0f - dot(rNormal.xy, rNormal.xy), 0.0f));
+        }
+        else {
+            rNormal = mNormal.rgb;
+            if ((material.flags & MATERIAL_LINEAR_NORMAL) == 0) {
+                // srgb images are decoded by the sampler, the stored values are the normal
+                rNormal.r = linear_to_srgb(mNormal.r);
+                rNormal.g = linear_to_srgb(mNormal.g);
+                rNormal.b = linear_to_srgb(mNormal.b);
+            }
+            rNormal -= 0.5f;
+            rNormal = rNormal * 2.0f;
+        }
+        rNormal = inputData.inNormalMatrix * rNormal;
     }
 
     // cube - 0 is always environment; cube - 1 is always env-lambertian
@@ -235,39 +420,46 @@ void main() {
 
     // 2D texture
     vec3 baseColor;
-    if (inputData.textForm[0] == 0) {
-        vec4 rgbeColor = texture(tex2DSampler[inputData.textForm[1]], fragTexCoord);
+    if ((material.flags & MATERIAL_CONST_ALBEDO) != 0) {
+        baseColor = material.albedo.rgb;
+    }
+    else if ((material.flags & MATERIAL_ALBEDO_CUBE) == 0) {
+        vec4 rgbeColor = texture(tex2DSampler[material.albedoTexture], fragTexCoord);
         baseColor = rgbeColor.rgb;
     }
     else {
-        vec4 rgbeColor = texture(texCubeSampler[inputData.textForm[1]], rNormal);
+        vec4 rgbeColor = texture(texCubeSampler[material.albedoTexture], rNormal);
         baseColor = decodeRGBE(rgbeColor);
     }
 
     // outColor = vec4(0.0, 0.0, 0.0, 1.0);
     vec3 color = vec3(0.0, 0.0, 0.0);
     // after getting the base color, get light resources
-    int totalLightCount = int(lubo.metadata2[0][2]);
-    int sphere_idx = 0;
-    int spot_idx = 0;
+    uvec2 lightRange = clusterRange(fragWorldPos);
+    worldDx = dFdx(fragWorldPos);
+    worldDy = dFdy(fragWorldPos);
+
+    // suns reach every cluster
+    for (uint s = 0; s < clusters.lightCounts.x; s++) {
+        color += baseColor * renderSun(int(s));
+    }
 
-    for (int lightIdx = 0; lightIdx < totalLightCount; lightIdx++) {
-        int lightType = int(lubo.lightPos[lightIdx].w);
+    for (uint k = 0; k < lightRange.y; k++) {
+        int lightIdx = int(clusters.indices[lightRange.x + k]);
+        int lightType = int(sceneLights.lights[lightIdx].position.w);
 
         // Spot Light
         if (lightType == 0) {
-            vec3 pLight = renderSpot(lightIdx, spot_idx);
+            vec3 pLight = renderSpot(lightIdx);
             // outColor += vec4(baseColor * pLight, 0.0);
             color += baseColor * pLight;
-            spot_idx++;
             // outColor = vec4(pLight, 1.0);
             continue;
 
         } else if (lightType == 1) {
-            vec3 pLight = renderSphere(lightIdx, sphere_idx);
+            vec3 pLight = renderSphere(lightIdx);
             color += baseColor * pLight;
             // outColor += vec4(baseColor * pLight, 0.0);
-            sphere_idx++;
             continue;
         }
 
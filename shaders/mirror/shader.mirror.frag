@@ -5,10 +5,34 @@ const int MAX_INSTANCE = 32;
 layout(binding = 1) uniform sampler2D tex2DSampler[MAX_INSTANCE];
 layout(binding = 2) uniform samplerCube texCubeSampler[MAX_INSTANCE];
 
+// per material values, the draw pushes its slot. only the normal map is read here
+const int MATERIAL_NORMAL_XY = 16;
+const int MATERIAL_LINEAR_NORMAL = 32;
+
+struct MaterialParams {
+    vec4 albedo;
+    float roughness;
+    float metalness;
+    int flags;
+    int normalMap;
+    int albedoTexture;
+    int roughnessTexture;
+    int metalnessTexture;
+    int pad;
+};
+
+layout(std430, binding = 6) readonly buffer MaterialBuffer {
+    MaterialParams params[];
+} materials;
+
+layout(push_constant) uniform MaterialPush {
+    vec4 positionScale;     // compact positions are relative to the mesh bounds
+    vec4 positionOffset;
+    int materialIdx;
+} pc;
+
 struct InputBlock {
-    int inNormalMapIdx;
-    int textForm[2];
-    mat4 inNormalMatrix;
+    mat3 inNormalMatrix;
     vec3 fragTrack;
 };
 
@@ -41,17 +65,29 @@ vec3 decodeRGBE(vec4 rgbe)
 
 
 void main() {
+    MaterialParams material = materials.params[pc.materialIdx];
 
     vec3 rNormal = fragNormal;
 
-    if (inputData.inNormalMapIdx != -1) {
-        vec4 mNormal = texture(tex2DSampler[inputData.inNormalMapIdx], fragTexCoord);
-        rNormal.r = linear_to_srgb(mNormal.r);
-        rNormal.g = linear_to_srgb(mNormal.g);
-        rNormal.b = linear_to_srgb(mNormal.b);
-        rNormal -= 0.5f;
-        rNormal = rNormal * 2.0f;
-        rNormal = mat3(inputData.inNormalMatrix) * rNormal;
+    if (material.normalMap != -1) {
+        vec4 mNormal = texture(tex2DSampler[material.normalMap], fragTexCoord);
+        if ((material.flags & MATERIAL_NORMAL_XY) != 0) {
+            // bc5 is linear and keeps x and y only, z comes from the unit length
+            rNormal.xy = mNormal.rg * 2.0f - 1.0f;
+            rNormal.z = sqrt(max(1.0f - dot(rNormal.xy, rNormal.xy), 0.0f));
+        }
+        else {
+            rNormal = mNormal.rgb;
+            if ((material.flags & MATERIAL_LINEAR_NORMAL) == 0) {
+                // srgb images are decoded by the sampler, the stored values are the normal
+                rNormal.r = linear_to_srgb(mNormal.r);
+                rNormal.g = linear_to_srgb(mNormal.g);
+                rNormal.b = linear_to_srgb(mNormal.b);
+            }
+            rNormal -= 0.5f;
+            rNormal = rNormal * 2.0f;
+        }
+        rNormal = inputData.inNormalMatrix * rNormal;
     }
 
     vec3 ref_dir = reflect(inputData.fragTrack, normalize(rNormal));
@@ -8,25 +8,37 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 view;
     mat4 proj;
     mat4 instanceModels[MAX_INSTANCE];
+    mat3 instanceNormals[MAX_INSTANCE];     // transpose(inverse(model)), filled on the cpu
 } ubo;
 
 
 struct OutputBlock {
-    int outNormalMapIdx;
-    int textForm[2];
-    int pbrs[3];
-    mat4 outNormalMatrix;
+    mat3 outNormalMatrix;
     vec3 fragTrack;
 };
 
 
+// --vertex-format compact: 16 bit unorm positions, octahedral normals
+layout(constant_id = 0) const bool COMPACT_VERTEX = false;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+layout(push_constant) uniform MaterialPush {
+    vec4 positionScale;     // compact positions are relative to the mesh bounds
+    vec4 positionOffset;
+    int materialIdx;
+} pc;
+
 // INS:
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 texCoord;
-layout(location = 3) in vec3 textureMapIdxs;
-layout(location = 4) in vec2 inNormalMapIdx;
-layout(location = 5) in vec3 pbrs;
 
 
 // OUTS:
@@ -36,26 +48,22 @@ layout(location = 2) out vec3 fragWorldPos;
 layout(location = 3) out OutputBlock outputData;
 
 void main() {
-    mat4 normalMatrix = transpose(inverse(ubo.instanceModels[gl_InstanceIndex]));
-    vec4 after_Pos = ubo.instanceModels[gl_InstanceIndex] * vec4(inPosition, 1.0);
+    vec3 position = COMPACT_VERTEX ? inPosition * pc.positionScale.xyz + pc.positionOffset.xyz : inPosition;
+    vec3 normal = COMPACT_VERTEX ? octDecode(inNormal.xy) : inNormal;
+    mat3 normalMatrix = ubo.instanceNormals[gl_InstanceIndex];
+    vec4 after_Pos = ubo.instanceModels[gl_InstanceIndex] * vec4(position, 1.0);
     gl_Position = ubo.proj * ubo.view * after_Pos;
 
     fragWorldPos = after_Pos.xyz;
 
-    vec3 rNormal = mat3(normalMatrix) * inNormal;
+    vec3 rNormal = normalMatrix * normal;
     fragTexCoord = texCoord;
 
-    outputData.textForm[0] = int(textureMapIdxs[2]);
-    outputData.textForm[1] = int(textureMapIdxs[0]);
 
     fragNormal = rNormal;    
     outputData.outNormalMatrix = normalMatrix;
-    outputData.outNormalMapIdx = int(inNormalMapIdx[0]);
     
     vec3 in_dir = ubo.cameraPos - after_Pos.xyz;
     outputData.fragTrack = in_dir;
 
-    outputData.pbrs[0] = int(pbrs[0]);
-    outputData.pbrs[1] = int(pbrs[1]);
-    outputData.pbrs[2] = int(pbrs[2]);
 }
\ No newline at end of file
@@ -1,7 +1,13 @@
 #version 450
 
+// built twice, vert_multiview.spv defines MULTIVIEW and draws all six cube faces in one pass
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : require
+#endif
+
 const int MAX_LIGHT = 8;
 const int MAX_INSTANCE = 32;
+const int SUN_CASCADES = 4;
 
 layout(binding = 0) uniform LightUniformBufferObject {
     vec4 lightPos[MAX_LIGHT];
@@ -13,6 +19,11 @@ layout(binding = 0) uniform LightUniformBufferObject {
 
     vec4 metadata1[MAX_LIGHT];
     vec4 metadata2[MAX_LIGHT];
+    vec4 shadowRects[MAX_LIGHT];      // spot tile (offset, scale) in the shadow atlas
+    mat4 cascadeMatrices[MAX_LIGHT * SUN_CASCADES];     // proj * view of every sun cascade
+
+    mat4 cubeFaceViews[MAX_LIGHT * 6];
+    uvec4 cubeFaceMasks[MAX_LIGHT * MAX_INSTANCE / 4];     // bit per cube face an instance touches
 } lubo;
 
 layout(binding = 1) uniform UniformBufferObject {
@@ -21,53 +32,81 @@ layout(binding = 1) uniform UniformBufferObject {
     mat4 view;
     mat4 proj;
     mat4 instanceModels[MAX_INSTANCE];
+    mat3 instanceNormals[MAX_INSTANCE];     // transpose(inverse(model)), filled on the cpu
 } ubo;
 
 layout(push_constant) uniform PushConsts 
 {
     int lightIdx;
-	mat4 view;
-    mat4 proj;
+    int face;               // cube face of a sphere light or cascade of a sun, unused with MULTIVIEW
+    vec4 positionScale;     // per mesh, see MeshPushConstants
+    vec4 positionOffset;
 } pushConsts;
 
+// --vertex-format compact: 16 bit unorm positions, octahedral normals
+layout(constant_id = 0) const bool COMPACT_VERTEX = false;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+// binding 0 only, the shading attributes are not bound for shadow passes
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
 
+// depth only, there is no fragment stage for spot lights
 void setUpSpotLight(int lightIdx, vec4 tr_pos, vec3 rNormal) {
-    vec3 curLightPos = lubo.lightPos[lightIdx].xyz;
     mat4 curViewMat = lubo.lightViewMatrix[lightIdx];
     mat4 curProjMat = lubo.lightProjMatrix[lightIdx];
 
     vec3 r_pos = tr_pos.xyz - rNormal * 0.05;
-    gl_Position = curProjMat * curViewMat * vec4(r_pos, 1.0);  // old version
-
-    float depth = length(curLightPos - r_pos);
-    
-    // limit is at index-2
-    float d_val = depth / lubo.metadata1[lightIdx][2];
-
-    fragColor = vec3(d_val, d_val, d_val);
+    gl_Position = curProjMat * curViewMat * vec4(r_pos, 1.0);
 }
 
 void setUpSphereLight(int lightIdx, vec4 tr_pos, vec3 rNormal) {
     vec3 curLightPos = lubo.lightPos[lightIdx].xyz;
     float limit = lubo.metadata1[lightIdx][1];
 
+#ifdef MULTIVIEW
+    int face = int(gl_ViewIndex);
+#else
+    int face = pushConsts.face;
+#endif
+
+    // instance culled for this face: every vertex lands on the same point outside the clip volume
+    int maskIdx = lightIdx * MAX_INSTANCE + gl_InstanceIndex;
+    if ((lubo.cubeFaceMasks[maskIdx / 4][maskIdx % 4] & (1u << face)) == 0u) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        fragColor = vec3(1.0);
+        return;
+    }
+
     vec3 r_pos = tr_pos.xyz - rNormal * 0.08;
-    gl_Position = pushConsts.proj * pushConsts.view * vec4(r_pos, 1.0); 
+    gl_Position = lubo.lightProjMatrix[lightIdx] * lubo.cubeFaceViews[lightIdx * 6 + face] * vec4(r_pos, 1.0);
 
     float dist = length(curLightPos - r_pos);
     float d_val = dist / limit;
     fragColor = vec3(d_val, d_val, d_val);
 }
 
+// depth only like spots, one cascade per pass
+void setUpSunLight(int lightIdx, vec4 tr_pos, vec3 rNormal) {
+    vec3 r_pos = tr_pos.xyz - rNormal * 0.05;
+    gl_Position = lubo.cascadeMatrices[lightIdx * SUN_CASCADES + pushConsts.face] * vec4(r_pos, 1.0);
+}
+
 void main() {
-    mat4 normalMatrix = transpose(inverse(ubo.instanceModels[gl_InstanceIndex]));
-    vec4 tr_pos = ubo.instanceModels[gl_InstanceIndex] * vec4(inPosition, 1.0);
-    vec3 rNormal = mat3(normalMatrix) * inNormal;
+    vec3 position = COMPACT_VERTEX ? inPosition * pushConsts.positionScale.xyz + pushConsts.positionOffset.xyz : inPosition;
+    vec3 normal = COMPACT_VERTEX ? octDecode(inNormal.xy) : inNormal;
+    mat3 normalMatrix = ubo.instanceNormals[gl_InstanceIndex];
+    vec4 tr_pos = ubo.instanceModels[gl_InstanceIndex] * vec4(position, 1.0);
+    vec3 rNormal = normalMatrix * normal;
 
     // int lightIdx = int(lubo.metadata2[0][0]);
     int lightIdx = pushConsts.lightIdx;
@@ -82,5 +121,9 @@ void main() {
         // sphere light
         setUpSphereLight(lightIdx, tr_pos, rNormal);
     }
+    else if (lightType == 2) {
+        // sun light
+        setUpSunLight(lightIdx, tr_pos, rNormal);
+    }
 
 }
\ No newline at end of file
@@ -1,4 +1,14 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+// shadow samplers are indexed by the cluster's lights, which differ between neighbouring fragments.
+// frag_nonuniform.spv is built with NONUNIFORM_INDEXING for devices with non uniform sampled image indexing
+#ifdef NONUNIFORM_INDEXING
+#extension GL_EXT_nonuniform_qualifier : require
+#define NONUNIFORM(i) nonuniformEXT(i)
+#else
+#define NONUNIFORM(i) (i)
+#endif
 
 const int MAX_LIGHT = 8;
 
@@ -12,29 +22,87 @@ layout(binding = 3) uniform LightUniformBufferObject {
 
     vec4 metadata1[MAX_LIGHT];  // radius - fov/2 - limit - blend
     vec4 metadata2[MAX_LIGHT];
+    vec4 shadowRects[MAX_LIGHT];      // spot tile (offset, scale) in the shadow atlas
 } lubo;
 
-layout(binding = 4) uniform sampler2D shadowMapSampler[MAX_LIGHT];
+layout(binding = 4) uniform sampler2DShadow shadowMapSampler[MAX_LIGHT];
 layout(binding = 5) uniform samplerCube shadowCubeMapSampler[MAX_LIGHT];
+layout(binding = 7) uniform sampler2D shadowDepthSampler[MAX_LIGHT];       // same maps, no compare
+
+// every light in the scene, shadow casters first. color.a is the light's slot in lubo, -1 without shadows
+struct ClusterLight {
+    vec4 position;      // xyz, w is the type
+    vec4 direction;     // xyz, w is the power
+    vec4 color;
+    vec4 metadata;      // radius - fov/2 - limit - blend for spots, radius - limit for spheres
+};
+
+layout(std430, binding = 8) readonly buffer LightBuffer {
+    ClusterLight lights[];
+} sceneLights;
+
+// froxel grid over the main viewport, depth slices are logarithmic between the camera's near and far
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 9;
+const int CLUSTER_Z = 24;
+
+layout(std430, binding = 9) readonly buffer ClusterBuffer {
+    vec4 viewport;      // x, y, 1 / width, 1 / height
+    vec4 cameraPos;     // w is near
+    vec4 cameraDir;     // w is far
+    uvec4 lightCounts;  // x is the number of suns leading the light buffer
+    uvec2 ranges[CLUSTER_X * CLUSTER_Y * CLUSTER_Z];     // (first, count) in indices
+    uint indices[];
+} clusters;
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec3 worldPos;
 
 layout(location = 0) out vec4 outColor;
 
+// spot maps hold [0, 1] depth from lightProjMatrix
+float spotViewDepth(mat4 proj, float depth) {
+    return proj[3][2] / (depth + proj[2][2]);
+}
+
+// spot map uv into the light's tile, clamped half a texel inside so filtering never reads a neighbouring tile
+vec2 spotShadowUV(int shadowIdx, vec2 uv) {
+    float size = lubo.metadata2[shadowIdx].w;
+    vec4 rect = lubo.shadowRects[shadowIdx];
+    return rect.xy + clamp(uv, vec2(0.5 / size), vec2(1.0 - 0.5 / size)) * rect.zw;
+}
+
+#include "../common/pcss.glsl"
+
+// the lights binned into the cluster this fragment falls in
+uvec2 clusterRange(vec3 pos) {
+    vec2 screen = (gl_FragCoord.xy - clusters.viewport.xy) * clusters.viewport.zw;
+    float zNear = clusters.cameraPos.w;
+    float zFar = clusters.cameraDir.w;
+    float depth = max(dot(pos - clusters.cameraPos.xyz, clusters.cameraDir.xyz), zNear);
+    int x = clamp(int(screen.x * CLUSTER_X), 0, CLUSTER_X - 1);
+    int y = clamp(int(screen.y * CLUSTER_Y), 0, CLUSTER_Y - 1);
+    int z = clamp(int(log(depth / zNear) / log(zFar / zNear) * CLUSTER_Z), 0, CLUSTER_Z - 1);
+    return clusters.ranges[(z * CLUSTER_Y + y) * CLUSTER_X + x];
+}
+
 
-vec3 renderSphere(int lightIdx, int sphere_idx) {
-    vec3 curLightPos = lubo.lightPos[lightIdx].xyz;
+vec3 renderSphere(int lightIdx) {
+    // lubo slot of the light's shadow, clamped so unshadowed lights still index in bounds
+    int shadowIdx = int(sceneLights.lights[lightIdx].color.a);
+    bool shadowed = shadowIdx >= 0;
+    shadowIdx = max(shadowIdx, 0);
+    vec3 curLightPos = sceneLights.lights[lightIdx].position.xyz;
     vec3 dir = normalize(worldPos - curLightPos);
-    float limit = lubo.metadata1[lightIdx][1];
-    float power = lubo.lightDir[lightIdx].w;
+    float limit = sceneLights.lights[lightIdx].metadata[1];
+    float power = sceneLights.lights[lightIdx].direction.w;
 
-    float stored_pre_d = texture(shadowCubeMapSampler[sphere_idx], dir).r;
+    float stored_pre_d = texture(shadowCubeMapSampler[NONUNIFORM(int(lubo.metadata2[shadowIdx].x))], dir).r;
     float storedDepth = stored_pre_d * limit;
 
     float curDistance = length(worldPos - curLightPos);
 
-    if (curDistance < storedDepth) {
+    if (!shadowed || curDistance < storedDepth) {
         return fragColor;
     } else {
         return vec3(0.0, 0.0, 0.0);
@@ -43,19 +111,22 @@ vec3 renderSphere(int lightIdx, int sphere_idx) {
     float dis_dec_factor = max(0, pow(1 - (curDistance / limit), 4));
     dis_dec_factor *= power / (4 * 3.1415926 * pow(curDistance, 2));
     vec3 fct = vec3(dis_dec_factor, dis_dec_factor, dis_dec_factor);
-    fct *= vec3(lubo.lightColor[lightIdx].xyz);
+    fct *= vec3(sceneLights.lights[lightIdx].color.xyz);
 
     return fragColor * fct;
 }
 
 
-vec3 renderSpot(int lightIdx, int spot_idx) {
-    vec3 curLightPos = lubo.lightPos[lightIdx].xyz;
-    vec3 curLightDir = lubo.lightDir[lightIdx].xyz;
-    mat4 curViewMat = lubo.lightViewMatrix[lightIdx];   
-    mat4 curProjMat = lubo.lightProjMatrix[lightIdx];
-    float halfFov = lubo.metadata1[lightIdx][1];
-    float shadowMapSize = lubo.metadata2[lightIdx].w;
+vec3 renderSpot(int lightIdx) {
+    // lubo slot of the light's shadow, clamped so unshadowed lights still index in bounds
+    int shadowIdx = int(sceneLights.lights[lightIdx].color.a);
+    bool shadowed = shadowIdx >= 0;
+    shadowIdx = max(shadowIdx, 0);
+    vec3 curLightPos = sceneLights.lights[lightIdx].position.xyz;
+    vec3 curLightDir = sceneLights.lights[lightIdx].direction.xyz;
+    mat4 curViewMat = lubo.lightViewMatrix[shadowIdx];   
+    mat4 curProjMat = lubo.lightProjMatrix[shadowIdx];
+    float halfFov = sceneLights.lights[lightIdx].metadata[1];
 
     vec3 ptr = worldPos - curLightPos;
     float viewAngle = acos(dot(normalize(ptr), curLightDir));
@@ -71,55 +142,16 @@ vec3 renderSpot(int lightIdx, int spot_idx) {
     float u = (frag_coord[0]/frag_coord[3] + 1.0) / 2.0;
     float v = (frag_coord[1]/frag_coord[3] + 1.0) / 2.0;
 
-    int diff = 1;
-    int tt_num = 0;
-    float avgDepth = 0.0;
-
-    float pcfVal = 0.0;
-
-    for (int i=-diff; i<=diff; i++) {
-        for (int j=-diff; j<=diff; j++) {
-            float stored_pre_d = texture(shadowMapSampler[spot_idx], vec2(u+float(i)/shadowMapSize, v+float(j)/shadowMapSize)).r;
-            float storedDepth = stored_pre_d * lubo.metadata1[lightIdx][2];
-
-            if (storedDepth < curDistance) {
-                avgDepth += storedDepth;
-                ++tt_num;
-            }
-        }
-    }
-
-    avgDepth /= float(tt_num);
-
-    if (tt_num == 0) {
-        pcfVal = 1.0;
-    }
-    else {
-        float lightRadius = lubo.metadata1[lightIdx][0];
-        float frac1 = (curDistance - avgDepth) / avgDepth;
-        float w = shadowMapSize * lightRadius * frac1 / (curDistance * tan(halfFov));
-        int rw = int(w) / 4;
-
-        rw = min(10, rw);
-
-        tt_num = 0;
-        for (int i=-rw; i<=rw; i++) {
-            for (int j=-rw; j<=rw; j++) {
-                float stored_pre_d = texture(shadowMapSampler[spot_idx], vec2(u+float(i)/shadowMapSize, v+float(j)/shadowMapSize)).r;
-                float storedDepth = stored_pre_d * lubo.metadata1[lightIdx][2];
-
-                if (curDistance <= storedDepth) {
-                    pcfVal += 1.0;
-                }
-                tt_num++;
-            }
-        }
-        pcfVal /= float(tt_num);
+    float pcfVal = 1.0;
+    if (shadowed) {
+        // blocker search and penumbra in light view depth
+        float lightRadius = sceneLights.lights[lightIdx].metadata[0];
+        pcfVal = spotPCSS(shadowIdx, curProjMat, vec2(u, v), frag_coord[3], frag_coord[2] / frag_coord[3], lightRadius, halfFov, 1.0, 0.25, 10.0);
     }
 
     vec3 res = vec3(pcfVal, pcfVal, pcfVal) * fragColor;
 
-    float blend = lubo.metadata1[lightIdx][3];
+    float blend = sceneLights.lights[lightIdx].metadata[3];
     float edge = halfFov*(1-blend);
     if (viewAngle > edge) {
         float px = viewAngle - edge;
@@ -129,9 +161,9 @@ vec3 renderSpot(int lightIdx, int spot_idx) {
         res *= eft;
     }
 
-    float dis_dec_factor = pow(1 - (curDistance / lubo.metadata1[lightIdx][2]), 4);
+    float dis_dec_factor = pow(1 - (curDistance / sceneLights.lights[lightIdx].metadata[2]), 4);
     vec3 fct = vec3(dis_dec_factor, dis_dec_factor, dis_dec_factor);
-    vec3 colorFct = vec3(lubo.lightColor[lightIdx].xyz);
+    vec3 colorFct = vec3(sceneLights.lights[lightIdx].color.xyz);
     res *= fct * colorFct;
     
     return res;
@@ -141,23 +173,21 @@ vec3 renderSpot(int lightIdx, int spot_idx) {
 void main() {
 
     float bias = 0.0;
-    int totalLightCount = int(lubo.metadata2[0][2]);
-    int sphere_idx = 0;
-    int spot_idx = 0;
+    uvec2 lightRange = clusterRange(worldPos);
 
     outColor = vec4(0.0, 0.0, 0.0, 1.0);
 
-    for (int lightIdx = 0; lightIdx < totalLightCount; lightIdx++) {
-        int lightType = int(lubo.lightPos[lightIdx].w);
+    for (uint k = 0; k < lightRange.y; k++) {
+        int lightIdx = int(clusters.indices[lightRange.x + k]);
+        int lightType = int(sceneLights.lights[lightIdx].position.w);
 
         // for sphere light
         if (lightType == 1) {
-            vec3 res = renderSphere(lightIdx, sphere_idx);
+            vec3 res = renderSphere(lightIdx);
             outColor += vec4(res, 1.0);
-            ++sphere_idx;
         }
         else if (lightType == 0) {
-            renderSpot(lightIdx, spot_idx);
+            renderSpot(lightIdx);
         }
 
         
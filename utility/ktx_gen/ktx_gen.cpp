@@ -0,0 +1,581 @@
+/**
+ * Converts a PNG texture (or a WIDTH*(WIDTH*6) cubemap strip) into a KTX2 file with a full mip chain,
+ * block compressed to BC1, BC3, BC5 or BC7. The viewer picks up <name>.ktx2 next to <name>.png.
+ *
+ * compile: g++ -std=c++20 -O2 -fopenmp -o ktx_gen ktx_gen.cpp -I"D:/STUDY/Libs/stb"
+ * usage:   ./ktx_gen <in.png> [--bc1|--bc3|--bc5|--bc7] [--cube] [--linear]
+ *          bc7 is the default. bc5 keeps only red/green (normal maps, the shader has to rebuild z).
+ *          --linear for data textures (normal, roughness, metalness), color textures stay sRGB.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// VkFormat values, the tool does not depend on the vulkan headers
+constexpr uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+constexpr uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+constexpr uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+constexpr uint32_t VK_FORMAT_BC3_SRGB_BLOCK = 138;
+constexpr uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+constexpr uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+constexpr uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+
+// khr data format descriptor constants
+constexpr uint8_t KHR_DF_MODEL_BC1A = 128;
+constexpr uint8_t KHR_DF_MODEL_BC3 = 130;
+constexpr uint8_t KHR_DF_MODEL_BC5 = 132;
+constexpr uint8_t KHR_DF_MODEL_BC7 = 134;
+constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+constexpr uint8_t KHR_DF_CHANNEL_COLOR = 0;
+constexpr uint8_t KHR_DF_CHANNEL_GREEN = 1;
+constexpr uint8_t KHR_DF_CHANNEL_ALPHA = 15;
+
+enum class BlockFormat { bc1, bc3, bc5, bc7 };
+
+struct Image {
+    int width, height;
+    std::vector<uint8_t> rgba;
+};
+
+struct Rgba {
+    uint8_t c[4];
+};
+
+// ---------------------------------------------------------------- mip chain
+
+float srgbToLinear(uint8_t v) {
+    float c = v / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+uint8_t linearToSrgb(float c) {
+    c = std::clamp(c, 0.0f, 1.0f);
+    float v = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::lround(v * 255.0f));
+}
+
+// 2x2 box filter, color is averaged in linear space for srgb textures
+Image downsample(const Image& src, bool srgb) {
+    Image dst;
+    dst.width = std::max(src.width / 2, 1);
+    dst.height = std::max(src.height / 2, 1);
+    dst.rgba.resize(static_cast<size_t>(dst.width) * dst.height * 4);
+
+    for (int y = 0; y < dst.height; y++) {
+        for (int x = 0; x < dst.width; x++) {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    int sx = std::min(x * 2 + dx, src.width - 1);
+                    int sy = std::min(y * 2 + dy, src.height - 1);
+                    const uint8_t* p = &src.rgba[(static_cast<size_t>(sy) * src.width + sx) * 4];
+                    for (int c = 0; c < 4; c++) {
+                        sum[c] += (srgb && c < 3) ? srgbToLinear(p[c]) : p[c] / 255.0f;
+                    }
+                }
+            }
+            uint8_t* q = &dst.rgba[(static_cast<size_t>(y) * dst.width + x) * 4];
+            for (int c = 0; c < 4; c++) {
+                float avg = sum[c] / 4.0f;
+                q[c] = (srgb && c < 3) ? linearToSrgb(avg) : static_cast<uint8_t>(std::lround(std::clamp(avg, 0.0f, 1.0f) * 255.0f));
+            }
+        }
+    }
+    return dst;
+}
+
+// 4x4 block at (bx, by), edges are clamped for mips smaller than a block
+void fetchBlock(const Image& image, int bx, int by, Rgba block[16]) {
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int sx = std::min(bx * 4 + x, image.width - 1);
+            int sy = std::min(by * 4 + y, image.height - 1);
+            memcpy(block[y * 4 + x].c, &image.rgba[(static_cast<size_t>(sy) * image.width + sx) * 4], 4);
+        }
+    }
+}
+
+// ---------------------------------------------------------------- block encoders
+
+// principal axis of the block colors over `channels`, endpoints are the extreme projections
+void principalEndpoints(const Rgba block[16], int channels, float lo[4], float hi[4]) {
+    float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < channels; c++) {
+            mean[c] += block[i].c[c] / 16.0f;
+        }
+    }
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++) {
+                cov[a][b] += (block[i].c[a] - mean[a]) * (block[i].c[b] - mean[b]);
+            }
+        }
+    }
+    // a few power iterations are plenty for a 4x4 block
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int iter = 0; iter < 8; iter++) {
+        float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++) {
+                next[a] += cov[a][b] * axis[b];
+            }
+        }
+        float len = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            len += next[c] * next[c];
+        }
+        if (len < 1e-8f) {
+            break;
+        }
+        len = std::sqrt(len);
+        for (int c = 0; c < channels; c++) {
+            axis[c] = next[c] / len;
+        }
+    }
+
+    float tMin = 0.0f, tMax = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            t += (block[i].c[c] - mean[c]) * axis[c];
+        }
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    for (int c = 0; c < channels; c++) {
+        lo[c] = std::clamp(mean[c] + tMin * axis[c], 0.0f, 255.0f);
+        hi[c] = std::clamp(mean[c] + tMax * axis[c], 0.0f, 255.0f);
+    }
+}
+
+uint16_t packRgb565(const float c[3]) {
+    uint16_t r = static_cast<uint16_t>(std::lround(c[0] * 31.0f / 255.0f));
+    uint16_t g = static_cast<uint16_t>(std::lround(c[1] * 63.0f / 255.0f));
+    uint16_t b = static_cast<uint16_t>(std::lround(c[2] * 31.0f / 255.0f));
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpackRgb565(uint16_t v, int c[3]) {
+    c[0] = ((v >> 11) & 31) * 255 / 31;
+    c[1] = ((v >> 5) & 63) * 255 / 63;
+    c[2] = (v & 31) * 255 / 31;
+}
+
+// bc1 in four color mode, 8 bytes
+void encodeBC1(const Rgba block[16], uint8_t* out) {
+    float lo[4], hi[4];
+    principalEndpoints(block, 3, lo, hi);
+    uint16_t c0 = packRgb565(hi);
+    uint16_t c1 = packRgb565(lo);
+    if (c0 < c1) {
+        std::swap(c0, c1);
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int e0[3], e1[3];
+        unpackRgb565(c0, e0);
+        unpackRgb565(c1, e1);
+        int palette[4][3];
+        for (int c = 0; c < 3; c++) {
+            palette[0][c] = e0[c];
+            palette[1][c] = e1[c];
+            palette[2][c] = (2 * e0[c] + e1[c]) / 3;
+            palette[3][c] = (e0[c] + 2 * e1[c]) / 3;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < 4; p++) {
+                int error = 0;
+                for (int c = 0; c < 3; c++) {
+                    int d = block[i].c[c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= static_cast<uint32_t>(best) << (i * 2);
+        }
+    }
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+// bc4 style single channel block in eight value mode, 8 bytes. used for bc3 alpha and both bc5 channels
+void encodeBC4(const Rgba block[16], int channel, uint8_t* out) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        a0 = std::max(a0, static_cast<int>(block[i].c[channel]));
+        a1 = std::min(a1, static_cast<int>(block[i].c[channel]));
+    }
+    out[0] = static_cast<uint8_t>(a0);
+    out[1] = static_cast<uint8_t>(a1);
+
+    uint64_t indices = 0;
+    if (a0 != a1) {
+        int palette[8] = { a0, a1 };
+        for (int k = 1; k < 7; k++) {
+            palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < 8; p++) {
+                int error = std::abs(block[i].c[channel] - palette[p]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= static_cast<uint64_t>(best) << (i * 3);
+        }
+    }
+    for (int b = 0; b < 6; b++) {
+        out[2 + b] = static_cast<uint8_t>(indices >> (b * 8));
+    }
+}
+
+void encodeBC3(const Rgba block[16], uint8_t* out) {
+    encodeBC4(block, 3, out);
+    encodeBC1(block, out + 8);
+}
+
+void encodeBC5(const Rgba block[16], uint8_t* out) {
+    encodeBC4(block, 0, out);
+    encodeBC4(block, 1, out + 8);
+}
+
+// little endian bit writer for bc7
+struct BitWriter {
+    uint8_t* out;
+    int pos = 0;
+    void write(uint32_t value, int bits) {
+        for (int b = 0; b < bits; b++, pos++) {
+            if (value & (1u << b)) {
+                out[pos >> 3] |= static_cast<uint8_t>(1u << (pos & 7));
+            }
+        }
+    }
+};
+
+// bc7 mode 6: one subset, rgba 7.7.7.7 endpoints with a p-bit each, 4 bit indices. 16 bytes
+void encodeBC7(const Rgba block[16], uint8_t* out) {
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    float lo[4], hi[4];
+    principalEndpoints(block, 4, lo, hi);
+
+    // pick each endpoint's p-bit for the smallest quantization error
+    int q[2][4], p[2];
+    int e[2][4];
+    const float* ends[2] = { lo, hi };
+    for (int k = 0; k < 2; k++) {
+        float bestError = 1e30f;
+        for (int pbit = 0; pbit < 2; pbit++) {
+            float error = 0.0f;
+            int candidate[4];
+            for (int c = 0; c < 4; c++) {
+                candidate[c] = std::clamp(static_cast<int>(std::lround((ends[k][c] - pbit) / 2.0f)), 0, 127);
+                float d = ends[k][c] - static_cast<float>((candidate[c] << 1) | pbit);
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                p[k] = pbit;
+                memcpy(q[k], candidate, sizeof(candidate));
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            e[k][c] = (q[k][c] << 1) | p[k];
+        }
+    }
+
+    int palette[16][4];
+    for (int w = 0; w < 16; w++) {
+        for (int c = 0; c < 4; c++) {
+            palette[w][c] = ((64 - weights[w]) * e[0][c] + weights[w] * e[1][c] + 32) >> 6;
+        }
+    }
+    int indices[16];
+    for (int i = 0; i < 16; i++) {
+        int best = 0, bestError = INT32_MAX;
+        for (int w = 0; w < 16; w++) {
+            int error = 0;
+            for (int c = 0; c < 4; c++) {
+                int d = block[i].c[c] - palette[w][c];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                best = w;
+            }
+        }
+        indices[i] = best;
+    }
+
+    // the anchor index (pixel 0) is stored with 3 bits, so its top bit must be zero
+    if (indices[0] & 8) {
+        std::swap(q[0], q[1]);
+        std::swap(p[0], p[1]);
+        for (int i = 0; i < 16; i++) {
+            indices[i] = 15 - indices[i];
+        }
+    }
+
+    memset(out, 0, 16);
+    BitWriter writer{ out };
+    writer.write(1u << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        writer.write(q[0][c], 7);
+        writer.write(q[1][c], 7);
+    }
+    writer.write(p[0], 1);
+    writer.write(p[1], 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        writer.write(indices[i], 4);
+    }
+}
+
+size_t blockBytes(BlockFormat format) {
+    return (format == BlockFormat::bc1) ? 8 : 16;
+}
+
+std::vector<uint8_t> compress(const Image& image, BlockFormat format) {
+    int blocksX = (image.width + 3) / 4;
+    int blocksY = (image.height + 3) / 4;
+    size_t size = blockBytes(format);
+    std::vector<uint8_t> data(static_cast<size_t>(blocksX) * blocksY * size);
+
+#pragma omp parallel for
+    for (int by = 0; by < blocksY; by++) {
+        Rgba block[16];
+        for (int bx = 0; bx < blocksX; bx++) {
+            fetchBlock(image, bx, by, block);
+            uint8_t* out = &data[(static_cast<size_t>(by) * blocksX + bx) * size];
+            switch (format) {
+            case BlockFormat::bc1: encodeBC1(block, out); break;
+            case BlockFormat::bc3: encodeBC3(block, out); break;
+            case BlockFormat::bc5: encodeBC5(block, out); break;
+            case BlockFormat::bc7: encodeBC7(block, out); break;
+            }
+        }
+    }
+    return data;
+}
+
+// ---------------------------------------------------------------- ktx2 writer
+
+template <typename T>
+void put(std::vector<uint8_t>& bytes, T value) {
+    uint8_t raw[sizeof(T)];
+    memcpy(raw, &value, sizeof(T));
+    bytes.insert(bytes.end(), raw, raw + sizeof(T));
+}
+
+// basic data format descriptor for the block compressed format
+std::vector<uint8_t> makeDfd(BlockFormat format, bool srgb) {
+    struct Sample {
+        uint16_t bitOffset;
+        uint8_t bitLength;
+        uint8_t channel;
+    };
+    std::vector<Sample> samples;
+    uint8_t model = 0;
+    switch (format) {
+    case BlockFormat::bc1: model = KHR_DF_MODEL_BC1A; samples = { { 0, 63, KHR_DF_CHANNEL_COLOR } }; break;
+    case BlockFormat::bc3: model = KHR_DF_MODEL_BC3; samples = { { 0, 63, KHR_DF_CHANNEL_ALPHA }, { 64, 63, KHR_DF_CHANNEL_COLOR } }; break;
+    case BlockFormat::bc5: model = KHR_DF_MODEL_BC5; samples = { { 0, 63, KHR_DF_CHANNEL_COLOR }, { 64, 63, KHR_DF_CHANNEL_GREEN } }; break;
+    case BlockFormat::bc7: model = KHR_DF_MODEL_BC7; samples = { { 0, 127, KHR_DF_CHANNEL_COLOR } }; break;
+    }
+
+    uint16_t blockSize = static_cast<uint16_t>(24 + 16 * samples.size());
+    std::vector<uint8_t> dfd;
+    put<uint32_t>(dfd, 4 + blockSize);
+    put<uint32_t>(dfd, 0);                  // vendor khronos, descriptor type basic
+    put<uint16_t>(dfd, 2);                  // version
+    put<uint16_t>(dfd, blockSize);
+    put<uint8_t>(dfd, model);
+    put<uint8_t>(dfd, KHR_DF_PRIMARIES_BT709);
+    put<uint8_t>(dfd, srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR);
+    put<uint8_t>(dfd, 0);                   // straight alpha
+    put<uint32_t>(dfd, 0x00000303);         // 4x4x1x1 texel block, stored minus one
+    put<uint32_t>(dfd, static_cast<uint32_t>(blockBytes(format)));
+    put<uint32_t>(dfd, 0);
+    for (const auto& sample : samples) {
+        put<uint16_t>(dfd, sample.bitOffset);
+        put<uint8_t>(dfd, sample.bitLength);
+        put<uint8_t>(dfd, sample.channel);
+        put<uint32_t>(dfd, 0);              // sample position
+        put<uint32_t>(dfd, 0);              // lower
+        put<uint32_t>(dfd, 0xFFFFFFFF);     // upper
+    }
+    return dfd;
+}
+
+uint32_t vkFormatOf(BlockFormat format, bool srgb) {
+    switch (format) {
+    case BlockFormat::bc1: return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    case BlockFormat::bc3: return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+    case BlockFormat::bc5: return VK_FORMAT_BC5_UNORM_BLOCK;
+    case BlockFormat::bc7: return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+    }
+    return 0;
+}
+
+// levels[level] holds every face of that level back to back
+void writeKtx2(const std::string& file_name, BlockFormat format, bool srgb, int width, int height, int faceCount,
+               const std::vector<std::vector<uint8_t>>& levels) {
+    static const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+    uint32_t levelCount = static_cast<uint32_t>(levels.size());
+    std::vector<uint8_t> dfd = makeDfd(format, srgb);
+
+    // identifier and header (48 bytes), index (32 bytes), then the level index
+    uint32_t dfdOffset = 80 + levelCount * 24;
+    size_t alignment = blockBytes(format);
+
+    // mips are stored smallest first, each aligned to the block size
+    std::vector<uint64_t> offsets(levelCount);
+    uint64_t cursor = dfdOffset + dfd.size();
+    for (int level = static_cast<int>(levelCount) - 1; level >= 0; level--) {
+        cursor = (cursor + alignment - 1) / alignment * alignment;
+        offsets[level] = cursor;
+        cursor += levels[level].size();
+    }
+
+    std::vector<uint8_t> bytes(identifier, identifier + 12);
+    put<uint32_t>(bytes, vkFormatOf(format, srgb));
+    put<uint32_t>(bytes, 1);                // typeSize
+    put<uint32_t>(bytes, width);
+    put<uint32_t>(bytes, height);
+    put<uint32_t>(bytes, 0);                // pixelDepth
+    put<uint32_t>(bytes, 0);                // layerCount
+    put<uint32_t>(bytes, faceCount);
+    put<uint32_t>(bytes, levelCount);
+    put<uint32_t>(bytes, 0);                // no supercompression
+    put<uint32_t>(bytes, dfdOffset);
+    put<uint32_t>(bytes, static_cast<uint32_t>(dfd.size()));
+    put<uint32_t>(bytes, 0);                // no key/value data
+    put<uint32_t>(bytes, 0);
+    put<uint64_t>(bytes, 0);                // no supercompression global data
+    put<uint64_t>(bytes, 0);
+    for (uint32_t level = 0; level < levelCount; level++) {
+        put<uint64_t>(bytes, offsets[level]);
+        put<uint64_t>(bytes, levels[level].size());
+        put<uint64_t>(bytes, levels[level].size());
+    }
+    bytes.insert(bytes.end(), dfd.begin(), dfd.end());
+    for (int level = static_cast<int>(levelCount) - 1; level >= 0; level--) {
+        bytes.resize(offsets[level], 0);
+        bytes.insert(bytes.end(), levels[level].begin(), levels[level].end());
+    }
+
+    std::ofstream file(file_name, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("could not write " + file_name);
+    }
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+// ---------------------------------------------------------------- main
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: ./ktx_gen <in.png> [--bc1|--bc3|--bc5|--bc7] [--cube] [--linear]" << std::endl;
+        return 1;
+    }
+
+    std::string in_file = argv[1];
+    BlockFormat format = BlockFormat::bc7;
+    bool cube = false;
+    bool srgb = true;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bc1") format = BlockFormat::bc1;
+        else if (arg == "--bc3") format = BlockFormat::bc3;
+        else if (arg == "--bc5") format = BlockFormat::bc5;
+        else if (arg == "--bc7") format = BlockFormat::bc7;
+        else if (arg == "--cube") cube = true;
+        else if (arg == "--linear") srgb = false;
+        else {
+            std::cerr << "Error: unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (format == BlockFormat::bc5) {
+        srgb = false;
+    }
+
+    int width, height, channels;
+    unsigned char* image_data = stbi_load(in_file.c_str(), &width, &height, &channels, 4);
+    if (!image_data) {
+        std::cerr << "Error: could not load image " << in_file << std::endl;
+        return 1;
+    }
+
+    // cubemap strips are WIDTH x WIDTH*6 with the faces stacked vertically
+    int faceCount = cube ? 6 : 1;
+    if (cube && height != width * 6) {
+        std::cerr << "Error: cubemap strip must be WIDTH x WIDTH*6, got " << width << "x" << height << std::endl;
+        stbi_image_free(image_data);
+        return 1;
+    }
+    int faceHeight = height / faceCount;
+
+    std::vector<Image> faces(faceCount);
+    for (int f = 0; f < faceCount; f++) {
+        faces[f].width = width;
+        faces[f].height = faceHeight;
+        size_t faceBytes = static_cast<size_t>(width) * faceHeight * 4;
+        faces[f].rgba.assign(image_data + f * faceBytes, image_data + (f + 1) * faceBytes);
+    }
+    stbi_image_free(image_data);
+
+    std::vector<std::vector<uint8_t>> levels;
+    while (true) {
+        std::vector<uint8_t> level;
+        for (auto& face : faces) {
+            std::vector<uint8_t> blocks = compress(face, format);
+            level.insert(level.end(), blocks.begin(), blocks.end());
+        }
+        levels.push_back(std::move(level));
+        if (faces[0].width == 1 && faces[0].height == 1) {
+            break;
+        }
+        for (auto& face : faces) {
+            face = downsample(face, srgb);
+        }
+    }
+
+    std::string out_file = in_file.substr(0, in_file.find_last_of('.')) + ".ktx2";
+    try {
+        writeKtx2(out_file, format, srgb, width, faceHeight, faceCount, levels);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    size_t total = 0;
+    for (auto& level : levels) {
+        total += level.size();
+    }
+    std::cout << out_file << ": " << width << "x" << faceHeight << (cube ? " cube" : "") << ", " << levels.size() << " mips, "
+              << total << " bytes (png rgba8 was " << static_cast<size_t>(width) * height * 4 << ")" << std::endl;
+}